@@ -0,0 +1,166 @@
+/*
+ * mini_iperf_bench.c
+ *
+ * Loopback benchmark for the Mini-Iperf data path. Sender and receiver run
+ * in the same process over 127.0.0.1, so the result is the ceiling of the
+ * tool itself rather than of any network.
+ *
+ * Every combination of engine x batch depth x stream count x packet size is
+ * run as a short trial, and one CSV row is printed per trial:
+ *
+ *   engine,packet_size,batch,streams,duration_s,tx_packets,rx_packets,
+ *   loss_pct,pps,gbps,cpu_ns_per_pkt,verify
+ *
+ * cpu_ns_per_pkt is the CPU time of the whole process (sender and receiver)
+ * divided by the number of packets received. verify is 0 for runs with -V,
+ * whose payloads are neither written nor checked.
+ */
+#include "mini_iperf.h"
+
+volatile sig_atomic_t stop_flag = 1;
+
+#define MAX_SWEEP 16
+#define RECEIVER_SETUP_US 100000   // Time given to receivers to bind their sockets
+#define RECEIVER_DRAIN_US 100000   // Time given to receivers to drain their queues
+
+/* One sweep dimension, parsed from a comma separated list */
+typedef struct {
+    int values[MAX_SWEEP];
+    int count;
+} sweep_t;
+
+static int parse_list(const char* text, sweep_t* sweep, int is_engine) {
+    char* copy = strdup(text);
+    char* saveptr = NULL;
+    sweep->count = 0;
+    for (char* tok = strtok_r(copy, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        if (sweep->count == MAX_SWEEP) break;
+        int value = is_engine ? parse_engine(tok) : atoi(tok);
+        if (value < 0 || (!is_engine && value == 0)) {
+            fprintf(stderr, "Error: Invalid list value '%s'\n", tok);
+            free(copy);
+            return -1;
+        }
+        sweep->values[sweep->count++] = value;
+    }
+    free(copy);
+    return sweep->count > 0 ? 0 : -1;
+}
+
+static uint64_t process_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Run one sender/receiver pair over loopback and print its CSV row */
+static void run_trial(struct arguments* args) {
+    pthread_t sender, receiver;
+
+    memset(&udp_stats, 0, sizeof(udp_stats));
+    stop_flag = 1;
+
+    pthread_create(&receiver, NULL, udp_recv, args);
+    usleep(RECEIVER_SETUP_US);
+
+    const uint64_t cpu_start = process_cpu_ns();
+    const uint64_t wall_start = get_monotonic_time();
+    pthread_create(&sender, NULL, udp_sendto, args);
+    pthread_join(sender, NULL);
+    const uint64_t wall_end = get_monotonic_time();
+
+    usleep(RECEIVER_DRAIN_US);
+    stop_flag = 0;
+    pthread_join(receiver, NULL);
+    const uint64_t cpu_end = process_cpu_ns();
+
+    const double duration = (wall_end - wall_start) / 1e9;
+    const uint64_t tx = udp_stats.sent_packets;
+    const uint64_t rx = udp_stats.received_packets;
+    const double loss = tx > 0 && tx > rx ? 100.0 * (tx - rx) / tx : 0.0;
+
+    printf("%s,%d,%d,%d,%.3f,%lu,%lu,%.3f,%.0f,%.3f,%.1f,%d\n",
+           engine_name(args->engine), args->packet_size, args->batch_size, args->num_streams,
+           duration, tx, rx, loss,
+           rx / duration,
+           udp_stats.total_bytes * 8.0 / duration / 1e9,
+           rx > 0 ? (double)(cpu_end - cpu_start) / rx : 0.0,
+           args->verify);
+    fflush(stdout);
+}
+
+static void print_bench_help(void) {
+    printf("Mini-Iperf loopback benchmark\n\n");
+    printf("Usage: mini_iperf_bench [options]\n\n");
+    printf("  -t <seconds>    Duration of each trial (default: 1)\n");
+    printf("  -p <port>       Base port, data ports start at port+1 (default: 15201)\n");
+    printf("  -b <bps>        Offered load per trial, 0 = unlimited (default: 0)\n");
+    printf("  -l <list>       Packet sizes to sweep (default: 64,512,1460)\n");
+    printf("  -B <list>       Batch depths to sweep (default: 1,32)\n");
+    printf("  -n <list>       Stream counts to sweep (default: 1,2)\n");
+    printf("  -e <list>       Engines to sweep (default: sendto,mmsg)\n");
+    printf("  -V              Leave payloads unwritten and unchecked\n");
+    printf("  -h              Show this help message\n");
+}
+
+int main(int argc, char* argv[]) {
+    struct arguments args;
+    sweep_t sizes, batches, streams, engines;
+    int opt;
+
+    init_arguments(&args);
+    args.is_client = 1;
+    args.duration = 1;
+    args.port = 15201;
+    args.ip_address = strdup("127.0.0.1");
+
+    parse_list("64,512,1460", &sizes, 0);
+    parse_list("1,32", &batches, 0);
+    parse_list("1,2", &streams, 0);
+    parse_list("sendto,mmsg", &engines, 1);
+
+    while ((opt = getopt(argc, argv, "t:p:b:l:B:n:e:Vh")) != -1) {
+        int rc = 0;
+        switch (opt) {
+            case 't': args.duration = atoi(optarg); rc = args.duration > 0 ? 0 : -1; break;
+            case 'p': args.port = atoi(optarg); rc = args.port > 0 && args.port < 65000 ? 0 : -1; break;
+            case 'b': args.bandwidth = atol(optarg); rc = args.bandwidth >= 0 ? 0 : -1; break;
+            case 'l': rc = parse_list(optarg, &sizes, 0); break;
+            case 'B': rc = parse_list(optarg, &batches, 0); break;
+            case 'n': rc = parse_list(optarg, &streams, 0); break;
+            case 'e': rc = parse_list(optarg, &engines, 1); break;
+            case 'V': args.verify = 0; break;
+            case 'h':
+            default:
+                print_bench_help();
+                free_arguments(&args);
+                return opt == 'h' ? 0 : 1;
+        }
+        if (rc < 0) {
+            fprintf(stderr, "Error: Invalid value for -%c\n", opt);
+            free_arguments(&args);
+            return 1;
+        }
+    }
+
+    args.data_port = args.port + 1;
+    printf("engine,packet_size,batch,streams,duration_s,tx_packets,rx_packets,"
+           "loss_pct,pps,gbps,cpu_ns_per_pkt,verify\n");
+    for (int e = 0; e < engines.count; e++) {
+        for (int b = 0; b < batches.count; b++) {
+            for (int n = 0; n < streams.count; n++) {
+                for (int l = 0; l < sizes.count; l++) {
+                    args.engine = engines.values[e];
+                    args.batch_size = batches.values[b];
+                    args.num_streams = streams.values[n];
+                    args.packet_size = sizes.values[l];
+                    if (args.batch_size > MAX_BATCH_SIZE) continue;
+                    run_trial(&args);
+                }
+            }
+        }
+    }
+
+    free_arguments(&args);
+    return 0;
+}
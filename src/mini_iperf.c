@@ -18,10 +18,9 @@ extern int server_socket;
 
 /* Global variables */
 int who = UNDEFINED;
-int line=0;
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_t server_recv_thread, server_send_thread,client_send_thread,client_recv_thread;
+pthread_t client_send_thread;
 pthread_t udp_sender_thread, udp_receiver_thread;
+pthread_t probe_echo_thread;
 volatile sig_atomic_t stop_flag = 1;
 /**
  * Signal handler for SIGINT (Ctrl+C)
@@ -62,6 +61,19 @@ struct arguments args;
     }
      duration = args.duration;
 
+    // All reports go through the results writer thread
+    if (results_start(&args) != 0) {
+        free_arguments(&args);
+        return 1;
+    }
+    results_emit_config(&args);
+    // Live counters for monitoring, for as long as the process runs
+    if (args.metrics_port > 0 && metrics_start(&args) != 0) {
+        results_stop();
+        free_arguments(&args);
+        return 1;
+    }
+
 
     if (args.is_server) {
         server_socket = server_start(args.ip_address,args.port);
@@ -70,32 +82,29 @@ struct arguments args;
             return 1;
         }
         who = SERVER;
-        int client_socket = server_accept(server_socket);
-        if (client_socket < 0) {
+        // Answer latency probes for as long as the server runs
+        if (pthread_create(&probe_echo_thread, NULL, probe_echo, (void*)&args) == 0) {
+            pthread_detach(probe_echo_thread);
+        }
+        // One client, or with -N the clients of a many-to-one test
+        if (server_serve(server_socket, args.clients) != 0) {
             server_close(server_socket);
             free_arguments(&args);
             return 1;
         }
-        pthread_create(&server_recv_thread, NULL, server_channel_recv, (void*)&client_socket);
-       // pthread_create(&server_send_thread, NULL, server_channel_send, (void*)&client_socket);
-        
-        pthread_join(server_recv_thread, NULL);
-     //   pthread_join(server_send_thread, NULL);
     } else if (args.is_client) {
-        client_socket = client_connect(args.ip_address, args.port);
-        if (client_socket < 0) {
+        // One control connection per server (several for a fan-out)
+        if (client_open_sessions(&args) != 0) {
             free_arguments(&args);
             return 1;
         }
         who = CLIENT;
-  //      pthread_create(&client_recv_thread, NULL, client_channel_recv, (void*)&client_socket);
-        pthread_create(&client_send_thread, NULL, client_channel_send, (void*)&client_socket);
-        
-       // pthread_join(client_recv_thread, NULL);
+        pthread_create(&client_send_thread, NULL, client_channel_send, NULL);
         pthread_join(client_send_thread, NULL);
     }
 
     // print_arguments(&args);
+     results_stop();
      free_arguments(&args);
      return 0;
  }
\ No newline at end of file
@@ -31,10 +31,79 @@
 #include <errno.h>
 #include <poll.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <endian.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <net/if.h>
 
 
 /* Initial Functions and Structures */
 
+#define MAX_SIZE_CLASSES 16
+
+/**
+ * Traffic profiles generated by the UDP sender
+ */
+enum TrafficProfile {
+  PROFILE_CBR = 0,     // Constant bit rate at -b (default)
+  PROFILE_POISSON = 1, // Exponential inter-departure times, mean rate -b
+  PROFILE_ONOFF = 2,   // Bursts of on_ms at a peak rate, then off_ms of silence; mean rate -b
+  PROFILE_REPLAY = 3   // Departure times and sizes read from a trace file
+};
+
+/**
+ * Packet size distribution: every packet is -l bytes unless classes are given
+ */
+typedef struct {
+  int count;                          // Number of size classes (0 = fixed -l)
+  int uniform;                        // Uniform between sizes[0] and sizes[1]
+  int sizes[MAX_SIZE_CLASSES];        // Packet sizes in bytes
+  double weights[MAX_SIZE_CLASSES];   // Relative weight of each size
+} size_distribution_t;
+
+#define MAX_TARGETS 64    // Servers of one fan-out client (-a list)
+#define DELAY_BUCKETS 22  // Delay histogram: <= 2^k us for k < 21, then everything above
+#define MAX_CLIENTS 64    // Clients of one incast run (-N)
+#define MAX_SOURCES 16    // Local addresses or interfaces of one client (-I list)
+
+/**
+ * One server of a client's run; -a takes a comma separated list of them
+ */
+typedef struct {
+  char address[INET_ADDRSTRLEN];
+  int port;                           // Control port (default: -p)
+  int data_port;                      // First data port; the server's MSG_ACK may assign another
+  char label[INET_ADDRSTRLEN + 6];    // "address:port", for the reports
+} server_target_t;
+
+/**
+ * One local address or interface the client's streams leave from; -I takes
+ * a comma separated list of them
+ */
+typedef struct {
+  char name[IFNAMSIZ > INET_ADDRSTRLEN ? IFNAMSIZ : INET_ADDRSTRLEN]; // As given, for the reports
+  int device;                         // 1: interface (SO_BINDTODEVICE), 0: address (bind)
+  struct in_addr address;             // Source address when not a device
+} source_binding_t;
+
+/**
+ * Impairments a sender applies to its packets before they reach the
+ * socket (-X); each stream draws from its own generator seeded from seed
+ */
+typedef struct {
+  int enabled;
+  double drop_pct;                    // Packets discarded
+  double duplicate_pct;               // Packets sent twice
+  double corrupt_pct;                 // Packets with their last payload byte flipped
+  double reorder_pct;                 // Packets held back by reorder_ns on top of the delay
+  uint64_t delay_ns;                  // Added to every packet
+  uint64_t jitter_ns;                 // Uniform extra delay in [0, jitter_ns]
+  uint64_t reorder_ns;
+  uint64_t seed;
+  char* log_file;                     // Ground-truth trace of the releases (NULL: none)
+} impair_config_t;
+
 /**
   * Structure to hold all command line parameters
   */
@@ -51,10 +120,82 @@
     int duration;           // -t: Experiment duration in seconds
     int measure_delay;      // -d: Flag for delay measurement mode
     int wait_duration;      // -w: Wait duration before transmission
+    int batch_size;         // -B: Packets per send/receive batch
+    int engine;             // -e: Data path engine (enum EngineType)
+    int output_format;      // -o: Report format (enum OutputFormat)
+    char* results_file;     // -R: File for the report (default: stdout)
+    int profile;            // -P: Traffic profile (enum TrafficProfile)
+    int on_ms;              // -P onoff: burst length in milliseconds
+    int off_ms;             // -P onoff: silence length in milliseconds
+    char* replay_file;      // -P replay: "<seconds> <bytes>" per line
+    size_distribution_t sizes; // -S: Packet size distribution
+    double search_loss;     // -L: Search the max rate with loss below this % (<0: off)
+    double search_delay_pct;// -Q: Delay percentile checked during the search (0: off)
+    double search_delay_ms; // -Q: Limit for that percentile above the minimum OWD
+    int probe_rate;         // -r: Latency probes per second alongside the streams (0: off)
+    int transactions;       // -T: Outstanding requests per stream in transaction mode (0: off)
+    int workers;            // -j: Worker threads of the event engine (flows are spread across them)
+    int adapt;              // -A: Rate controller (enum AdaptMode); -b becomes the ceiling
+    double adapt_target;    // -A: Loss % (aimd) or queueing delay ms (delay) to stay below
+    int feedback_ms;        // -F: Interval of the server's MSG_INTERIM feedback
+    int data_port;          // -D: First UDP data port, stream i uses data_port + i (default: port + 1)
+    int analysis_threads;   // -k: Server: threads analyzing what the stream threads capture (0: inline)
+    int crc;                // -C: Carry a CRC32C of the payload in every packet
+    int verify;             // Write and check payload patterns (-V turns it off)
+    int batch_stamp;        // -G: Stamp each send batch once instead of every packet
+    int direction;          // -m: Client: which way the data flows (enum Direction)
+    server_target_t* targets; // -a: Client: every server of the run (a fan-out when more than one)
+    int num_targets;
+    int clients;            // -N: Server: clients whose streams make up one (incast) run
+    source_binding_t sources[MAX_SOURCES]; // -I: Client: where the streams leave from
+    int num_sources;        // -I: Entries of sources (0: let the kernel pick); the server
+                            //     learns the count from the spec, for its per-source reports
+    impair_config_t impair; // -X: Impairments of our senders' packets
+    int metrics_port;       // -M: Serve live metrics over HTTP on this port (0: off)
+    char metrics_address[INET_ADDRSTRLEN]; // -M: Address of the metrics listener
+};
+
+/**
+ * Directions of a test; the client picks one and the spec carries it
+ */
+enum Direction {
+  DIRECTION_FORWARD = 0,  // Client sends, server receives
+  DIRECTION_REVERSE = 1,  // Server sends, client receives
+  DIRECTION_DUPLEX = 2    // Both at once over the same control session
+};
+
+/**
+ * Closed-loop rate controllers driven by the server's interim feedback
+ */
+enum AdaptMode {
+  ADAPT_OFF = 0,       // Fixed rate -b
+  ADAPT_AIMD = 1,      // Additive increase, multiplicative decrease on loss
+  ADAPT_DELAY = 2      // Hold the queueing delay at a target (LEDBAT-like)
+};
+
+/**
+ * Data path engines used by the UDP sender and receiver threads
+ */
+enum EngineType {
+  ENGINE_SENDTO = 0,   // One sendto()/recvfrom() system call per packet
+  ENGINE_MMSG = 1,     // Batched sendmmsg()/recvmmsg() system calls
+  ENGINE_EVENT = 2     // A few workers drive -n flows from timer wheels / epoll
+};
+#define MAX_BATCH_SIZE 1024
+#define MAX_PACKET_SIZE 1460  // MTU-safe max size
+
+/**
+ * Report formats produced by the results writer thread
+ */
+enum OutputFormat {
+  OUTPUT_TEXT = 0,     // Human readable blocks (default)
+  OUTPUT_JSON = 1,     // One JSON object per line
+  OUTPUT_CSV = 2       // One CSV row per record
 };
 #define HEADER_SIZE 24  // Define fixed header size (adjust as needed)
 /**
  * Structure to represent the custom header for Mini-Iperf
+ * (network byte order on the wire, converted by send_tcp_message/recv_tcp_header)
  */
 typedef struct {
   uint8_t     msg_type;       // Message type (from enum below)
@@ -69,10 +210,63 @@ enum MessageType {
   MSG_SYNC_RESP = 2,   // Clock synchronization response
   MSG_START_EXP = 3,   // Start experiment command
   MSG_STOP_EXP = 4,    // Stop experiment command
-  MSG_STATS = 5,       // Final statistics report
+  MSG_STATS = 5,       // Final statistics report, then one per -I source of the client
   MSG_INTERIM = 6,     // Interim statistics report
-  MSG_ACK = 7          // Acknowledgment
+  MSG_ACK = 7,         // MSG_START_EXP accepted and the data ports bound; payload is a start_ack_t
+  MSG_ERROR = 8,       // Request rejected; payload is the reason as text
+  MSG_SEND_DONE = 9    // The server's senders finished (reverse/duplex); payload is
+                       // an experiment_stats_t with the sender fields filled in
 };
+
+/**
+ * Payload of the MSG_ACK that accepts a MSG_START_EXP, in network byte order
+ */
+typedef struct {
+  uint16_t data_port;         // First data port the client's streams must use
+  uint16_t clients;           // Clients taking part in the run (incast, -N)
+} __attribute__((packed)) start_ack_t;
+
+#define TEST_SPEC_VERSION 2
+#define SPEC_FLAG_CRC 0x0001      // test_spec_t.flags: senders carry a payload CRC32C (-C)
+#define SPEC_FLAG_NO_VERIFY 0x0002 // Payloads carry no pattern; receivers skip the check (-V)
+#define SPEC_FLAG_BATCH_STAMP 0x0004 // Senders stamp each batch once (-G)
+#define MAX_CONTROL_PAYLOAD 8192  // Larger control messages end the session
+
+/**
+ * Test parameters the client sends in MSG_START_EXP, in network byte order.
+ * Fields are only ever appended: a peer accepts any length covering the
+ * fields it knows and ignores the rest; a different version is rejected.
+ */
+typedef struct {
+  uint16_t version;           // TEST_SPEC_VERSION of the client
+  uint16_t length;            // Bytes of the spec, these two fields included
+  uint32_t num_streams;       // -n (flows with the event engine)
+  uint32_t packet_size;       // -l
+  uint32_t max_packet_size;   // Largest packet the client sends (-S)
+  uint64_t bandwidth;         // -b in bits per second (0: unlimited)
+  int32_t duration;           // -t in seconds (-1: unlimited)
+  uint32_t engine;            // -e
+  uint32_t batch_size;        // -B
+  uint32_t workers;           // -j
+  uint16_t data_port;         // First data port; stream i uses data_port + i
+  uint16_t direction;         // enum Direction
+  uint32_t transactions;      // -T (0: off)
+  uint32_t feedback_us;       // MSG_INTERIM interval (0: off)
+  uint32_t flags;             // SPEC_FLAG_*
+  uint32_t sources;           // -I entries the streams are spread across (0: none)
+} __attribute__((packed)) test_spec_t;
+/**
+ * CPU cost of one end of a run
+ */
+typedef struct {
+  double cpu_pct;             // Process CPU time over wall time (100 = one core busy)
+  double threads_cpu_pct;     // Of which the stream threads (CLOCK_THREAD_CPUTIME_ID)
+  double host_user_pct;       // All CPUs of the host (/proc/stat), 100 = every core busy
+  double host_sys_pct;
+  double host_softirq_pct;
+  double bytes_per_cpu_s;     // Bytes moved per CPU-second of the process
+} __attribute__((packed)) cpu_report_t;
+
 // Structure for experiment statistics
 typedef struct {
   uint64_t total_packets;
@@ -82,17 +276,107 @@ typedef struct {
   double max_owd_ms;
   double jitter_ms;
   double throughput_mbps;
+  uint64_t total_bytes;
+  uint64_t payload_bytes;
+  uint64_t corrupt_packets;
+  uint64_t out_of_order;
+  uint64_t expected_packets;
+  double duration_sec;
+  double goodput_mbps;
+  double jitter_stddev_ms;
+  double owd_p50_ms;          // One-way delay percentiles
+  double owd_p90_ms;
+  double owd_p99_ms;
+  double owd_p999_ms;
+  uint64_t rcvbuf_bytes;      // Effective SO_RCVBUF granted to the receive sockets
+  uint64_t socket_drops;      // Receive queue overflows reported by SO_RXQ_OVFL
+  uint64_t rcvbuf_errors;     // Host-wide Udp RcvbufErrors during the run (/proc/net/snmp)
+  uint64_t in_errors;         // Host-wide Udp InErrors during the run
+  uint64_t backlog_drops;     // Host-wide input backlog drops during the run (/proc/net/softnet_stat)
+  uint64_t sndbuf_bytes;      // Effective SO_SNDBUF of the senders (filled in by the client)
+  uint64_t sndbuf_errors;     // Host-wide Udp SndbufErrors of the sender (filled in by the client)
+  cpu_report_t rx_cpu;        // Receiver CPU cost
+  cpu_report_t tx_cpu;        // Sender CPU cost (filled in by the client)
+  uint64_t ring_overflows;    // Packets captured but dropped by a full analysis ring (-k)
 } __attribute__((packed)) experiment_stats_t;
+_Static_assert((1 + MAX_SOURCES) * sizeof(experiment_stats_t) <= MAX_CONTROL_PAYLOAD,
+               "MSG_STATS with a report per source must fit in a control message");
 
+/**
+ * Receiver feedback sent every -F milliseconds while an adaptive run lasts
+ */
+typedef struct {
+  uint32_t seq;
+  uint32_t interval_us;       // Time covered by this report
+  uint64_t packets;           // Packets received in the interval
+  uint64_t lost;              // Sequence gaps found in the interval
+  int64_t owd_avg_ns;         // Mean one-way delay (includes the clock offset)
+} __attribute__((packed)) interim_report_t;
 
 /**
- * Structure to represent the custom header for Mini-Iperf
+ * Host-wide UDP and input queue counters, sampled before and after a run
+ */
+typedef struct {
+  uint64_t in_datagrams;      // /proc/net/snmp Udp InDatagrams
+  uint64_t in_errors;         // Udp InErrors
+  uint64_t rcvbuf_errors;     // Udp RcvbufErrors
+  uint64_t sndbuf_errors;     // Udp SndbufErrors
+  uint64_t backlog_drops;     // Sum of the "dropped" column of /proc/net/softnet_stat
+} host_counters_t;
+
+/**
+ * Process and host CPU times, sampled before and after a run
+ */
+typedef struct {
+  uint64_t wall_ns;           // Monotonic time of the sample
+  uint64_t process_ns;        // getrusage(RUSAGE_SELF) user + system time
+  uint64_t host_user;         // /proc/stat "cpu" line, in clock ticks: user + nice
+  uint64_t host_sys;          // system + irq
+  uint64_t host_softirq;
+  uint64_t host_total;        // All states, idle included
+} cpu_sample_t;
+
+
+#define PACKET_VERSION 2  // MiniIperfHeader.version (1 was the unversioned 12-byte header)
+
+/**
+ * Flags of a data packet
+ */
+enum PacketFlags {
+  PACKET_FLAG_CRC = 1       // crc holds the CRC32C of the payload (-C)
+};
+
+/**
+ * Structure to represent the custom header for Mini-Iperf. Every field is
+ * naturally aligned (and so is the payload that follows), multi-byte fields
+ * are in network byte order. New fields go at the end: receivers find the
+ * payload header_len bytes into the datagram and ignore what they do not know.
  */
 typedef struct {
-  uint32_t    seq_num;        // Sequence number (for loss detection)
+  uint8_t     version;        // PACKET_VERSION
+  uint8_t     header_len;     // Size of the header as sent, in bytes
+  uint16_t    flags;          // PacketFlags
+  uint32_t    stream_id;      // Sending stream (event engine: flow)
+  uint64_t    seq_num;        // Sequence number within the stream (for loss detection)
   uint64_t    timestamp_ns;   // Monotonic clock timestamp (CLOCK_MONOTONIC)
-  // Optional: Add fields for OWD (if clocks are synced via NTP/PTP)
-} __attribute__((packed)) MiniIperfHeader;
+  uint32_t    batch_seq;      // Sender batch (system call) the packet left in
+  uint32_t    crc;            // CRC32C of the payload (PACKET_FLAG_CRC)
+} MiniIperfHeader;
+_Static_assert(sizeof(MiniIperfHeader) == 32, "MiniIperfHeader must stay 32 bytes");
+
+/**
+ * Header fields of a received packet in host byte order
+ */
+typedef struct {
+  uint64_t seq;
+  uint64_t sent_ns;
+  uint32_t stream_id;
+  uint32_t batch_seq;
+  uint32_t crc;
+  uint16_t flags;
+  int payload_size;
+  const char* payload;
+} packet_info_t;
 
 /**
  * Structure to represent a data packet
@@ -102,7 +386,470 @@ typedef struct {
   char payload[1460];         // Flexible array member for payload data
 } MiniIperfPacket;
 
-//total bytes = 16 B
+
+/**
+ * Statistics kept by a UDP receiver thread for a single stream
+ */
+typedef struct {
+  uint64_t total_bytes;
+  uint64_t payload_bytes;
+  uint64_t received_packets;
+  uint64_t corrupt_packets;
+  uint64_t out_of_order;
+  uint64_t lost_packets;
+  uint64_t expected_seq;
+  uint64_t first_ts;
+  uint64_t last_ts;
+
+  // Jitter calculation variables
+  uint64_t last_arrival_ns;       // Last packet arrival time
+  double *jitter_samples;         // Array to store inter-arrival differences
+  int jitter_samples_count;       // Number of samples collected
+  int jitter_samples_capacity;    // Size of jitter_samples array
+  double jitter_sum;              // Sum of all jitter values
+  double jitter_sum_squares;      // Sum of squares for stddev calculation
+
+  // One-way delay (receive time - sender timestamp)
+  double owd_sum_ns;
+  int64_t owd_min_ns;
+  int64_t owd_max_ns;
+  int64_t *owd_samples;           // Reservoir sample of one-way delays
+  int owd_samples_count;
+  int owd_samples_capacity;
+  uint64_t owd_rng;               // Generator state for reservoir replacement
+
+  uint32_t socket_drops;          // Latest SO_RXQ_OVFL count of the socket
+  int rcvbuf_bytes;               // Effective SO_RCVBUF
+  // Delay histogram (bucket k: at most 2^k us), published as it is counted
+  // for the metrics endpoint; single writer, read without locks
+  atomic_uint_fast64_t delay_buckets[DELAY_BUCKETS];
+} udp_stream_stats_t;
+
+/**
+ * Counters a stream thread publishes once per batch so the interval
+ * reporter can read them without touching the thread's private state
+ */
+typedef struct {
+  atomic_uint_fast64_t packets;
+  atomic_uint_fast64_t bytes;
+  atomic_uint_fast64_t payload_bytes;
+  atomic_uint_fast64_t lost;
+  atomic_uint_fast64_t owd_sum_ns;  // Sum of the one-way delays (two's complement)
+} udp_progress_t;
+
+/**
+ * Copy of one running stream's published counters (metrics endpoint)
+ */
+typedef struct {
+  int stream_id;
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t payload_bytes;
+  uint64_t lost;
+  uint64_t owd_sum_ns;
+  uint64_t delay_buckets[DELAY_BUCKETS];
+} udp_live_stream_t;
+
+/**
+ * Receiver counters summed over the running streams
+ */
+typedef struct {
+  uint64_t packets;
+  uint64_t lost;
+  uint64_t owd_sum_ns;
+} udp_live_t;
+
+/* Trace Structures */
+
+#define TRACE_MAGIC "MIPT"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 64              // Records start at this file offset
+#define TRACE_CHUNK_RECORDS 4096          // Records claimed by a thread at a time
+#define TRACE_DEFAULT_RECORDS (1UL << 22) // File capacity when the rate is unknown
+
+enum TraceFlags {
+  TRACE_FLAG_VALID = 1,     // Slot holds a record (unused slots stay zeroed)
+  TRACE_FLAG_CORRUPT = 2,   // Payload verification failed (impairment log: corrupted)
+  // Impairment log (-X) only: what the stage did to the packet
+  TRACE_FLAG_DROPPED = 4,   // Never sent; rx_ts is 0
+  TRACE_FLAG_DUPLICATE = 8, // Second copy of the packet
+  TRACE_FLAG_DELAYED = 16,  // Held for the delay or jitter
+  TRACE_FLAG_REORDERED = 32 // Held back to arrive behind later packets
+};
+
+/**
+ * One per-packet record of the binary trace (-f), naturally aligned
+ */
+typedef struct {
+  uint64_t seq;             // Sequence number from the packet header
+  uint64_t tx_ts;           // Sender timestamp (sender CLOCK_MONOTONIC, ns)
+  uint64_t rx_ts;           // Receive timestamp (receiver CLOCK_MONOTONIC, ns)
+  uint32_t stream_id;       // Stream the packet arrived on
+  uint16_t size;            // UDP payload size in bytes
+  uint16_t flags;           // TraceFlags
+} trace_record_t;
+
+/**
+ * Header at offset 0 of a trace file
+ */
+typedef struct {
+  char     magic[4];        // TRACE_MAGIC
+  uint16_t version;         // TRACE_VERSION
+  uint16_t record_size;     // sizeof(trace_record_t)
+  uint32_t num_streams;
+  uint32_t reserved;
+  uint64_t record_slots;    // Slots following the header (some may be unused)
+  uint64_t dropped_records; // Records lost because the file was full
+  uint64_t start_ns;        // Receiver time when the trace was opened
+} trace_file_header_t;
+
+/**
+ * Shared state of a trace file: a preallocated, mmap'd file from which
+ * threads claim chunks of record slots with an atomic cursor
+ */
+typedef struct {
+  int fd;
+  char* map;
+  size_t map_size;
+  uint64_t capacity;            // Number of record slots in the file
+  atomic_uint_fast64_t cursor;  // Next unclaimed slot
+  atomic_uint_fast64_t dropped;
+} trace_writer_t;
+
+/**
+ * Per-thread view of a trace: the chunk currently being filled
+ */
+typedef struct {
+  trace_writer_t* writer;
+  trace_record_t* next;
+  trace_record_t* end;
+  uint64_t dropped;
+} trace_buffer_t;
+
+/**
+ * Token bucket shared by all sender threads of an experiment. The bucket is
+ * kept as a virtual departure clock (in picoseconds since epoch_ns) that
+ * threads advance with one compare-and-swap per batch, so there is no lock
+ * and the aggregate rate does not drift however the streams are scheduled.
+ */
+typedef struct {
+  _Alignas(64) atomic_uint_fast64_t next_ps; // Departure time of the next claimed byte
+  uint64_t epoch_ns;              // Monotonic time the clock counts from
+  _Atomic double ps_per_byte;     // Cost of one byte at the configured rate
+  uint64_t burst_ps;              // How far the clock may lag behind now (catch-up allowance)
+} rate_limiter_t;
+
+/**
+ * Receive state of one flow of the event engine, kept in a flat
+ * open-addressed table keyed by the flow's source address and port
+ */
+typedef struct {
+  uint32_t addr;                  // Source address (network order), 0: free slot
+  uint16_t port;                  // Source port (network order)
+  uint32_t flow_id;               // Order in which the worker first saw the flow
+  uint64_t expected_seq;
+  uint32_t out_of_order;
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t lost;
+  uint64_t first_ts;
+  uint64_t last_ts;
+} flow_rx_t;
+
+/**
+ * Compact record of one received packet, handed from the capture thread of a
+ * stream to an analysis thread (-k). The payload is verified from samples of
+ * its first and last bytes.
+ */
+typedef struct {
+  uint64_t seq;
+  uint64_t sent_ns;               // Sender timestamp of the packet
+  uint64_t recv_ns;               // Capture time
+  uint16_t len;                   // Datagram size in bytes
+  uint16_t stream_id;
+  uint8_t verdict;                // RxVerdict
+  uint8_t header_len;             // Header size of the datagram (0 if it had none)
+  uint8_t head[8];                // First payload bytes
+  uint8_t tail[8];                // Last payload bytes
+} rx_record_t;
+
+/**
+ * Payload checks already done by the capture thread
+ */
+enum RxVerdict {
+  RX_CHECK_SAMPLES = 0,           // Analysis verifies head and tail
+  RX_VERIFIED = 1,                // CRC checked on capture
+  RX_CORRUPT = 2                  // Not a valid packet, or the CRC did not match
+};
+
+/**
+ * Lock-free single-producer single-consumer ring of rx_record_t. Producer
+ * and consumer indices live on their own cache lines, and each side keeps
+ * a copy of the other's index so the shared line is read only when the
+ * copy says the ring is full (or empty).
+ */
+typedef struct {
+  _Alignas(64) atomic_uint_fast64_t head; // Next slot the producer fills
+  uint64_t cached_tail;           // Producer's copy of tail
+  uint64_t overflows;             // Records dropped because the ring was full (producer)
+  _Alignas(64) atomic_uint_fast64_t tail; // Next slot the consumer reads
+  uint64_t cached_head;           // Consumer's copy of head
+  _Alignas(64) rx_record_t* records;
+  uint64_t mask;                  // Capacity - 1 (a power of two)
+  _Atomic(void*) stream;          // udp_stream_t of the producer, set when it starts
+} rx_ring_t;
+
+/**
+ * Context of a single UDP stream: one socket driven by one thread.
+ * Stream i uses data port (args->data_port + i) on both ends.
+ */
+typedef struct {
+  struct arguments* args;
+  int stream_id;
+  pthread_t thread;
+  void* (*body)(void*);           // Sender or receiver loop
+  atomic_int done;                // Set when body has returned
+  uint64_t sent_packets;          // Sender side counters
+  uint64_t sent_bytes;
+  int sndbuf_bytes;               // Effective SO_SNDBUF
+  udp_progress_t progress;        // Published counters (sender or receiver)
+  udp_stream_stats_t stats;       // Receiver side statistics
+  trace_buffer_t trace;           // Per-packet trace (receiver, -f only), or the
+                                  // sender's impairment log (-X log=)
+  rate_limiter_t* limiter;        // Pacing shared by the senders (NULL: unpaced)
+  uint64_t cpu_ns;                // CPU time of the stream thread
+  atomic_int ready;               // Receiver: data socket bound, receiving
+  flow_rx_t* flows;               // Event engine receiver: flow table of this worker
+  int flows_capacity;             // Slots in the flow table (a power of two)
+  uint64_t untracked_packets;     // Packets of flows that found the table full
+  rx_ring_t* ring;                // Receiver: ring to the analysis threads (-k), NULL: inline
+  uint64_t start_ns;              // Sender: shared start time of the run's streams
+  struct impair_stream* impair;   // Sender: impairment stage (-X), NULL: packets go straight out
+} udp_stream_t;
+
+/**
+ * Aggregate statistics of the last run, summed over all streams
+ */
+typedef struct {
+  uint64_t sent_packets;
+  uint64_t sent_bytes;
+  uint64_t received_packets;
+  uint64_t lost_packets;
+  uint64_t corrupt_packets;
+  uint64_t out_of_order;
+  uint64_t total_bytes;
+  uint64_t payload_bytes;
+  uint64_t first_ts;
+  uint64_t last_ts;
+  uint64_t expected_packets;
+  double jitter_ms;
+  double jitter_stddev_ms;
+  double avg_owd_ms;
+  double min_owd_ms;
+  double max_owd_ms;
+  double owd_p50_ms;
+  double owd_p90_ms;
+  double owd_p99_ms;
+  double owd_p999_ms;
+  uint64_t rcvbuf_bytes;          // Smallest effective SO_RCVBUF of the receive sockets
+  uint64_t socket_drops;          // Sum of the SO_RXQ_OVFL counts
+  uint64_t ring_overflows;        // Records the capture threads could not hand to the analysis (-k)
+  uint64_t sndbuf_bytes;          // Smallest effective SO_SNDBUF of the send sockets
+  host_counters_t host;           // Host-wide counter deltas over the run
+  cpu_report_t rx_cpu;            // CPU cost of the last receiver run
+  cpu_report_t tx_cpu;            // CPU cost of the last sender run
+  int groups;                     // Receiver: clients of an incast run, or -I sources of the
+                                  // client, set before udp_recv (0: one)
+  int group_streams[MAX_CLIENTS]; // Streams of each group, in stream order
+  experiment_stats_t group_stats[MAX_CLIENTS]; // Summary of each group's streams, from udp_recv
+} udp_stats_t;
+
+/* Results Structures */
+
+enum ResultType {
+  RESULT_CONFIG = 1,   // Experiment configuration
+  RESULT_INTERVAL = 2, // Metrics of one reporting interval
+  RESULT_STREAM = 3,   // Final metrics of one stream
+  RESULT_SUMMARY = 4,  // Final metrics over all streams
+  RESULT_TRIAL = 5,    // One trial of a rate search
+  RESULT_SEARCH = 6,   // Maximum sustainable rate found by a search
+  RESULT_LATENCY = 7,  // Probe round-trip times, idle or under load
+  RESULT_TRANSACT = 8, // Request/response rate and latency
+  RESULT_FLOWS = 9,    // Per-flow distribution of the event engine
+  RESULT_ADAPT = 10,   // Rates chosen by the adaptive controller
+  RESULT_IMPAIR = 11   // What the impairment stage did, and what the receiver should count
+};
+
+/**
+ * Experiment configuration as reported at the start of a run
+ */
+typedef struct {
+  char mode[8];                   // "server" or "client"
+  char address[INET_ADDRSTRLEN];
+  int port;
+  int packet_size;
+  long bandwidth;
+  int num_streams;
+  int duration;
+  int interval;
+  int engine;
+  int batch_size;
+} result_config_t;
+
+/**
+ * Metrics of an interval, a stream or the whole experiment
+ */
+typedef struct {
+  const char* side;               // "sender" or "receiver"
+  const char* direction;          // "client-to-server" or "server-to-client"
+  char peer[48];                  // Summary of one server, client or source of a fan-out,
+                                  // incast or -I run, or "aggregate"; empty otherwise
+  int stream_id;                  // -1 for the sum over all streams
+  double start_s;
+  double end_s;
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t payload_bytes;
+  uint64_t lost;
+  uint64_t corrupt;
+  uint64_t out_of_order;
+  double loss_pct;
+  double throughput_mbps;
+  double goodput_mbps;
+  double jitter_ms;
+  double jitter_stddev_ms;
+  double avg_owd_ms;
+  double min_owd_ms;
+  double max_owd_ms;
+  double p50_owd_ms;
+  double p99_owd_ms;
+  uint64_t rcvbuf_bytes;          // Effective socket buffers (summary only)
+  uint64_t sndbuf_bytes;
+  uint64_t lost_socket;           // Loss split by cause (summary only)
+  uint64_t lost_cpu;
+  uint64_t lost_pipeline;         // Captured, but dropped by a full analysis ring
+  uint64_t lost_network;
+  uint64_t ring_overflows;
+  uint64_t sndbuf_errors;         // Sends the sender's kernel refused for lack of buffer
+  cpu_report_t rx_cpu;            // CPU cost of both ends (summary only)
+  cpu_report_t tx_cpu;
+} result_metrics_t;
+
+/**
+ * One trial of the maximum lossless rate search (or its final result)
+ */
+typedef struct {
+  int trial;                      // Trial number, -1 for the search result
+  double offered_mbps;            // Rate requested from the sender
+  double received_mbps;           // Rate measured by the receiver
+  uint64_t sent_packets;
+  uint64_t received_packets;
+  double loss_pct;                // 100 * (sent - received) / sent
+  double delay_ms;                // Delay percentile above the minimum OWD
+  int pass;                       // Loss (and delay) within target
+} result_trial_t;
+
+/**
+ * Round-trip times of the latency probes of one phase
+ */
+typedef struct {
+  const char* phase;              // "idle" or "loaded"
+  uint64_t sent;
+  uint64_t answered;
+  double loss_pct;
+  double min_ms;
+  double p50_ms;
+  double p90_ms;
+  double p99_ms;
+  double max_ms;
+  double added_p50_ms;            // Loaded p50 minus idle p50 (0 for idle)
+} result_latency_t;
+
+/**
+ * Result of the request/response transaction mode
+ */
+typedef struct {
+  int stream_id;                  // -1 for all streams
+  double duration_s;
+  uint64_t transactions;          // Requests answered
+  uint64_t timeouts;              // Requests presumed lost
+  double tps;                     // Transactions per second
+  double min_ms;
+  double p50_ms;
+  double p90_ms;
+  double p99_ms;
+  double p999_ms;
+  double max_ms;
+} result_transact_t;
+
+/**
+ * How evenly the event engine's flows were served
+ */
+typedef struct {
+  int flows_expected;             // -n
+  int flows_seen;                 // Distinct flows that delivered packets
+  uint64_t untracked_packets;     // Packets of flows beyond the flow table
+  double min_mbps;                // Per-flow throughput distribution
+  double p50_mbps;
+  double max_mbps;
+  double fairness;                // Jain's index over the per-flow throughput
+  double max_loss_pct;            // Worst per-flow loss
+} result_flows_t;
+
+/**
+ * Course of an adaptive-rate run
+ */
+typedef struct {
+  const char* controller;         // "aimd" or "delay"
+  uint64_t reports;               // Feedback reports acted on
+  uint64_t decreases;             // Multiplicative decreases
+  double start_mbps;
+  double final_mbps;
+  double mean_mbps;               // Mean of the rates set over the reports
+  double min_mbps;
+  double max_mbps;
+} result_adapt_t;
+
+/**
+ * Ground truth of the impairment stage (-X), over all sender streams. The
+ * expect_* counters are what the receiver's accounting makes of the packets
+ * in the order they were released; on a path that loses and reorders
+ * nothing else they match the receiver's summary.
+ */
+typedef struct {
+  uint64_t seed;
+  uint64_t offered;               // Packets the senders handed to the stage
+  uint64_t dropped;
+  uint64_t duplicated;
+  uint64_t corrupted;             // Copies sent corrupted
+  uint64_t reordered;             // Held back by reorder
+  uint64_t delayed;               // Held for delay or jitter
+  double mean_held_ms;            // Time the released copies spent in the stage
+  double max_held_ms;
+  uint64_t expect_packets;        // Valid packets
+  uint64_t expect_lost;
+  uint64_t expect_out_of_order;
+  uint64_t expect_corrupt;
+} result_impair_t;
+
+/**
+ * One entry of the results queue
+ */
+typedef struct {
+  int type;                       // ResultType
+  union {
+    result_config_t config;
+    result_metrics_t metrics;
+    result_trial_t trial;
+    result_latency_t latency;
+    result_transact_t transact;
+    result_flows_t flows;
+    result_adapt_t adapt;
+    result_impair_t impair;
+  };
+} result_record_t;
+
+#define RESULTS_QUEUE_DEPTH 256
 
 
  /**
@@ -145,31 +892,554 @@ void print_help();
 
 void safe_print(char* message);
 
+/**
+ * Convert an engine name ("sendto", "mmsg") to its EngineType value
+ * @param name Engine name
+ * @return EngineType value, or -1 if the name is unknown
+ */
+int parse_engine(const char* name);
+
+/**
+ * Get the printable name of an engine
+ * @param engine EngineType value
+ * @return Engine name
+ */
+const char* engine_name(int engine);
+
+/**
+ * Convert a format name ("text", "json", "csv") to its OutputFormat value
+ * @param name Format name
+ * @return OutputFormat value, or -1 if the name is unknown
+ */
+int parse_output_format(const char* name);
+/**
+ * Parse a -A controller specification: aimd[:<loss%>] or delay[:<ms>]
+ * @return 0 on success, -1 on error
+ */
+int parse_adapt(const char* spec, struct arguments* args);
+/**
+ * Parse -X: comma separated drop=<%>, dup=<%>, corrupt=<%>, reorder=<%>[:<ms>],
+ * delay=<ms>[:<jitter ms>], seed=<n>, log=<file>
+ * @return 0 on success, -1 on error
+ */
+int parse_impair(const char* spec, struct arguments* args);
+const char* adapt_name(int adapt);
+/**
+ * Parse -a: one address, or a comma separated list of <address>[:<port>]
+ * (the servers of a fan-out); args->ip_address becomes the first address
+ * @return 0 on success, -1 on error
+ */
+int parse_targets(const char* list, struct arguments* args);
+/**
+ * Parse -I: a comma separated list of local IPv4 addresses or interface names
+ * @return 0 on success, -1 on error
+ */
+int parse_sources(const char* list, struct arguments* args);
+/**
+ * Convert a direction name ("forward", "reverse", "duplex") to its Direction value
+ * @return Direction value, or -1 if the name is unknown
+ */
+int parse_direction(const char* name);
+const char* direction_name(int direction);
+/**
+ * First data port of the server-to-client streams: the client's data ports
+ * from -D on, after the client-to-server ones in duplex mode
+ */
+int reverse_data_port(const struct arguments* args);
+/**
+ * Direction of the data handled by this end's senders or receivers
+ * @param side "sender" or "receiver"
+ * @return "client-to-server" or "server-to-client"
+ */
+const char* data_direction(const struct arguments* args, const char* side);
+
 
 // TCP Channel Functions
+/**
+ * Send one control message (header in network byte order, then the payload),
+ * retrying partial sends
+ * @return 0 on success, -1 on error
+ */
 int send_tcp_message(int sock, uint8_t msg_type, const void* payload, uint32_t payload_len);
+/**
+ * Receive the next control message header and convert it to host byte order
+ * @return 0 on success, -1 if the connection closed or the header is invalid
+ */
+int recv_tcp_header(int sock, tcp_header_t* header);
+/**
+ * Convert every 64-bit field of the statistics report between host and network byte order
+ */
+void experiment_stats_swap(experiment_stats_t* stats);
+/**
+ * Convert an interim report between host and network byte order
+ */
+void interim_report_swap(interim_report_t* report);
+
+// Test Spec Functions
+/**
+ * Describe the client's test in wire format
+ */
+void test_spec_encode(const struct arguments* args, test_spec_t* spec);
+/**
+ * Validate a received test spec and apply it to the server's arguments
+ * @param spec Spec as received (network byte order)
+ * @param len Bytes received
+ * @param args Server arguments, changed only if the spec is valid
+ * @param error Reason for a rejection
+ * @return 0 on success, -1 if the spec was rejected
+ */
+int test_spec_apply(const void* spec, uint32_t len, struct arguments* args,
+                    char* error, size_t error_size);
 //Server Functions
 int server_start(const char* ip, int port);
 int server_accept(int server_socket);
 int server_receive(int client_socket, char* buffer, int buffer_size);
 int server_send(int client_socket, const char* message, int message_size);
 int server_close(int server_socket);
-void * server_channel_send(void* client_socket);
-void* server_channel_recv(void* client_socket);
+void * server_channel_send(void* session);
+void* server_channel_recv(void* session);
+/**
+ * Accept clients and run their control sessions until all have left. With
+ * more than one client (-N) their client-to-server streams run as one
+ * many-to-one test: it starts once every client sent MSG_START_EXP and ends
+ * once every client sent MSG_STOP_EXP.
+ * @param server_socket Listening socket
+ * @param clients Clients to accept
+ * @return 0 once every client has been served, -1 on error
+ */
+int server_serve(int server_socket, int clients);
 //Client Functions
 int client_connect(const char* server_ip, int server_port);
 int client_send(int client_socket, const char* message, int message_size);
 int client_receive(int client_socket, char* buffer, int buffer_size);
 int client_close(int client_socket);
-void* client_channel_send(void* client_socket);
-void* client_channel_recv(void* client_socket);
+void* client_channel_send(void* unused);
+void* client_channel_recv(void* session);
+/**
+ * Connect to every server of args->targets and start their control channels
+ * @return 0 on success, -1 if a server cannot be reached
+ */
+int client_open_sessions(const struct arguments* args);
+/**
+ * Run one experiment (START, send for args.duration, STOP) on the control
+ * connections and wait for the servers' MSG_STATS (and MSG_SEND_DONE when
+ * the server sends too). With several servers all streams start together
+ * and each server gets its own -n streams at -b.
+ * @param stats Receives the server's statistics (client-to-server streams),
+ *        summed over all servers of a fan-out
+ * @param reverse_stats Receives our statistics of the server-to-client
+ *        streams (reverse and duplex modes only, otherwise may be NULL)
+ * @return 0 on success, -1 if the server went away or the run was aborted
+ */
+int client_run_trial(experiment_stats_t* stats, experiment_stats_t* reverse_stats);
+
+// Rate Search Functions
+/**
+ * Bisect the offered rate between 0 and args->bandwidth until the loss
+ * (and optional delay percentile) target is met within 1% of the maximum
+ * @param args Arguments with the targets; bandwidth/duration are changed per trial
+ * @return 0 on success, -1 on error
+ */
+int rate_search(struct arguments* args);
+
+// Latency Probe Functions
+/**
+ * Server side echo responder on UDP port args->port; runs until the process exits
+ * @param arg Pointer to the arguments structure
+ */
+void* probe_echo(void* arg);
+/**
+ * Start sending args->probe_rate probes per second to the server's echo
+ * responder; replies are accounted to the idle phase until probe_set_loaded()
+ * @return 0 on success, -1 on error
+ */
+int probe_start(const struct arguments* args);
+/**
+ * Account the following probes to the loaded phase
+ */
+void probe_set_loaded(void);
+/**
+ * Stop probing, wait briefly for outstanding replies and emit the
+ * RESULT_LATENCY records of both phases
+ */
+void probe_stop(void);
+
+// Host Counter Functions
+/**
+ * Read the host-wide UDP counters (/proc/net/snmp) and input backlog drops
+ * (/proc/net/softnet_stat); counters that cannot be read are left at 0
+ */
+void host_counters_sample(host_counters_t* out);
+/**
+ * Sample the process CPU time (getrusage) and the host CPU times (/proc/stat)
+ */
+void cpu_sample(cpu_sample_t* out);
+/**
+ * CPU cost of the interval between two samples
+ * @param threads_ns CPU time of the stream threads over the interval
+ * @param bytes Bytes moved over the interval, for bytes_per_cpu_s
+ */
+void cpu_report(const cpu_sample_t* before, const cpu_sample_t* after, uint64_t threads_ns,
+                uint64_t bytes, cpu_report_t* out);
+
+// Pacing Functions
+/**
+ * Set up a shared token bucket for a total rate
+ * @param limiter Bucket to initialize
+ * @param bits_per_sec Aggregate rate of all senders
+ * @param burst_ns Sending time a lagging sender may catch up on
+ */
+void rate_limiter_init(rate_limiter_t* limiter, long bits_per_sec, uint64_t burst_ns);
+/**
+ * Claim the departure of bytes from the bucket (lock-free, safe from any thread)
+ * @param now_ns Current monotonic time
+ * @return Monotonic time at which the bytes may be sent
+ */
+uint64_t rate_limiter_claim(rate_limiter_t* limiter, uint64_t bytes, uint64_t now_ns);
+/**
+ * Change the rate of a bucket in use; claims already made keep their departures
+ */
+void rate_limiter_set_rate(rate_limiter_t* limiter, long bits_per_sec);
+
+// Impairment Functions
+typedef struct impair_stream impair_stream_t;
+/**
+ * Reset the ground truth of a sender run and open its log (-X log=)
+ * @param log Receives the log for the streams' trace buffers, NULL without one
+ * @return 0 on success, -1 if the log cannot be created
+ */
+int impair_start(const struct arguments* args, trace_writer_t** log);
+/**
+ * Set up the stage of one sender stream, sized for what it sends within
+ * the longest hold; it logs to the stream's trace buffer
+ * @return The stage, or NULL on allocation failure
+ */
+impair_stream_t* impair_open(udp_stream_t* stream);
+/**
+ * Pass a batch through the stage: each packet is dropped, or copied (once
+ * or twice) and held until its release time. Sends whatever is due.
+ * @return 0 on success, -1 on a fatal send error
+ */
+int impair_send(impair_stream_t* impair, int sock, int engine, struct mmsghdr* msgs, int count);
+/**
+ * Sleep until until_ns, sending the held packets as they fall due
+ */
+void impair_sleep(impair_stream_t* impair, int sock, int engine, uint64_t until_ns);
+/**
+ * Send the remaining held packets at their times, add the stream's
+ * counts to the run's ground truth and free the stage
+ */
+void impair_close(impair_stream_t* impair, int sock, int engine);
+/**
+ * Close the log and emit the RESULT_IMPAIR record of the run
+ */
+void impair_stop(void);
+
+// Adaptive Rate Functions
+/**
+ * Hand the senders' bucket to the controller, starting at a tenth of args->bandwidth
+ * @param args Arguments with the controller, its target and the ceiling (-b)
+ * @param limiter Bucket of the senders, already initialized
+ * @return Initial rate in bits per second
+ */
+long adapt_start(const struct arguments* args, rate_limiter_t* limiter);
+/**
+ * Adjust the rate from one interim report (called from the control channel thread)
+ */
+void adapt_feedback(const interim_report_t* report);
+/**
+ * Detach the controller from the bucket and emit the RESULT_ADAPT record
+ */
+void adapt_stop(void);
+
+// Traffic Profile Functions
+/**
+ * One departure of a precomputed sending schedule
+ */
+typedef struct {
+  uint64_t offset_ns;   // Departure time relative to the start of the cycle
+  uint32_t size;        // Packet size in bytes
+} schedule_entry_t;
+
+/**
+ * Sending schedule of one stream; it repeats every period_ns
+ */
+typedef struct {
+  schedule_entry_t* entries;
+  size_t count;
+  uint64_t period_ns;
+} traffic_schedule_t;
+
+#define SCHEDULE_LENGTH 65536   // Generated departures per stream and cycle
+#define MAX_REPLAY_ENTRIES (1 << 24)
+
+/**
+ * Parse a -P profile specification: cbr, poisson, onoff:<on_ms>:<off_ms>, replay:<file>
+ * @return 0 on success, -1 on error
+ */
+int parse_profile(const char* spec, struct arguments* args);
+/**
+ * Parse a -S size specification: uniform:<min>:<max> or <size>[:<weight>],...
+ * @return 0 on success, -1 on error
+ */
+int parse_size_distribution(const char* spec, size_distribution_t* dist);
+/**
+ * Whether the sender needs a schedule (any profile or size mix other than fixed CBR)
+ */
+int profile_uses_schedule(const struct arguments* args);
+/**
+ * Precompute the schedule of one stream from args (rate is split across streams)
+ * @return 0 on success, -1 on error
+ */
+int schedule_build(traffic_schedule_t* schedule, const struct arguments* args, int stream_id);
+void schedule_free(traffic_schedule_t* schedule);
+
+/**
+ * Small seeded pseudo-random generator (splitmix64), one state per thread
+ */
+uint64_t rng_next(uint64_t* state);
+/**
+ * Uniform double in [0, 1)
+ */
+double rng_uniform(uint64_t* state);
 
 // UDP Channel Functions
+// udp_sendto/udp_recv start args->num_streams stream threads and wait for them
+// (args->workers threads driving args->num_streams flows with the event engine)
 void *udp_sendto(void* args);
 void* udp_recv(void* args);
+/**
+ * Account one delay sample (one-way or round-trip) in the stream statistics
+ */
+void record_delay(udp_stream_stats_t* stats, int64_t delay_ns);
+
+// Packet Functions
+/**
+ * Fill the constant part of a data packet header
+ * @param packet Packet to prepare
+ * @param stream_id Stream (or flow) the packet belongs to
+ * @param crc Non-zero to carry a CRC32C of the payload
+ */
+void packet_init(MiniIperfPacket* packet, uint32_t stream_id, int crc);
+/**
+ * Number a prepared packet and timestamp it, leaving the payload as it is
+ */
+void packet_stamp_header(MiniIperfPacket* packet, uint64_t seq, uint32_t batch_seq, uint64_t now);
+/**
+ * Write the payload pattern of sequence number seq (and its CRC with -C)
+ */
+void packet_fill(MiniIperfPacket* packet, uint64_t seq, int payload_size);
+/**
+ * Number a prepared packet, timestamp it and fill its payload pattern
+ */
+void packet_stamp(MiniIperfPacket* packet, uint64_t seq, uint32_t batch_seq, uint64_t now,
+                  int payload_size);
+/**
+ * Check the version and sizes of a received datagram and decode its header
+ * @return 0 on success, -1 if it is not a Mini-Iperf data packet
+ */
+int packet_parse(const MiniIperfPacket* packet, ssize_t bytes, packet_info_t* info);
+/**
+ * Verify the payload of a parsed packet: its CRC when it carries one,
+ * otherwise the pattern of its first and last bytes
+ * @return 1 if the payload is intact, 0 otherwise
+ */
+int packet_verify(const packet_info_t* info);
+/**
+ * Check payload samples against the pattern of sequence number seq
+ * @return 1 if they match, 0 otherwise
+ */
+int packet_samples_match(uint64_t seq, const uint8_t* head, const uint8_t* tail, size_t sample);
+/**
+ * CRC32C (Castagnoli) of a buffer; SSE4.2 instructions when the CPU has them
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+// Event Engine Functions
+/**
+ * Sender worker of the event engine: drives its share of the flows, each
+ * on its own socket (distinct source port), from a timer wheel
+ * @param stream_ptr udp_stream_t of the worker
+ */
+void* flow_send_worker(void* stream_ptr);
+/**
+ * Make room for one descriptor per flow, before any sender worker opens its sockets
+ * @param needed Descriptors the process needs
+ */
+void raise_fd_limit(int needed);
+/**
+ * Receiver worker of the event engine: one SO_REUSEPORT socket per worker,
+ * epoll driven batched receives, per-flow accounting in stream->flows
+ * @param stream_ptr udp_stream_t of the worker
+ */
+void* flow_recv_worker(void* stream_ptr);
+/**
+ * Emit the per-flow records and the flow distribution of a finished run
+ * @param args Arguments of the run
+ * @param workers Receiver workers holding the flow tables
+ * @param n Number of workers
+ */
+void flow_report(const struct arguments* args, udp_stream_t* workers, int n);
+extern udp_stats_t udp_stats;
+/**
+ * Transaction mode client: keeps args->transactions requests outstanding per
+ * stream, which the server's receivers echo, and reports the transaction
+ * rate and latency percentiles
+ * @param args_ptr Pointer to the arguments structure
+ */
+void* udp_transact(void* args_ptr);
+/**
+ * Fill the wire statistics report from the last receiver run (udp_stats)
+ */
+void udp_get_experiment_stats(experiment_stats_t* out);
+/**
+ * Sum the counters published by the running receiver streams
+ * @return 0 on success, -1 if no receiver is running
+ */
+int udp_live_totals(udp_live_t* out);
+/**
+ * Copy the published counters of the running streams of one side. Stream
+ * threads never wait for this: they only store to their own counters.
+ * @param receiver 1 for the receiver streams, 0 for the sender streams
+ * @param out Receives a malloc'ed array (NULL when none are running)
+ * @return Number of streams copied, -1 on allocation failure
+ */
+int udp_live_snapshot(int receiver, udp_live_stream_t** out);
+/**
+ * Send a batch of prepared messages: one sendmmsg() call (mmsg engine) or
+ * one sendto() per message, waiting out a full socket buffer
+ * @return 0 on success, -1 on a fatal error
+ */
+int send_batch(int sock, int engine, struct mmsghdr* msgs, int count);
+/**
+ * Wait until every receiver stream has bound its data socket
+ * @return 0 when all are receiving, -1 if one failed or the timeout passed
+ */
+int udp_receivers_ready(uint64_t timeout_ns);
+/**
+ * Where stream (or flow) index of a sender goes. A fan-out run gives each
+ * server args->num_streams / args->num_targets consecutive streams.
+ * @param per_stream_port Stream i uses data port + i (0: one port for all, event engine)
+ * @param addr Receives the server's data address
+ * @param local_id Receives the stream's number at that server
+ */
+void data_destination(const struct arguments* args, uint32_t index, int per_stream_port,
+                      struct sockaddr_in* addr, uint32_t* local_id);
+/**
+ * Which -I source a stream leaves from: each source takes a block of
+ * consecutive streams, so a receiver can report the sources as groups
+ * @return Source index in [0, sources)
+ */
+int stream_source(int stream, int streams, int sources);
+/**
+ * Bind a sender socket to a source address or interface
+ * @return 0 on success, -1 on error
+ */
+int source_bind(int sock, const source_binding_t* source);
+/**
+ * Sleep until the shared start time of the sender streams of a run
+ */
+void stream_wait_start(const udp_stream_t* stream);
+/**
+ * Publish the receive counters of a stream for the interval reporter and feedback
+ */
+void publish_progress(udp_stream_t* stream);
+/**
+ * Verify one captured packet and update the statistics of its stream
+ * (analysis side of the receive pipeline)
+ */
+void account_record(udp_stream_t* stream, const rx_record_t* record);
+
+// Receive Pipeline Functions
+/**
+ * Allocate one capture ring per stream and start the analysis threads
+ * @param args Arguments of the run (num_streams, analysis_threads)
+ * @return 0 on success, -1 on error
+ */
+int rx_pipeline_start(const struct arguments* args);
+/**
+ * Hand the ring of a stream to its capture thread
+ * @return The ring, or NULL when packets are analyzed inline
+ */
+rx_ring_t* rx_pipeline_attach(udp_stream_t* stream);
+/**
+ * Queue captured records; those that do not fit are counted as overflows
+ */
+void rx_ring_push(rx_ring_t* ring, const rx_record_t* records, int count);
+/**
+ * Let the analysis threads drain the rings once every capture thread has
+ * returned, then join them and free the rings
+ * @param overflows Total of the ring overflows
+ * @param cpu_ns CPU time of the analysis threads
+ */
+void rx_pipeline_stop(uint64_t* overflows, uint64_t* cpu_ns);
+
+// Results Functions
+/**
+ * Start the results writer thread; records emitted before this are dropped
+ * @param args Arguments holding the output format and results file
+ * @return 0 on success, -1 on error
+ */
+int results_start(const struct arguments* args);
+/**
+ * Queue one record for the writer thread (blocks only if the queue is full)
+ */
+void results_emit(const result_record_t* record);
+/**
+ * Queue the configuration record of args
+ */
+void results_emit_config(const struct arguments* args);
+/**
+ * Queue the final summary, built from the statistics shared over MSG_STATS
+ * @param direction "client-to-server" or "server-to-client"
+ * @param peer Server, client or source it covers in a fan-out, incast or -I run, or
+ *             NULL; copied into the record
+ */
+void results_emit_summary(const experiment_stats_t* stats, const char* direction, const char* peer);
+/**
+ * Drain the queue, stop the writer thread and close the results file
+ */
+void results_stop(void);
+
+// Metrics Functions
+/**
+ * Serve the live counters of the running streams in the Prometheus text
+ * format at http://<metrics_address>:<metrics_port>/metrics, from a
+ * detached thread, for as long as the process runs
+ * @return 0 on success, -1 if the listener cannot be set up
+ */
+int metrics_start(const struct arguments* args);
 
 uint64_t get_monotonic_time();
 
+// Trace Functions
+/**
+ * Create a preallocated trace file and map it into memory
+ * @param writer Trace state to initialize
+ * @param filename Path of the trace file
+ * @param capacity Number of record slots to preallocate
+ * @param num_streams Number of streams, stored in the file header
+ * @return 0 on success, -1 on error
+ */
+int trace_open(trace_writer_t* writer, const char* filename, uint64_t capacity, int num_streams);
+/**
+ * Attach a per-thread buffer to a trace (writer may be NULL to disable tracing)
+ */
+void trace_buffer_init(trace_buffer_t* buffer, trace_writer_t* writer);
+/**
+ * Append one record; never blocks, drops the record if the file is full
+ */
+void trace_log(trace_buffer_t* buffer, uint32_t stream_id, uint64_t seq,
+               uint64_t tx_ts, uint64_t rx_ts, uint16_t size, uint16_t flags);
+/**
+ * Detach a per-thread buffer and account for its dropped records
+ */
+void trace_buffer_release(trace_buffer_t* buffer);
+/**
+ * Finalize the header, trim unused space and close the trace file
+ */
+void trace_close(trace_writer_t* writer);
+
 
 
 
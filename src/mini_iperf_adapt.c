@@ -0,0 +1,139 @@
+/*
+ * mini_iperf_adapt.c
+ *
+ * Closed-loop rate control (-A). While the senders run, the server reports
+ * the packets, sequence gaps and mean one-way delay of every -F interval
+ * over the control connection (MSG_INTERIM), and a controller on the client
+ * moves the rate of the senders' token bucket between a thousandth of -b
+ * and -b. Runs start at a tenth of -b so a shared path is probed, not flooded.
+ *
+ * aimd:  add 1% of -b per report while the loss stays at or below the
+ *        target, multiply by 0.7 when it does not.
+ * delay: LEDBAT-like. The queueing delay is the report's mean OWD above the
+ *        lowest mean seen in the run, so the clock offset of the two hosts
+ *        cancels out. The rate moves by up to 1% of -b per report in
+ *        proportion to how far that delay is below (or above) the target,
+ *        and is multiplied by 0.7 when it exceeds twice the target or when
+ *        more than 1% of the packets are lost.
+ *
+ * The two reports after a decrease are not acted on: they mostly describe
+ * traffic sent before the decrease took effect.
+ */
+#include "mini_iperf.h"
+
+#define ADAPT_START_FRACTION 0.1    // Initial rate relative to -b
+#define ADAPT_FLOOR_FRACTION 0.001  // Lowest rate relative to -b
+#define ADAPT_STEP_FRACTION 0.01    // Additive step per report relative to -b
+#define ADAPT_BETA 0.7              // Multiplicative decrease
+#define ADAPT_HOLD_REPORTS 2        // Reports ignored after a decrease
+#define ADAPT_DELAY_LOSS_PCT 1.0    // Loss that makes the delay controller back off
+
+static struct {
+    pthread_mutex_t mutex;
+    rate_limiter_t* limiter;        // NULL while no sender runs
+    int mode;
+    double target;
+    double ceiling_bps;
+    double rate_bps;
+    int hold;
+    int have_base;
+    int64_t base_owd_ns;            // Lowest mean OWD of the run
+    result_adapt_t result;
+    double rate_sum;
+} adapt = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+long adapt_start(const struct arguments* args, rate_limiter_t* limiter) {
+    pthread_mutex_lock(&adapt.mutex);
+    adapt.limiter = limiter;
+    adapt.mode = args->adapt;
+    adapt.target = args->adapt_target;
+    adapt.ceiling_bps = args->bandwidth;
+    adapt.rate_bps = args->bandwidth * ADAPT_START_FRACTION;
+    if (adapt.rate_bps < 1) adapt.rate_bps = 1;
+    adapt.hold = 0;
+    adapt.have_base = 0;
+    adapt.rate_sum = 0.0;
+    memset(&adapt.result, 0, sizeof(adapt.result));
+    adapt.result.controller = adapt_name(args->adapt);
+    adapt.result.start_mbps = adapt.rate_bps / 1e6;
+    adapt.result.min_mbps = adapt.result.max_mbps = adapt.rate_bps / 1e6;
+    rate_limiter_set_rate(limiter, (long)adapt.rate_bps);
+    const long rate = (long)adapt.rate_bps;
+    pthread_mutex_unlock(&adapt.mutex);
+    return rate;
+}
+
+// New rate from one report; returns 1 if it was a multiplicative decrease
+static int next_rate(const interim_report_t* report) {
+    const double step = adapt.ceiling_bps * ADAPT_STEP_FRACTION;
+    const double loss_pct = 100.0 * report->lost / (report->packets + report->lost);
+
+    if (adapt.mode == ADAPT_AIMD) {
+        if (loss_pct > adapt.target) {
+            adapt.rate_bps *= ADAPT_BETA;
+            return 1;
+        }
+        adapt.rate_bps += step;
+        return 0;
+    }
+
+    if (!adapt.have_base || report->owd_avg_ns < adapt.base_owd_ns) {
+        adapt.base_owd_ns = report->owd_avg_ns;
+        adapt.have_base = 1;
+    }
+    const double queueing_ms = (report->owd_avg_ns - adapt.base_owd_ns) / 1e6;
+    if (loss_pct > ADAPT_DELAY_LOSS_PCT || queueing_ms > 2 * adapt.target) {
+        adapt.rate_bps *= ADAPT_BETA;
+        return 1;
+    }
+    adapt.rate_bps += step * (adapt.target - queueing_ms) / adapt.target;
+    return 0;
+}
+
+void adapt_feedback(const interim_report_t* report) {
+    pthread_mutex_lock(&adapt.mutex);
+    if (!adapt.limiter || report->packets == 0) {
+        pthread_mutex_unlock(&adapt.mutex);
+        return;
+    }
+    if (adapt.hold > 0) {
+        // Still describes traffic sent before the last decrease; only the
+        // delay baseline is kept up to date
+        adapt.hold--;
+        if (adapt.mode == ADAPT_DELAY && report->owd_avg_ns < adapt.base_owd_ns) {
+            adapt.base_owd_ns = report->owd_avg_ns;
+        }
+        pthread_mutex_unlock(&adapt.mutex);
+        return;
+    }
+
+    if (next_rate(report)) {
+        adapt.result.decreases++;
+        adapt.hold = ADAPT_HOLD_REPORTS;
+    }
+    const double floor_bps = adapt.ceiling_bps * ADAPT_FLOOR_FRACTION;
+    if (adapt.rate_bps > adapt.ceiling_bps) adapt.rate_bps = adapt.ceiling_bps;
+    if (adapt.rate_bps < floor_bps) adapt.rate_bps = floor_bps;
+    if (adapt.rate_bps < 1) adapt.rate_bps = 1;
+    rate_limiter_set_rate(adapt.limiter, (long)adapt.rate_bps);
+
+    result_adapt_t* r = &adapt.result;
+    const double mbps = adapt.rate_bps / 1e6;
+    r->reports++;
+    adapt.rate_sum += mbps;
+    if (mbps < r->min_mbps) r->min_mbps = mbps;
+    if (mbps > r->max_mbps) r->max_mbps = mbps;
+    pthread_mutex_unlock(&adapt.mutex);
+}
+
+void adapt_stop(void) {
+    pthread_mutex_lock(&adapt.mutex);
+    adapt.limiter = NULL;
+    result_record_t record = {.type = RESULT_ADAPT};
+    record.adapt = adapt.result;
+    record.adapt.final_mbps = adapt.rate_bps / 1e6;
+    record.adapt.mean_mbps = adapt.result.reports > 0 ?
+                             adapt.rate_sum / adapt.result.reports : record.adapt.start_mbps;
+    pthread_mutex_unlock(&adapt.mutex);
+    results_emit(&record);
+}
@@ -14,9 +14,40 @@
 int client_socket=-1;
 extern int duration;
 extern pthread_t udp_sender_thread;
+extern pthread_t udp_receiver_thread;
 extern volatile sig_atomic_t stop_flag;
 extern struct arguments args;
 
+#define TRIAL_SETUP_TIMEOUT_S 35 // Wait for the server to accept the test spec (an incast
+                                // server waits up to 30s for its other clients)
+#define TRIAL_SETTLE_US 100000  // Time for packets in flight to arrive before MSG_STOP_EXP
+#define PROBE_IDLE_US 1000000   // Idle latency probing before the streams start
+#define RECEIVER_SETUP_TIMEOUT_NS 2000000000ULL  // Time our receivers get to bind (reverse/duplex)
+#define STOP_POLL_NS 100000000  // Ctrl+C check while waiting for the server's senders
+#define NS_PER_SEC 1000000000L
+
+// Control connection to one server of args.targets; what its channel
+// thread receives is handed to the experiment driver under stats_mutex
+typedef struct {
+  int sock;
+  server_target_t* target;
+  pthread_t recv_thread;
+  experiment_stats_t stats;             // Latest MSG_STATS
+  experiment_stats_t source_stats[MAX_SOURCES]; // Its reports of our -I sources
+  int stats_ready;
+  int start_reply;                      // 1: MSG_ACK, -1: MSG_ERROR
+  experiment_stats_t sender;            // Sender fields of MSG_SEND_DONE
+  int sender_done;
+  int gone;
+} client_session_t;
+
+static client_session_t sessions[MAX_TARGETS];
+static int sessions_count = 0;
+static struct arguments reverse_args;   // Receivers of the server-to-client streams
+static struct arguments fanout_args;    // Senders of all servers of a fan-out
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stats_cond = PTHREAD_COND_INITIALIZER;
+
 /**
  * @brief Connect to the server
  * @param server_ip IP address of the server
@@ -82,13 +113,15 @@ int client_close(int client_socket) {
     return 0;
 }
 
-void* client_channel_recv(void* client_socket) {
-    int sock = *(int*)client_socket;
+
+void* client_channel_recv(void* session_ptr) {
+    client_session_t* session = session_ptr;
+    int sock = session->sock;
     tcp_header_t header;
     int64_t clock_offset = 0;
 
     while (1) {
-        if (recv(sock, &header, sizeof(header), MSG_WAITALL) <= 0) {
+        if (recv_tcp_header(sock, &header) != 0) {
             break; // Server disconnected
         }
 
@@ -98,21 +131,89 @@ void* client_channel_recv(void* client_socket) {
                 uint64_t t3 = get_monotonic_time();
                 uint64_t t1;
                 recv(sock, &t1, sizeof(t1), MSG_WAITALL);
+                t1 = be64toh(t1);
                 clock_offset = ((header.timestamp_ns - t1) + (t3 - header.timestamp_ns)) / 2;
                 break;
             }
             
             case MSG_STATS: {
-                experiment_stats_t stats;
-                recv(sock, &stats, sizeof(stats), MSG_WAITALL);
-                // Process statistics
+                // The whole run, then each of our sources when we spread the streams
+                experiment_stats_t reports[1 + MAX_SOURCES];
+                const int count = 1 + (args.num_sources > 1 ? args.num_sources : 0);
+                if (header.payload_len != count * sizeof(reports[0]) ||
+                    recv(sock, reports, header.payload_len, MSG_WAITALL) != (ssize_t)header.payload_len) {
+                    fprintf(stderr, "Error: Malformed statistics report\n");
+                    goto disconnected;
+                }
+                for (int i = 0; i < count; i++) experiment_stats_swap(&reports[i]);
+                // Hand the report to the thread driving the experiment
+                pthread_mutex_lock(&stats_mutex);
+                session->stats = reports[0];
+                memcpy(session->source_stats, reports + 1, (count - 1) * sizeof(reports[0]));
+                session->stats_ready = 1;
+                pthread_cond_broadcast(&stats_cond);
+                pthread_mutex_unlock(&stats_mutex);
                 break;
             }
             
+            case MSG_INTERIM: {
+                interim_report_t report;
+                if (header.payload_len != sizeof(report) ||
+                    recv(sock, &report, sizeof(report), MSG_WAITALL) != sizeof(report)) {
+                    fprintf(stderr, "Error: Malformed interim report\n");
+                    goto disconnected;
+                }
+                interim_report_swap(&report);
+                adapt_feedback(&report);
+                break;
+            }
+
             case MSG_ACK: {
-                // Acknowledgment received
+                // The server accepted the test and its receivers are bound;
+                // an incast server tells each client which data ports to use
+                start_ack_t ack;
+                if (header.payload_len != 0 && (header.payload_len != sizeof(ack) ||
+                    recv(sock, &ack, sizeof(ack), MSG_WAITALL) != sizeof(ack))) {
+                    fprintf(stderr, "Error: Malformed start acknowledgement\n");
+                    goto disconnected;
+                }
+                pthread_mutex_lock(&stats_mutex);
+                if (header.payload_len != 0) session->target->data_port = ntohs(ack.data_port);
+                session->start_reply = 1;
+                pthread_cond_broadcast(&stats_cond);
+                pthread_mutex_unlock(&stats_mutex);
+                break;
+            }
+
+            case MSG_ERROR: {
+                char reason[MAX_CONTROL_PAYLOAD + 1];
+                if (recv(sock, reason, header.payload_len, MSG_WAITALL) != (ssize_t)header.payload_len) {
+                    goto disconnected;
+                }
+                reason[header.payload_len] = '\0';
+                fprintf(stderr, "Error: Server %s rejected the test: %s\n", session->target->label, reason);
+                pthread_mutex_lock(&stats_mutex);
+                session->start_reply = -1;
+                pthread_cond_broadcast(&stats_cond);
+                pthread_mutex_unlock(&stats_mutex);
                 break;
             }
+            case MSG_SEND_DONE: {
+                experiment_stats_t stats;
+                if (header.payload_len != sizeof(stats) ||
+                    recv(sock, &stats, sizeof(stats), MSG_WAITALL) != sizeof(stats)) {
+                    fprintf(stderr, "Error: Malformed sender report\n");
+                    goto disconnected;
+                }
+                experiment_stats_swap(&stats);
+                pthread_mutex_lock(&stats_mutex);
+                session->sender = stats;
+                session->sender_done = 1;
+                pthread_cond_broadcast(&stats_cond);
+                pthread_mutex_unlock(&stats_mutex);
+                break;
+            }
+
             case MSG_STOP_EXP: {
                 // Stop experiment command received
                 printf("Experiment stopped by server\n");
@@ -125,27 +226,299 @@ void* client_channel_recv(void* client_socket) {
         }
     }
     
-    printf("Server disconnected\n");
+disconnected:
+    pthread_mutex_lock(&stats_mutex);
+    session->gone = 1;
+    pthread_cond_broadcast(&stats_cond);
+    pthread_mutex_unlock(&stats_mutex);
+    printf("Server %s disconnected\n", session->target->label);
     return NULL;
 }
 
-void* client_channel_send(void* client_socket) {
-    int sock = *(int*)client_socket;
+int client_open_sessions(const struct arguments* args) {
+    for (sessions_count = 0; sessions_count < args->num_targets; sessions_count++) {
+        client_session_t* session = &sessions[sessions_count];
+        memset(session, 0, sizeof(*session));
+        session->target = &args->targets[sessions_count];
+        session->sock = client_connect(session->target->address, session->target->port);
+        if (session->sock < 0 ||
+            pthread_create(&session->recv_thread, NULL, client_channel_recv, session) != 0) {
+            if (session->sock >= 0) close(session->sock);
+            break;
+        }
+    }
+    if (sessions_count == args->num_targets) return 0;
+
+    // Leave the servers already connected
+    for (int i = 0; i < sessions_count; i++) {
+        shutdown(sessions[i].sock, SHUT_RDWR);
+        pthread_join(sessions[i].recv_thread, NULL);
+        close(sessions[i].sock);
+    }
+    sessions_count = 0;
+    return -1;
+}
+
+// Bind the receivers of the server-to-client streams on our data ports
+static int start_reverse_receivers(void) {
+    reverse_args = args;
+    reverse_args.data_port = reverse_data_port(&args);
+    stop_flag=1;
+    if (pthread_create(&udp_receiver_thread, NULL, udp_recv, (void*)&reverse_args) != 0) {
+        perror("Error: Cannot start UDP receiver");
+        return -1;
+    }
+    if (udp_receivers_ready(RECEIVER_SETUP_TIMEOUT_NS) != 0) {
+        fprintf(stderr, "Error: Cannot bind data ports %d-%d\n", reverse_args.data_port,
+                reverse_args.data_port + (args.engine == ENGINE_EVENT ? 0 : args.num_streams - 1));
+        stop_flag=0;
+        pthread_join(udp_receiver_thread, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+// Combine the servers' reports of a fan-out: counts and rates add up,
+// delays and jitter are averaged over the packets, and the tails are those
+// of the worst server
+static void aggregate_stats(experiment_stats_t* out) {
+    memset(out, 0, sizeof(*out));
+    double owd_sum = 0, jitter_sum = 0;
+    for (int i = 0; i < sessions_count; i++) {
+        const experiment_stats_t* s = &sessions[i].stats;
+        if (s->total_packets > 0) {
+            const int none = out->total_packets == 0;
+            if (none || s->min_owd_ms < out->min_owd_ms) out->min_owd_ms = s->min_owd_ms;
+            if (none || s->max_owd_ms > out->max_owd_ms) out->max_owd_ms = s->max_owd_ms;
+        }
+        owd_sum += s->avg_owd_ms * s->total_packets;
+        jitter_sum += s->jitter_ms * s->total_packets;
+        out->total_packets += s->total_packets;
+        out->lost_packets += s->lost_packets;
+        out->total_bytes += s->total_bytes;
+        out->payload_bytes += s->payload_bytes;
+        out->corrupt_packets += s->corrupt_packets;
+        out->out_of_order += s->out_of_order;
+        out->expected_packets += s->expected_packets;
+        out->throughput_mbps += s->throughput_mbps;
+        out->goodput_mbps += s->goodput_mbps;
+        out->socket_drops += s->socket_drops;
+        out->rcvbuf_errors += s->rcvbuf_errors;
+        out->in_errors += s->in_errors;
+        out->backlog_drops += s->backlog_drops;
+        out->ring_overflows += s->ring_overflows;
+        if (s->duration_sec > out->duration_sec) out->duration_sec = s->duration_sec;
+        if (s->jitter_stddev_ms > out->jitter_stddev_ms) out->jitter_stddev_ms = s->jitter_stddev_ms;
+        if (s->owd_p50_ms > out->owd_p50_ms) out->owd_p50_ms = s->owd_p50_ms;
+        if (s->owd_p90_ms > out->owd_p90_ms) out->owd_p90_ms = s->owd_p90_ms;
+        if (s->owd_p99_ms > out->owd_p99_ms) out->owd_p99_ms = s->owd_p99_ms;
+        if (s->owd_p999_ms > out->owd_p999_ms) out->owd_p999_ms = s->owd_p999_ms;
+        if (i == 0 || s->rcvbuf_bytes < out->rcvbuf_bytes) out->rcvbuf_bytes = s->rcvbuf_bytes;
+    }
+    if (out->total_packets > 0) {
+        out->avg_owd_ms = owd_sum / out->total_packets;
+        out->jitter_ms = jitter_sum / out->total_packets;
+    }
+}
+
+// Tell the servers that accepted a test we are not running to end it
+static void abort_trial(void) {
+    for (int i = 0; i < sessions_count; i++) {
+        if (sessions[i].start_reply == 1) send_tcp_message(sessions[i].sock, MSG_STOP_EXP, NULL, 0);
+    }
+}
+
+int client_run_trial(experiment_stats_t* stats, experiment_stats_t* reverse_stats) {
+    const int forward = args.direction != DIRECTION_REVERSE;
+    const int reverse = args.direction != DIRECTION_FORWARD;
+    client_session_t* first = &sessions[0];  // The only server unless forward
+    pthread_mutex_lock(&stats_mutex);
+    for (int i = 0; i < sessions_count; i++) {
+        sessions[i].stats_ready = 0;
+        sessions[i].sender_done = 0;
+        sessions[i].start_reply = 0;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+
+    // The server starts sending as soon as it accepts the spec
+    if (reverse && start_reverse_receivers() != 0) return -1;
+
+    // Measure the idle round-trip time before any load is offered
+    const int probing = args.probe_rate > 0 && probe_start(&args) == 0;
+    if (probing) usleep(PROBE_IDLE_US);
+
+    // Send experiment start command with the test spec to every server, and
+    // wait until all of them have bound their receivers for it
+    int accepted = 1;
+    for (int i = 0; i < sessions_count; i++) {
+        struct arguments target_args = args;
+        target_args.data_port = sessions[i].target->data_port;
+        test_spec_t spec;
+        test_spec_encode(&target_args, &spec);
+        if (send_tcp_message(sessions[i].sock, MSG_START_EXP, &spec, sizeof(spec)) != 0) accepted = 0;
+    }
+    if (accepted) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += TRIAL_SETUP_TIMEOUT_S;
+        pthread_mutex_lock(&stats_mutex);
+        for (int i = 0; i < sessions_count && accepted; i++) {
+            client_session_t* session = &sessions[i];
+            while (session->start_reply == 0 && !session->gone) {
+                if (pthread_cond_timedwait(&stats_cond, &stats_mutex, &deadline) == ETIMEDOUT) break;
+            }
+            if (session->start_reply == 0) {
+                fprintf(stderr, "Error: No reply from server %s to the start command\n",
+                        session->target->label);
+            }
+            accepted = session->start_reply == 1;
+        }
+        pthread_mutex_unlock(&stats_mutex);
+    }
+
+    // One set of senders covers every server: -n streams at -b each
+    struct arguments* sender_args = &args;
+    if (sessions_count > 1) {
+        fanout_args = args;
+        fanout_args.num_streams *= sessions_count;
+        if (fanout_args.bandwidth > 0) fanout_args.bandwidth *= sessions_count;
+        sender_args = &fanout_args;
+    }
+    if (accepted && forward) {
+        if (probing) probe_set_loaded();
+        void* (*sender)(void*) = args.transactions > 0 ? udp_transact : udp_sendto;
+        if (pthread_create(&udp_sender_thread, NULL, sender, (void*)sender_args) != 0) {
+            perror("Error: Cannot start UDP sender");
+            accepted = 0;
+        }
+    }
+    if (!accepted) {
+        abort_trial();
+        if (probing) probe_stop();
+        if (reverse) {
+            stop_flag=0;
+            pthread_join(udp_receiver_thread, NULL);
+        }
+        return -1;
+    }
+
+    // The senders return after the experiment duration (or on Ctrl+C); the
+    // server's tell us with MSG_SEND_DONE
+    if (forward) pthread_join(udp_sender_thread, NULL);
+    if (reverse) {
+        if (!forward && probing) probe_set_loaded();
+        pthread_mutex_lock(&stats_mutex);
+        while (!first->sender_done && !first->gone && stop_flag) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += STOP_POLL_NS;
+            if (deadline.tv_nsec >= NS_PER_SEC) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= NS_PER_SEC;
+            }
+            pthread_cond_timedwait(&stats_cond, &stats_mutex, &deadline);
+        }
+        pthread_mutex_unlock(&stats_mutex);
+    }
+    if (probing) probe_stop();
+
+    // When the experiment completes, send stop command
+    usleep(TRIAL_SETTLE_US);
+    int rc = 0;
+    for (int i = 0; i < sessions_count; i++) {
+        if (send_tcp_message(sessions[i].sock, MSG_STOP_EXP, NULL, 0) != 0) rc = -1;
+    }
+
+    // Wait for the servers' final statistics (and the sender report)
+    pthread_mutex_lock(&stats_mutex);
+    for (int i = 0; i < sessions_count; i++) {
+        client_session_t* session = &sessions[i];
+        while (rc == 0 && ((forward && !session->stats_ready) || (reverse && !session->sender_done)) &&
+               !session->gone) {
+            pthread_cond_wait(&stats_cond, &stats_mutex);
+        }
+        if (forward && !session->stats_ready) rc = -1;
+        if (reverse && !session->sender_done) rc = -1;
+    }
+    const experiment_stats_t sender = first->sender;
+    pthread_mutex_unlock(&stats_mutex);
+
+    // The sender's side of the buffer report is only known here; in a
+    // fan-out it covers the senders of all servers
+    if (rc == 0 && forward) {
+        for (int i = 0; i < sessions_count; i++) {
+            sessions[i].stats.sndbuf_bytes = udp_stats.sndbuf_bytes;
+            sessions[i].stats.sndbuf_errors = udp_stats.host.sndbuf_errors;
+            sessions[i].stats.tx_cpu = udp_stats.tx_cpu;
+        }
+        for (int i = 0; i < args.num_sources; i++) {
+            first->source_stats[i].sndbuf_bytes = udp_stats.sndbuf_bytes;
+            first->source_stats[i].sndbuf_errors = udp_stats.host.sndbuf_errors;
+            first->source_stats[i].tx_cpu = udp_stats.tx_cpu;
+        }
+        if (sessions_count > 1) {
+            aggregate_stats(stats);
+            stats->sndbuf_bytes = udp_stats.sndbuf_bytes;
+            stats->sndbuf_errors = udp_stats.host.sndbuf_errors;
+            stats->tx_cpu = udp_stats.tx_cpu;
+        } else {
+            *stats = first->stats;
+        }
+    }
+
+    if (reverse) {
+        stop_flag=0;
+        pthread_join(udp_receiver_thread, NULL);
+        if (rc == 0) {
+            udp_get_experiment_stats(reverse_stats);
+            reverse_stats->sndbuf_bytes = sender.sndbuf_bytes;
+            reverse_stats->sndbuf_errors = sender.sndbuf_errors;
+            reverse_stats->tx_cpu = sender.tx_cpu;
+
+            // Share our report so both ends show the same summary
+            experiment_stats_t shared = *reverse_stats;
+            experiment_stats_swap(&shared);
+            if (send_tcp_message(first->sock, MSG_STATS, &shared, sizeof(shared)) < 0) rc = -1;
+        }
+    }
+    return rc;
+}
+
+void* client_channel_send(void* unused) {
+    (void)unused;
     
     // 1. Perform clock synchronization
     uint64_t t1 = get_monotonic_time();
    // send_tcp_message(sock, MSG_SYNC, &t1, sizeof(t1));
     
-    // 2. Send experiment start command
-    send_tcp_message(sock, MSG_START_EXP, NULL, 0);
-    pthread_create(&udp_sender_thread, NULL, udp_sendto, (void*)&args);
-    
-    // 3. When experiment completes, send stop command
-    // (This would be triggered from your UDP thread)
-    //wait duration seconds and then send stop
-    sleep(duration); // Wait for the experiment duration
-    send_tcp_message(sock, MSG_STOP_EXP, NULL, 0); // Send stop command
-
+    // 2. Run the experiment (or the series of trials of a rate search)
+    if (args.search_loss >= 0) {
+        rate_search(&args);
+    } else {
+        experiment_stats_t stats, reverse_stats;
+        if (client_run_trial(&stats, &reverse_stats) == 0) {
+            // Same summaries the servers report, then the fan-out as a whole
+            if (sessions_count > 1) {
+                for (int i = 0; i < sessions_count; i++) {
+                    results_emit_summary(&sessions[i].stats, "client-to-server", sessions[i].target->label);
+                }
+                results_emit_summary(&stats, "client-to-server", "aggregate");
+            } else if (args.num_sources > 1 && args.direction != DIRECTION_REVERSE) {
+                for (int i = 0; i < args.num_sources; i++) {
+                    results_emit_summary(&sessions[0].source_stats[i], "client-to-server",
+                                         args.sources[i].name);
+                }
+                results_emit_summary(&stats, "client-to-server", "aggregate");
+                if (args.direction != DIRECTION_FORWARD) results_emit_summary(&reverse_stats, "server-to-client", NULL);
+            } else {
+                if (args.direction != DIRECTION_REVERSE) results_emit_summary(&stats, "client-to-server", NULL);
+                if (args.direction != DIRECTION_FORWARD) results_emit_summary(&reverse_stats, "server-to-client", NULL);
+            }
+        }
+    }
 
+    // 3. Done: shutting the connections down also ends client_channel_recv
+    for (int i = 0; i < sessions_count; i++) shutdown(sessions[i].sock, SHUT_RDWR);
+    for (int i = 0; i < sessions_count; i++) pthread_join(sessions[i].recv_thread, NULL);
     return NULL;
-}
\ No newline at end of file
+}
@@ -0,0 +1,499 @@
+/*
+ * mini_iperf_flows.c
+ *
+ * Event engine (-e event). Instead of one thread per stream, args->workers
+ * threads drive args->num_streams flows between them, so tens of thousands
+ * of 5-tuples can be offered to RSS, conntrack or a load balancer.
+ *
+ * Sender: every flow has its own connected socket (and thus its own source
+ * port) towards data port args->data_port. A worker keeps the departure times
+ * of its flows in a hashed timer wheel and, when a flow is due, sends all of
+ * its due packets with one sendmmsg() on that flow's socket.
+ *
+ * Receiver: every worker binds its own SO_REUSEPORT socket to the data port,
+ * so the kernel spreads the flows across workers by their 4-tuple, waits on
+ * it with epoll and reads with recvmmsg(). Flows are told apart by source
+ * address and port in a flat open-addressed table per worker.
+ */
+#include "mini_iperf.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define NS_PER_SEC 1000000000L
+#define WHEEL_SLOTS 4096                // Power of two
+#define WHEEL_TICK_NS 100000ULL         // 100us per slot, 409.6ms per revolution
+#define FLOW_BURST_NS 10000000ULL       // A late flow catches up at most 10ms
+#define FLOW_DRAIN_NS 100000000ULL      // Receive what is queued for 100ms after stop
+
+extern volatile sig_atomic_t stop_flag;
+
+// Send state of one flow
+typedef struct {
+    int fd;
+    uint32_t flow_id;                   // At its server, across all workers; carried as the packets' stream ID
+    uint64_t seq;
+    int32_t wheel_next;                 // Next flow in the same wheel slot, -1 at the end
+    uint64_t next_ns;                   // Next departure
+} flow_tx_t;
+
+// Number of flows driven by worker w (the first workers take one more when -n does not divide)
+static int worker_share(const struct arguments* args, int w) {
+    return args->num_streams / args->workers + (w < args->num_streams % args->workers ? 1 : 0);
+}
+
+void raise_fd_limit(int needed) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= (rlim_t)needed) return;
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < (rlim_t)needed) {
+        fprintf(stderr, "Warning: Descriptor limit %lu is below the %d flows; raise ulimit -n\n",
+                (unsigned long)limit.rlim_cur, needed);
+    }
+}
+
+static void wheel_insert(int32_t* wheel, flow_tx_t* flows, int i, uint64_t tick) {
+    const int slot = tick & (WHEEL_SLOTS - 1);
+    flows[i].wheel_next = wheel[slot];
+    wheel[slot] = i;
+}
+
+void* flow_send_worker(void* stream_ptr) {
+    udp_stream_t* stream = (udp_stream_t*)stream_ptr;
+    struct arguments* args = stream->args;
+    const int batch_size = args->batch_size;
+    const int payload_size = args->packet_size - sizeof(MiniIperfHeader);
+    const int count = worker_share(args, stream->stream_id);
+    if (count == 0) return NULL;
+
+    flow_tx_t* flows = calloc(count, sizeof(flow_tx_t));
+    int32_t* wheel = malloc(WHEEL_SLOTS * sizeof(int32_t));
+    MiniIperfPacket* batch = malloc(batch_size * sizeof(MiniIperfPacket));
+    struct mmsghdr* msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    struct iovec* iovs = calloc(batch_size, sizeof(struct iovec));
+    if (!flows || !wheel || !batch || !msgs || !iovs) {
+        perror("Failed to allocate flow state");
+        free(flows);
+        free(wheel);
+        free(batch);
+        free(msgs);
+        free(iovs);
+        return NULL;
+    }
+    for (int i = 0; i < batch_size; i++) {
+        packet_init(&batch[i], 0, args->crc);
+        iovs[i].iov_base = &batch[i];
+        iovs[i].iov_len = args->packet_size;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (int s = 0; s < WHEEL_SLOTS; s++) wheel[s] = -1;
+
+    // Every flow gets an equal share of the requested bandwidth
+    const uint64_t interval_ns = args->bandwidth > 0 ?
+        (uint64_t)(args->packet_size * 8.0 * args->num_streams / args->bandwidth * NS_PER_SEC) : 0;
+
+    uint32_t first_flow = 0;
+    for (int w = 0; w < stream->stream_id; w++) first_flow += worker_share(args, w);
+    int opened = 0;
+    for (int i = 0; i < count; i++) {
+        struct sockaddr_in server_addr;
+        data_destination(args, first_flow + i, 0, &server_addr, &flows[i].flow_id);
+        // connect() binds the socket to its own ephemeral source port
+        flows[i].fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (flows[i].fd < 0 ||
+            connect(flows[i].fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            perror("Flow socket setup failed");
+            if (flows[i].fd >= 0) close(flows[i].fd);
+            break;
+        }
+        opened++;
+    }
+    if (opened < count) {
+        fprintf(stderr, "Error: Worker %d opened %d of its %d flows\n", stream->stream_id, opened, count);
+        for (int i = 0; i < opened; i++) close(flows[i].fd);
+        free(flows);
+        free(wheel);
+        free(batch);
+        free(msgs);
+        free(iovs);
+        return NULL;
+    }
+    stream_wait_start(stream);
+
+    const uint64_t start_time = get_monotonic_time();
+    for (int i = 0; i < opened; i++) {
+        // Spread the first departures over one interval so flows do not start in lockstep
+        flows[i].next_ns = start_time + (interval_ns ? interval_ns * i / count : 0);
+        wheel_insert(wheel, flows, i, flows[i].next_ns / WHEEL_TICK_NS);
+    }
+    if (opened > 0) {
+        socklen_t optlen = sizeof(stream->sndbuf_bytes);
+        getsockopt(flows[0].fd, SOL_SOCKET, SO_SNDBUF, &stream->sndbuf_bytes, &optlen);
+    }
+
+    uint64_t tick = get_monotonic_time() / WHEEL_TICK_NS;
+    uint32_t batch_seq = 0;
+    int failed = 0;
+    while (stop_flag && !failed) {
+        const uint64_t now = get_monotonic_time();
+        if (args->duration > 0 && now - start_time >= (uint64_t)args->duration * NS_PER_SEC) break;
+
+        // Never walk more than one revolution: older slots are the same slots
+        const uint64_t now_tick = now / WHEEL_TICK_NS;
+        if (now_tick - tick >= WHEEL_SLOTS) tick = now_tick - WHEEL_SLOTS + 1;
+
+        for (; tick <= now_tick && !failed; tick++) {
+            const int slot = tick & (WHEEL_SLOTS - 1);
+            int32_t i = wheel[slot];
+            wheel[slot] = -1;
+            while (i >= 0 && !failed) {
+                flow_tx_t* flow = &flows[i];
+                const int32_t next = flow->wheel_next;
+
+                if (flow->next_ns / WHEEL_TICK_NS <= now_tick) {
+                    // All departures that are due, up to one batch, in one system call
+                    int due = batch_size;
+                    if (interval_ns > 0 && now < flow->next_ns) {
+                        due = 1;   // Due within this tick
+                    } else if (interval_ns > 0) {
+                        const uint64_t behind = (now - flow->next_ns) / interval_ns + 1;
+                        if (behind < (uint64_t)due) due = behind;
+                    }
+                    for (int k = 0; k < due; k++) {
+                        batch[k].header.stream_id = htonl(flow->flow_id);
+                        packet_stamp(&batch[k], flow->seq + k, batch_seq, now, payload_size);
+                    }
+                    int sent = sendmmsg(flow->fd, msgs, due, 0);
+                    batch_seq++;
+                    if (sent < 0) {
+                        // A full queue is retried on the next tick (the host's
+                        // SndbufErrors count it); any other error ends the worker
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+                            perror("Flow sendmmsg failed");
+                            failed = 1;
+                        }
+                        sent = 0;
+                    }
+                    flow->seq += sent;
+                    stream->sent_packets += sent;
+                    stream->sent_bytes += (uint64_t)sent * args->packet_size;
+
+                    flow->next_ns += sent * interval_ns;
+                    if (now > flow->next_ns + FLOW_BURST_NS) flow->next_ns = now;
+                }
+
+                // Re-arm, never in a slot this pass has already walked
+                uint64_t due_tick = flow->next_ns / WHEEL_TICK_NS;
+                if (due_tick <= now_tick) due_tick = now_tick + 1;
+                wheel_insert(wheel, flows, i, due_tick);
+                i = next;
+            }
+        }
+        atomic_store_explicit(&stream->progress.packets, stream->sent_packets, memory_order_relaxed);
+        atomic_store_explicit(&stream->progress.bytes, stream->sent_bytes, memory_order_relaxed);
+
+        // Sleep to the start of the next tick
+        const uint64_t wake = tick * WHEEL_TICK_NS;
+        const uint64_t after = get_monotonic_time();
+        if (wake > after) {
+            struct timespec delay = {.tv_sec = 0, .tv_nsec = wake - after};
+            nanosleep(&delay, NULL);
+        }
+    }
+
+    for (int i = 0; i < opened; i++) close(flows[i].fd);
+    free(flows);
+    free(wheel);
+    free(batch);
+    free(msgs);
+    free(iovs);
+    return NULL;
+}
+
+// Find (or claim) the table slot of a source address; NULL if the table is full
+static flow_rx_t* flow_lookup(udp_stream_t* stream, const struct sockaddr_in* from, uint32_t* next_id) {
+    const uint32_t mask = stream->flows_capacity - 1;
+    uint32_t h = (from->sin_addr.s_addr * 0x9E3779B1u) ^ (from->sin_port * 0x85EBCA6Bu);
+    for (uint32_t probe = 0; probe <= mask; probe++) {
+        flow_rx_t* flow = &stream->flows[(h + probe) & mask];
+        if (flow->addr == from->sin_addr.s_addr && flow->port == from->sin_port) return flow;
+        if (flow->addr == 0) {
+            flow->addr = from->sin_addr.s_addr;
+            flow->port = from->sin_port;
+            flow->flow_id = (*next_id)++;
+            return flow;
+        }
+    }
+    return NULL;
+}
+
+// Per-flow sequence tracking plus the worker-wide totals in stream->stats
+static void flow_account(udp_stream_t* stream, flow_rx_t* flow, const packet_info_t* info,
+                         int bytes, uint64_t recv_time) {
+    udp_stream_stats_t* stats = &stream->stats;
+    const uint64_t seq = info->seq;
+
+    // Same payload check as the stream receivers
+    if (!packet_verify(info)) {
+        stats->corrupt_packets++;
+        trace_log(&stream->trace, flow->flow_id, seq, info->sent_ns, recv_time, bytes,
+                  TRACE_FLAG_CORRUPT);
+        return;
+    }
+    trace_log(&stream->trace, flow->flow_id, seq, info->sent_ns, recv_time, bytes, 0);
+    record_delay(stats, (int64_t)(recv_time - info->sent_ns));
+
+    if (flow->packets == 0) {
+        flow->first_ts = recv_time;
+        flow->expected_seq = seq + 1;
+    } else if (seq == flow->expected_seq) {
+        flow->expected_seq++;
+    } else if (seq > flow->expected_seq) {
+        flow->lost += seq - flow->expected_seq;
+        stats->lost_packets += seq - flow->expected_seq;
+        flow->expected_seq = seq + 1;
+    } else {
+        flow->out_of_order++;
+        stats->out_of_order++;
+    }
+    flow->packets++;
+    flow->bytes += bytes;
+    flow->last_ts = recv_time;
+
+    if (stats->received_packets == 0) stats->first_ts = recv_time;
+    stats->last_ts = recv_time;
+    stats->total_bytes += bytes;
+    stats->payload_bytes += info->payload_size;
+    stats->received_packets++;
+}
+
+void* flow_recv_worker(void* stream_ptr) {
+    udp_stream_t* stream = (udp_stream_t*)stream_ptr;
+    struct arguments* args = stream->args;
+    udp_stream_stats_t* stats = &stream->stats;
+    const int batch_size = args->batch_size;
+
+    // Any worker may see any flow, so every table can hold all of them at half load
+    stream->flows_capacity = 1024;
+    while (stream->flows_capacity < 2 * args->num_streams) stream->flows_capacity *= 2;
+    stream->flows = calloc(stream->flows_capacity, sizeof(flow_rx_t));
+    stats->owd_samples_capacity = 100000;
+    stats->owd_samples = malloc(stats->owd_samples_capacity * sizeof(int64_t));
+    stats->owd_rng = 0x0DDULL + stream->stream_id;
+    MiniIperfPacket* packets = malloc(batch_size * sizeof(MiniIperfPacket));
+    struct mmsghdr* msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    struct iovec* iovs = calloc(batch_size, sizeof(struct iovec));
+    struct sockaddr_in* peers = calloc(batch_size, sizeof(struct sockaddr_in));
+    if (!stream->flows || !stats->owd_samples || !packets || !msgs || !iovs || !peers) {
+        perror("Failed to allocate flow receive buffers");
+        free(packets);
+        free(msgs);
+        free(iovs);
+        free(peers);
+        return NULL;
+    }
+    for (int i = 0; i < batch_size; i++) {
+        iovs[i].iov_base = &packets[i];
+        iovs[i].iov_len = sizeof(MiniIperfPacket);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &peers[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    int epfd = epoll_create1(0);
+    int optval = 1;
+    int bufsize = 256 * 1024 * 1024;  // 256MB
+    struct sockaddr_in server_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(args->data_port),
+        .sin_addr.s_addr = INADDR_ANY
+    };
+    struct epoll_event event = {.events = EPOLLIN};
+    if (sock < 0 || epfd < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0 ||
+        bind(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ||
+        epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &event) < 0) {
+        perror("Flow receiver socket setup failed");
+        if (sock >= 0) close(sock);
+        if (epfd >= 0) close(epfd);
+        free(packets);
+        free(msgs);
+        free(iovs);
+        free(peers);
+        return NULL;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    socklen_t optlen = sizeof(stats->rcvbuf_bytes);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &stats->rcvbuf_bytes, &optlen);
+
+    atomic_store(&stream->ready, 1);
+
+    uint32_t next_id = 0;
+    uint64_t drain_end = 0;
+    while (1) {
+        if (!stop_flag && drain_end == 0) drain_end = get_monotonic_time() + FLOW_DRAIN_NS;
+        if (drain_end && get_monotonic_time() >= drain_end) break;
+
+        struct epoll_event ready;
+        int n = epoll_wait(epfd, &ready, 1, 10);  // 10ms timeout
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait failed");
+            break;
+        }
+        if (n <= 0) {
+            if (drain_end) break;  // Queue is empty after stop
+            continue;
+        }
+
+        // Read until the socket is empty
+        int count;
+        while ((count = recvmmsg(sock, msgs, batch_size, MSG_DONTWAIT, NULL)) > 0) {
+            const uint64_t recv_time = get_monotonic_time();
+            for (int i = 0; i < count; i++) {
+                msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+                packet_info_t info;
+                if (packet_parse(&packets[i], msgs[i].msg_len, &info) != 0 || info.payload_size == 0) {
+                    stats->corrupt_packets++;
+                    continue;
+                }
+                flow_rx_t* flow = flow_lookup(stream, &peers[i], &next_id);
+                if (!flow) {
+                    stream->untracked_packets++;
+                    continue;
+                }
+                flow_account(stream, flow, &info, msgs[i].msg_len, recv_time);
+            }
+            publish_progress(stream);
+            if (count < batch_size) break;
+        }
+    }
+
+    // Expected packets of the worker, for the loss percentage
+    for (int i = 0; i < stream->flows_capacity; i++) {
+        stats->expected_seq += stream->flows[i].packets + stream->flows[i].lost;
+    }
+
+    trace_buffer_release(&stream->trace);
+    close(epfd);
+    close(sock);
+    free(packets);
+    free(msgs);
+    free(iovs);
+    free(peers);
+    return NULL;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_flow(const void* a, const void* b) {
+    const flow_rx_t* x = a;
+    const flow_rx_t* y = b;
+    if (x->addr != y->addr) return x->addr < y->addr ? -1 : 1;
+    return x->port < y->port ? -1 : x->port > y->port;
+}
+
+void flow_report(const struct arguments* args, udp_stream_t* workers, int n) {
+    int total = 0;
+    uint64_t untracked = 0;
+    for (int w = 0; w < n; w++) {
+        untracked += workers[w].untracked_packets;
+        for (int i = 0; i < workers[w].flows_capacity; i++) {
+            if (workers[w].flows[i].packets > 0) total++;
+        }
+    }
+
+    flow_rx_t* flows = malloc((total + 1) * sizeof(flow_rx_t));
+    double* rates = malloc((total + 1) * sizeof(double));
+    if (!flows || !rates) {
+        free(flows);
+        free(rates);
+        return;
+    }
+
+    // Gather the flows of all workers. A flow whose packets reached more than
+    // one worker (while the SO_REUSEPORT group was still forming) is merged.
+    int seen = 0;
+    uint64_t run_first = 0, run_last = 0;
+    for (int w = 0; w < n; w++) {
+        for (int i = 0; i < workers[w].flows_capacity; i++) {
+            if (workers[w].flows[i].packets > 0) flows[seen++] = workers[w].flows[i];
+        }
+    }
+    qsort(flows, seen, sizeof(flow_rx_t), compare_flow);
+    int merged = 0;
+    for (int i = 0; i < seen; i++) {
+        flow_rx_t* flow = &flows[i];
+        if (merged > 0 && compare_flow(&flows[merged - 1], flow) == 0) {
+            flow_rx_t* into = &flows[merged - 1];
+            into->packets += flow->packets;
+            into->bytes += flow->bytes;
+            into->lost += flow->lost;
+            into->out_of_order += flow->out_of_order;
+            if (flow->first_ts < into->first_ts) into->first_ts = flow->first_ts;
+            if (flow->last_ts > into->last_ts) into->last_ts = flow->last_ts;
+        } else {
+            flows[merged++] = *flow;
+        }
+        if (run_first == 0 || flow->first_ts < run_first) run_first = flow->first_ts;
+        if (flow->last_ts > run_last) run_last = flow->last_ts;
+    }
+    seen = merged;
+
+    // Every flow runs for the whole test, so all are rated over the run's duration
+    double duration = (run_last - run_first) / (double)NS_PER_SEC;
+    if (duration <= 0) duration = 1e-9;
+    double sum = 0.0, sum_squares = 0.0, max_loss = 0.0;
+    result_record_t record = {.type = RESULT_STREAM};
+    result_metrics_t* m = &record.metrics;
+    for (int i = 0; i < seen; i++) {
+        const flow_rx_t* flow = &flows[i];
+        const double loss = 100.0 * flow->lost / (flow->packets + flow->lost);
+        rates[i] = flow->bytes * 8.0 / (duration * 1e6);
+        sum += rates[i];
+        sum_squares += rates[i] * rates[i];
+        if (loss > max_loss) max_loss = loss;
+
+        // One record per flow for machine-readable output only; text
+        // reports would be thousands of blocks long
+        if (args->output_format != OUTPUT_TEXT) {
+            memset(m, 0, sizeof(*m));
+            m->side = "receiver";
+            m->direction = data_direction(args, "receiver");
+            m->stream_id = i;
+            m->start_s = (flow->first_ts - run_first) / (double)NS_PER_SEC;
+            m->end_s = (flow->last_ts - run_first) / (double)NS_PER_SEC;
+            m->packets = flow->packets;
+            m->bytes = flow->bytes;
+            m->payload_bytes = flow->bytes - flow->packets * sizeof(MiniIperfHeader);
+            m->lost = flow->lost;
+            m->out_of_order = flow->out_of_order;
+            m->loss_pct = loss;
+            m->throughput_mbps = rates[i];
+            m->goodput_mbps = m->payload_bytes * 8.0 / (duration * 1e6);
+            results_emit(&record);
+        }
+    }
+
+    result_record_t summary = {.type = RESULT_FLOWS};
+    result_flows_t* f = &summary.flows;
+    f->flows_expected = args->num_streams;
+    f->flows_seen = seen;
+    f->untracked_packets = untracked;
+    f->max_loss_pct = max_loss;
+    if (seen > 0) {
+        qsort(rates, seen, sizeof(double), compare_double);
+        f->min_mbps = rates[0];
+        f->p50_mbps = rates[seen / 2];
+        f->max_mbps = rates[seen - 1];
+        f->fairness = sum_squares > 0 ? sum * sum / (seen * sum_squares) : 1.0;
+    }
+    results_emit(&summary);
+    free(flows);
+    free(rates);
+}
@@ -0,0 +1,433 @@
+/*
+ * mini_iperf_impair.c
+ *
+ * In-process impairment stage for the senders (-X), to check the
+ * receivers' loss, reordering, duplicate, corruption and delay figures
+ * against a known truth without tc netem or root.
+ *
+ * Each sender stream hands its batches to its own stage instead of the
+ * socket. With a generator seeded from -X seed= and the stream number,
+ * every packet is dropped, or copied (twice when duplicated, its last
+ * payload byte flipped when corrupted) and held until its release time:
+ * now + delay + jitter, plus the reorder hold for the packets picked for
+ * it. The stage sends what falls due at each batch and while the sender
+ * sleeps for pacing. The decisions depend only on the seed and the
+ * sequence of packets, so a run can be repeated.
+ *
+ * The ground truth is kept two ways: counters of what was done (and what
+ * the receiver's accounting should make of the packets in the order they
+ * left), emitted as RESULT_IMPAIR, and optionally a trace file in the -f
+ * format with one record per release or drop, for mini_iperf_analyze.
+ */
+#include "mini_iperf.h"
+
+#define NS_PER_SEC 1000000000L
+#define IMPAIR_UNPACED_PPS 1000000.0     // Rate assumed per stream without -b, to size the stage
+#define IMPAIR_MAX_HELD (1 << 18)        // Packets one stage may hold
+#define IMPAIR_MAX_BYTES (256UL << 20)   // Memory one stage may hold them in
+
+// One packet held by the stage, ordered by release time, then arrival
+typedef struct {
+    uint64_t release_ns;
+    uint64_t order;
+    uint64_t entered_ns;
+    uint32_t slot;
+    uint16_t len;
+    uint16_t flags;                     // TraceFlags of the copy
+} held_packet_t;
+
+struct impair_stream {
+    const impair_config_t* config;
+    int verify;                         // Receivers check payloads (corruption is visible)
+    uint32_t stream_id;
+    uint64_t rng;
+    trace_buffer_t* log;                // The stream's trace buffer, on the log when there is one
+
+    int slot_size;
+    int capacity;
+    char* slab;                         // capacity slots of slot_size bytes
+    struct sockaddr_in* dests;          // Destination of each slot
+    uint32_t* free_slots;
+    int free_count;
+    held_packet_t* heap;                // Min-heap of the held packets
+    int held;
+    uint64_t order;
+
+    struct mmsghdr* out;                // Releases sent together
+    struct iovec* out_iovs;
+    uint32_t* out_slots;
+    int out_size;
+
+    result_impair_t counts;
+    double held_sum_ns;
+    uint64_t released;
+    uint64_t expected_seq;              // Receiver model (see account_valid)
+    int seen;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    result_impair_t totals;
+    double held_sum_ns;
+    uint64_t released;
+    trace_writer_t log;
+    int log_open;
+} impair_run = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static int chance(uint64_t* state, double pct) {
+    return pct > 0 && rng_uniform(state) * 100.0 < pct;
+}
+
+static int heap_before(const held_packet_t* a, const held_packet_t* b) {
+    return a->release_ns < b->release_ns || (a->release_ns == b->release_ns && a->order < b->order);
+}
+
+static void heap_push(impair_stream_t* impair, const held_packet_t* packet) {
+    int i = impair->held++;
+    while (i > 0) {
+        const int parent = (i - 1) / 2;
+        if (!heap_before(packet, &impair->heap[parent])) break;
+        impair->heap[i] = impair->heap[parent];
+        i = parent;
+    }
+    impair->heap[i] = *packet;
+}
+
+static held_packet_t heap_pop(impair_stream_t* impair) {
+    const held_packet_t top = impair->heap[0];
+    const held_packet_t last = impair->heap[--impair->held];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= impair->held) break;
+        if (child + 1 < impair->held && heap_before(&impair->heap[child + 1], &impair->heap[child])) child++;
+        if (!heap_before(&impair->heap[child], &last)) break;
+        impair->heap[i] = impair->heap[child];
+        i = child;
+    }
+    if (impair->held > 0) impair->heap[i] = last;
+    return top;
+}
+
+// Ground truth of one copy leaving the stage, and the receiver's view of it
+static void account_release(impair_stream_t* impair, const held_packet_t* packet, uint64_t now) {
+    const MiniIperfHeader* header = (const MiniIperfHeader*)(impair->slab + (size_t)packet->slot * impair->slot_size);
+    const uint64_t seq = be64toh(header->seq_num);
+    const uint64_t held_ns = now - packet->entered_ns;
+    impair->held_sum_ns += held_ns;
+    impair->released++;
+    if (held_ns / 1e6 > impair->counts.max_held_ms) impair->counts.max_held_ms = held_ns / 1e6;
+    trace_log(impair->log, impair->stream_id, seq, be64toh(header->timestamp_ns), now, packet->len,
+              packet->flags);
+
+    result_impair_t* c = &impair->counts;
+    if ((packet->flags & TRACE_FLAG_CORRUPT) && impair->verify) {
+        c->expect_corrupt++;
+        return;
+    }
+    c->expect_packets++;
+    if (!impair->seen) {
+        impair->seen = 1;
+        impair->expected_seq = seq + 1;
+    } else if (seq == impair->expected_seq) {
+        impair->expected_seq++;
+    } else if (seq > impair->expected_seq) {
+        c->expect_lost += seq - impair->expected_seq;
+        impair->expected_seq = seq + 1;
+    } else {
+        c->expect_out_of_order++;
+    }
+}
+
+// Send up to limit held packets due by due_ns; returns -1 on a fatal error
+static int release(impair_stream_t* impair, int sock, int engine, uint64_t due_ns, int limit) {
+    while (limit > 0 && impair->held > 0 && impair->heap[0].release_ns <= due_ns) {
+        const uint64_t now = get_monotonic_time();
+        int n = 0;
+        while (n < impair->out_size && n < limit && impair->held > 0 && impair->heap[0].release_ns <= due_ns) {
+            const held_packet_t packet = heap_pop(impair);
+            account_release(impair, &packet, now);
+            impair->out_iovs[n].iov_base = impair->slab + (size_t)packet.slot * impair->slot_size;
+            impair->out_iovs[n].iov_len = packet.len;
+            impair->out[n].msg_hdr.msg_name = &impair->dests[packet.slot];
+            impair->out_slots[n] = packet.slot;
+            n++;
+        }
+        const int rc = send_batch(sock, engine, impair->out, n);
+        for (int i = 0; i < n; i++) impair->free_slots[impair->free_count++] = impair->out_slots[i];
+        if (rc < 0) return -1;
+        limit -= n;
+    }
+    return 0;
+}
+
+int impair_start(const struct arguments* args, trace_writer_t** log) {
+    pthread_mutex_lock(&impair_run.mutex);
+    memset(&impair_run.totals, 0, sizeof(impair_run.totals));
+    impair_run.totals.seed = args->impair.seed;
+    impair_run.held_sum_ns = 0;
+    impair_run.released = 0;
+    *log = NULL;
+    int rc = 0;
+    if (args->impair.log_file) {
+        // One record per offered packet and per duplicate, sized like the receivers' trace
+        uint64_t capacity = TRACE_DEFAULT_RECORDS;
+        if (args->bandwidth > 0 && args->duration > 0) {
+            capacity = (uint64_t)((1.25 + args->impair.duplicate_pct / 100.0) * args->bandwidth *
+                                  args->duration / (args->packet_size * 8.0))
+                       + (uint64_t)args->num_streams * TRACE_CHUNK_RECORDS;
+        }
+        impair_run.log_open = trace_open(&impair_run.log, args->impair.log_file, capacity,
+                                         args->num_streams) == 0;
+        if (impair_run.log_open) {
+            *log = &impair_run.log;
+        } else {
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock(&impair_run.mutex);
+    return rc;
+}
+
+impair_stream_t* impair_open(udp_stream_t* stream) {
+    const struct arguments* args = stream->args;
+    const impair_config_t* config = &args->impair;
+    impair_stream_t* impair = calloc(1, sizeof(*impair));
+    if (!impair) {
+        perror("Error: Memory allocation failed for the impairment stage");
+        return NULL;
+    }
+    impair->config = config;
+    impair->verify = args->verify;
+    impair->stream_id = stream->stream_id;
+    impair->rng = config->seed + (uint64_t)stream->stream_id * 0xD1B54A32D192ED03ULL;
+    impair->log = &stream->trace;
+
+    // Room for everything sent within the longest hold, duplicates included
+    int max_packet_size = args->packet_size;
+    for (int i = 0; i < args->sizes.count; i++) {
+        if (args->sizes.sizes[i] > max_packet_size) max_packet_size = args->sizes.sizes[i];
+    }
+    const double pps = args->bandwidth > 0 ? args->bandwidth / (8.0 * args->packet_size) / args->num_streams
+                                           : IMPAIR_UNPACED_PPS;
+    const double max_hold_s = (config->delay_ns + config->jitter_ns + config->reorder_ns) / (double)NS_PER_SEC;
+    double capacity = 2 * (1 + config->duplicate_pct / 100.0) * pps * max_hold_s + 4 * args->batch_size;
+    if (capacity > IMPAIR_MAX_HELD) capacity = IMPAIR_MAX_HELD;
+    if (capacity > IMPAIR_MAX_BYTES / max_packet_size) capacity = IMPAIR_MAX_BYTES / max_packet_size;
+    if (capacity < 4 * args->batch_size) capacity = 4 * args->batch_size;
+    impair->slot_size = max_packet_size;
+    impair->capacity = (int)capacity;
+    impair->out_size = args->batch_size;
+
+    impair->slab = malloc((size_t)impair->capacity * impair->slot_size);
+    impair->dests = calloc(impair->capacity, sizeof(struct sockaddr_in));
+    impair->free_slots = malloc(impair->capacity * sizeof(uint32_t));
+    impair->heap = malloc(impair->capacity * sizeof(held_packet_t));
+    impair->out = calloc(impair->out_size, sizeof(struct mmsghdr));
+    impair->out_iovs = calloc(impair->out_size, sizeof(struct iovec));
+    impair->out_slots = malloc(impair->out_size * sizeof(uint32_t));
+    if (!impair->slab || !impair->dests || !impair->free_slots || !impair->heap || !impair->out ||
+        !impair->out_iovs || !impair->out_slots) {
+        perror("Error: Memory allocation failed for the impairment stage");
+        impair_close(impair, -1, 0);
+        return NULL;
+    }
+    for (int i = 0; i < impair->capacity; i++) impair->free_slots[i] = impair->capacity - 1 - i;
+    impair->free_count = impair->capacity;
+    for (int i = 0; i < impair->out_size; i++) {
+        impair->out[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        impair->out[i].msg_hdr.msg_iov = &impair->out_iovs[i];
+        impair->out[i].msg_hdr.msg_iovlen = 1;
+    }
+    return impair;
+}
+
+int impair_send(impair_stream_t* impair, int sock, int engine, struct mmsghdr* msgs, int count) {
+    const impair_config_t* config = impair->config;
+    const uint64_t now = get_monotonic_time();
+    result_impair_t* c = &impair->counts;
+
+    for (int i = 0; i < count; i++) {
+        const struct msghdr* msg = &msgs[i].msg_hdr;
+        const char* data = msg->msg_iov->iov_base;
+        const uint16_t len = msg->msg_iov->iov_len;
+        c->offered++;
+
+        if (chance(&impair->rng, config->drop_pct)) {
+            const MiniIperfHeader* header = (const MiniIperfHeader*)data;
+            trace_log(impair->log, impair->stream_id, be64toh(header->seq_num),
+                      be64toh(header->timestamp_ns), 0, len, TRACE_FLAG_DROPPED);
+            c->dropped++;
+            continue;
+        }
+        const int copies = chance(&impair->rng, config->duplicate_pct) ? 2 : 1;
+        const int corrupt = chance(&impair->rng, config->corrupt_pct);
+        uint64_t hold = config->delay_ns;
+        if (config->jitter_ns > 0) hold += (uint64_t)(rng_uniform(&impair->rng) * config->jitter_ns);
+        uint16_t flags = hold > 0 ? TRACE_FLAG_DELAYED : 0;
+        if (chance(&impair->rng, config->reorder_pct)) {
+            hold += config->reorder_ns;
+            flags |= TRACE_FLAG_REORDERED;
+            c->reordered++;
+        }
+        if (flags & TRACE_FLAG_DELAYED) c->delayed++;
+        c->duplicated += copies - 1;
+        if (corrupt) {
+            flags |= TRACE_FLAG_CORRUPT;
+            c->corrupted += copies;
+        }
+
+        for (int k = 0; k < copies; k++) {
+            // A full stage lets its next packet go early
+            if (impair->free_count == 0 && release(impair, sock, engine, UINT64_MAX, 1) < 0) return -1;
+            const uint32_t slot = impair->free_slots[--impair->free_count];
+            char* copy = impair->slab + (size_t)slot * impair->slot_size;
+            memcpy(copy, data, len);
+            if (corrupt) copy[len - 1] ^= 0xFF;
+            memcpy(&impair->dests[slot], msg->msg_name, sizeof(struct sockaddr_in));
+            const held_packet_t packet = {
+                .release_ns = now + hold,
+                .order = impair->order++,
+                .entered_ns = now,
+                .slot = slot,
+                .len = len,
+                .flags = flags | (k > 0 ? TRACE_FLAG_DUPLICATE : 0)
+            };
+            heap_push(impair, &packet);
+        }
+    }
+    return release(impair, sock, engine, get_monotonic_time(), INT32_MAX);
+}
+
+// Sleep until until_ns, releasing the held packets on time; -1 on a fatal error
+static int wait_releasing(impair_stream_t* impair, int sock, int engine, uint64_t until_ns) {
+    while (1) {
+        uint64_t now = get_monotonic_time();
+        if (release(impair, sock, engine, now, INT32_MAX) < 0) return -1;
+        if (now >= until_ns) return 0;
+        uint64_t wake = until_ns;
+        if (impair->held > 0 && impair->heap[0].release_ns < wake) wake = impair->heap[0].release_ns;
+        if (wake > now) {
+            struct timespec delay = {.tv_sec = (wake - now) / NS_PER_SEC, .tv_nsec = (wake - now) % NS_PER_SEC};
+            nanosleep(&delay, NULL);
+        }
+    }
+}
+
+void impair_sleep(impair_stream_t* impair, int sock, int engine, uint64_t until_ns) {
+    wait_releasing(impair, sock, engine, until_ns);
+}
+
+void impair_close(impair_stream_t* impair, int sock, int engine) {
+    // The last packets still leave at their times
+    while (sock >= 0 && impair->held > 0) {
+        if (wait_releasing(impair, sock, engine, impair->heap[0].release_ns) < 0) break;
+    }
+
+    pthread_mutex_lock(&impair_run.mutex);
+    result_impair_t* t = &impair_run.totals;
+    const result_impair_t* c = &impair->counts;
+    t->offered += c->offered;
+    t->dropped += c->dropped;
+    t->duplicated += c->duplicated;
+    t->corrupted += c->corrupted;
+    t->reordered += c->reordered;
+    t->delayed += c->delayed;
+    if (c->max_held_ms > t->max_held_ms) t->max_held_ms = c->max_held_ms;
+    t->expect_packets += c->expect_packets;
+    t->expect_lost += c->expect_lost;
+    t->expect_out_of_order += c->expect_out_of_order;
+    t->expect_corrupt += c->expect_corrupt;
+    impair_run.held_sum_ns += impair->held_sum_ns;
+    impair_run.released += impair->released;
+    pthread_mutex_unlock(&impair_run.mutex);
+
+    trace_buffer_release(impair->log);
+    free(impair->slab);
+    free(impair->dests);
+    free(impair->free_slots);
+    free(impair->heap);
+    free(impair->out);
+    free(impair->out_iovs);
+    free(impair->out_slots);
+    free(impair);
+}
+
+void impair_stop(void) {
+    pthread_mutex_lock(&impair_run.mutex);
+    if (impair_run.log_open) {
+        trace_close(&impair_run.log);
+        impair_run.log_open = 0;
+    }
+    result_record_t record = {.type = RESULT_IMPAIR};
+    record.impair = impair_run.totals;
+    record.impair.mean_held_ms = impair_run.released > 0 ?
+                                 impair_run.held_sum_ns / impair_run.released / 1e6 : 0;
+    pthread_mutex_unlock(&impair_run.mutex);
+    results_emit(&record);
+}
+
+int parse_impair(const char* spec, struct arguments* args) {
+    impair_config_t* config = &args->impair;
+    char* copy = strdup(spec);
+    if (!copy) {
+        perror("Error: Memory allocation failed for the impairments");
+        return -1;
+    }
+    int seeded = 0;
+    int rc = 0;
+    char* saveptr = NULL;
+    for (char* tok = strtok_r(copy, ",", &saveptr); tok && rc == 0; tok = strtok_r(NULL, ",", &saveptr)) {
+        char* value = strchr(tok, '=');
+        if (!value) {
+            rc = -1;
+            break;
+        }
+        *value++ = '\0';
+        char* second = strchr(value, ':');
+        if (second) *second++ = '\0';
+        char* end;
+        const double x = strtod(value, &end);
+        const int numeric = end != value && *end == '\0';
+        const double y = second ? strtod(second, &end) : 0;
+        const int second_ok = !second || (end != second && *end == '\0' && y >= 0);
+
+        if (strcmp(tok, "drop") == 0 && numeric && !second && x >= 0 && x <= 100) {
+            config->drop_pct = x;
+        } else if (strcmp(tok, "dup") == 0 && numeric && !second && x >= 0 && x <= 100) {
+            config->duplicate_pct = x;
+        } else if (strcmp(tok, "corrupt") == 0 && numeric && !second && x >= 0 && x <= 100) {
+            config->corrupt_pct = x;
+        } else if (strcmp(tok, "reorder") == 0 && numeric && second_ok && x >= 0 && x <= 100) {
+            config->reorder_pct = x;
+            config->reorder_ns = (uint64_t)((second ? y : 1.0) * 1e6);
+        } else if (strcmp(tok, "delay") == 0 && numeric && second_ok && x >= 0) {
+            config->delay_ns = (uint64_t)(x * 1e6);
+            config->jitter_ns = (uint64_t)(y * 1e6);
+        } else if (strcmp(tok, "seed") == 0 && !second && *value) {
+            config->seed = strtoull(value, &end, 0);
+            if (*end != '\0') rc = -1;
+            seeded = 1;
+        } else if (strcmp(tok, "log") == 0 && *value) {
+            if (second) second[-1] = ':';  // File names may hold a colon
+            free(config->log_file);
+            config->log_file = strdup(value);
+            if (!config->log_file) rc = -1;
+        } else {
+            rc = -1;
+        }
+    }
+    free(copy);
+    if (rc != 0) {
+        fprintf(stderr, "Error: Invalid impairments '%s' (use drop=<%%>, dup=<%%>, corrupt=<%%>, "
+                "reorder=<%%>[:<ms>], delay=<ms>[:<jitter ms>], seed=<n>, log=<file>)\n", spec);
+        return -1;
+    }
+    if (config->delay_ns + config->jitter_ns + config->reorder_ns > 10 * (uint64_t)NS_PER_SEC) {
+        fprintf(stderr, "Error: Impairments may hold a packet for at most 10 seconds\n");
+        return -1;
+    }
+    if (!seeded) config->seed = get_monotonic_time() ^ ((uint64_t)getpid() << 32);
+    config->enabled = 1;
+    return 0;
+}
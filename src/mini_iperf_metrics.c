@@ -0,0 +1,188 @@
+/*
+ * mini_iperf_metrics.c
+ *
+ * Live metrics for long runs (-M). A listener thread answers HTTP GET
+ * /metrics with the Prometheus text format: the counters every running
+ * stream publishes (per stream and summed per side) and the delay
+ * histogram of the receivers.
+ *
+ * A scrape copies the published counters (udp_live_snapshot) and formats
+ * the copy. The stream threads never wait for it; they only store to their
+ * own atomics, once per batch (per packet for the histogram).
+ */
+#include "mini_iperf.h"
+
+#define METRICS_REQUEST_MAX 4096        // Longer request heads are refused
+#define METRICS_READ_TIMEOUT_S 2        // A client that sends nothing is dropped
+
+static int metrics_socket = -1;
+static pthread_t metrics_thread;
+
+// Streams of one side, copied at the start of a scrape
+typedef struct {
+    const char* side;
+    udp_live_stream_t* streams;
+    int count;
+} side_snapshot_t;
+
+// One counter of the given sides: a family of per-stream lines, then a
+// family of their sums per side
+static void write_counter(FILE* out, const char* name, const char* help,
+                          const side_snapshot_t* sides, int count, size_t offset) {
+    fprintf(out, "# HELP mini_iperf_stream_%s %s, per stream\n", name, help);
+    fprintf(out, "# TYPE mini_iperf_stream_%s counter\n", name);
+    for (int s = 0; s < count; s++) {
+        for (int i = 0; i < sides[s].count; i++) {
+            const udp_live_stream_t* stream = &sides[s].streams[i];
+            fprintf(out, "mini_iperf_stream_%s{side=\"%s\",stream=\"%d\"} %lu\n", name,
+                    sides[s].side, stream->stream_id, *(const uint64_t*)((const char*)stream + offset));
+        }
+    }
+    fprintf(out, "# HELP mini_iperf_%s %s\n", name, help);
+    fprintf(out, "# TYPE mini_iperf_%s counter\n", name);
+    for (int s = 0; s < count; s++) {
+        uint64_t total = 0;
+        for (int i = 0; i < sides[s].count; i++) {
+            total += *(const uint64_t*)((const char*)&sides[s].streams[i] + offset);
+        }
+        fprintf(out, "mini_iperf_%s{side=\"%s\"} %lu\n", name, sides[s].side, total);
+    }
+}
+
+static void write_metrics(FILE* out) {
+    side_snapshot_t sides[2] = {{.side = "sender"}, {.side = "receiver"}};
+    for (int s = 0; s < 2; s++) {
+        sides[s].count = udp_live_snapshot(s, &sides[s].streams);
+        if (sides[s].count < 0) sides[s].count = 0;
+    }
+
+    fprintf(out, "# HELP mini_iperf_streams Streams running\n");
+    fprintf(out, "# TYPE mini_iperf_streams gauge\n");
+    for (int s = 0; s < 2; s++) {
+        fprintf(out, "mini_iperf_streams{side=\"%s\"} %d\n", sides[s].side, sides[s].count);
+    }
+    write_counter(out, "packets_total", "Packets sent or received", sides, 2,
+                  offsetof(udp_live_stream_t, packets));
+    write_counter(out, "bytes_total", "Bytes sent or received, headers included", sides, 2,
+                  offsetof(udp_live_stream_t, bytes));
+    write_counter(out, "payload_bytes_total", "Payload bytes sent or received", sides, 2,
+                  offsetof(udp_live_stream_t, payload_bytes));
+    write_counter(out, "lost_packets_total", "Packets missing from the sequence", &sides[1], 1,
+                  offsetof(udp_live_stream_t, lost));
+
+    // Delay histogram of all receiver streams, cumulative as Prometheus wants it
+    const side_snapshot_t* rx = &sides[1];
+    uint64_t buckets[DELAY_BUCKETS] = {0};
+    int64_t sum_ns = 0;
+    for (int i = 0; i < rx->count; i++) {
+        for (int b = 0; b < DELAY_BUCKETS; b++) buckets[b] += rx->streams[i].delay_buckets[b];
+        sum_ns += (int64_t)rx->streams[i].owd_sum_ns;
+    }
+    fprintf(out, "# HELP mini_iperf_delay_seconds One-way delay of the received packets "
+            "(round trip in transaction mode)\n");
+    fprintf(out, "# TYPE mini_iperf_delay_seconds histogram\n");
+    uint64_t cumulative = 0;
+    for (int b = 0; b < DELAY_BUCKETS - 1; b++) {
+        cumulative += buckets[b];
+        fprintf(out, "mini_iperf_delay_seconds_bucket{side=\"%s\",le=\"%.9g\"} %lu\n", rx->side,
+                (double)(1UL << b) / 1e6, cumulative);
+    }
+    cumulative += buckets[DELAY_BUCKETS - 1];
+    fprintf(out, "mini_iperf_delay_seconds_bucket{side=\"%s\",le=\"+Inf\"} %lu\n", rx->side, cumulative);
+    fprintf(out, "mini_iperf_delay_seconds_sum{side=\"%s\"} %.9f\n", rx->side, sum_ns / 1e9);
+    fprintf(out, "mini_iperf_delay_seconds_count{side=\"%s\"} %lu\n", rx->side, cumulative);
+
+    free(sides[0].streams);
+    free(sides[1].streams);
+}
+
+static int send_all(int sock, const char* data, size_t len) {
+    while (len > 0) {
+        const ssize_t sent = send(sock, data, len, MSG_NOSIGNAL);
+        if (sent <= 0) return -1;
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+static void serve_request(int sock) {
+    char request[METRICS_REQUEST_MAX + 1];
+    size_t received = 0;
+    while (received < METRICS_REQUEST_MAX) {
+        const ssize_t n = recv(sock, request + received, METRICS_REQUEST_MAX - received, 0);
+        if (n <= 0) return;
+        received += n;
+        request[received] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+    }
+    request[received] = '\0';
+
+    const int found = strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0;
+    char* body = NULL;
+    size_t body_len = 0;
+    FILE* out = open_memstream(&body, &body_len);
+    if (!out) return;
+    if (found) {
+        write_metrics(out);
+    } else {
+        fprintf(out, "Not found; metrics are at /metrics\n");
+    }
+    fclose(out);
+
+    char head[256];
+    const int head_len = snprintf(head, sizeof(head),
+                                  "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                  found ? "200 OK" : "404 Not Found", body_len);
+    if (send_all(sock, head, head_len) == 0) send_all(sock, body, body_len);
+    free(body);
+}
+
+static void* metrics_main(void* unused) {
+    (void)unused;
+    while (1) {
+        const int sock = accept(metrics_socket, NULL, NULL);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("Error: Metrics accept failed");
+            break;
+        }
+        struct timeval timeout = {.tv_sec = METRICS_READ_TIMEOUT_S};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        serve_request(sock);
+        close(sock);
+    }
+    return NULL;
+}
+
+int metrics_start(const struct arguments* args) {
+    metrics_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (metrics_socket < 0) {
+        perror("Error: Metrics socket creation failed");
+        return -1;
+    }
+    int optval = 1;
+    setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(args->metrics_port),
+        .sin_addr.s_addr = inet_addr(args->metrics_address)
+    };
+    if (bind(metrics_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(metrics_socket, 8) < 0) {
+        perror("Error: Metrics listener failed");
+        close(metrics_socket);
+        metrics_socket = -1;
+        return -1;
+    }
+    if (pthread_create(&metrics_thread, NULL, metrics_main, NULL) != 0) {
+        perror("Error: Cannot start the metrics listener");
+        close(metrics_socket);
+        metrics_socket = -1;
+        return -1;
+    }
+    pthread_detach(metrics_thread);
+    printf("Metrics at http://%s:%d/metrics\n", args->metrics_address, args->metrics_port);
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * mini_iperf_packet.c
+ *
+ * Data packet format shared by every sender and receiver: filling and
+ * numbering the header, decoding it on receipt and verifying the payload.
+ *
+ * The payload of packet seq is the byte 'A' + seq % 26 repeated. Receivers
+ * check the first and last 8 bytes of it (all of a payload of up to 64
+ * bytes), or, when the sender ran with -C, the CRC32C of the whole payload.
+ * With -V the payload is left as it is and only the header is accounted.
+ */
+#include "mini_iperf.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define PAYLOAD_SAMPLE 8            // Bytes checked at each end of the payload
+#define PAYLOAD_FULL_CHECK 64       // Payloads up to this size are checked entirely
+
+static int all_bytes_equal(const void* ptr, int c, size_t n) {
+    const unsigned char* p = ptr;
+    while (n-- > 0) if (*p++ != c) return 0;
+    return 1;
+}
+
+void packet_init(MiniIperfPacket* packet, uint32_t stream_id, int crc) {
+    memset(&packet->header, 0, sizeof(packet->header));
+    packet->header.version = PACKET_VERSION;
+    packet->header.header_len = sizeof(MiniIperfHeader);
+    packet->header.flags = htons(crc ? PACKET_FLAG_CRC : 0);
+    packet->header.stream_id = htonl(stream_id);
+}
+
+void packet_stamp_header(MiniIperfPacket* packet, uint64_t seq, uint32_t batch_seq, uint64_t now) {
+    MiniIperfHeader* header = &packet->header;
+    header->seq_num = htobe64(seq);
+    header->timestamp_ns = htobe64(now);
+    header->batch_seq = htonl(batch_seq);
+}
+
+void packet_fill(MiniIperfPacket* packet, uint64_t seq, int payload_size) {
+    memset(packet->payload, 'A' + (seq % 26), payload_size);
+    if (packet->header.flags & htons(PACKET_FLAG_CRC)) {
+        packet->header.crc = htonl(crc32c(0, packet->payload, payload_size));
+    }
+}
+
+void packet_stamp(MiniIperfPacket* packet, uint64_t seq, uint32_t batch_seq, uint64_t now,
+                  int payload_size) {
+    packet_stamp_header(packet, seq, batch_seq, now);
+    packet_fill(packet, seq, payload_size);
+}
+
+int packet_parse(const MiniIperfPacket* packet, ssize_t bytes, packet_info_t* info) {
+    const MiniIperfHeader* header = &packet->header;
+    if (bytes < (ssize_t)sizeof(MiniIperfHeader) || header->version != PACKET_VERSION ||
+        header->header_len < sizeof(MiniIperfHeader) || header->header_len > bytes) {
+        return -1;
+    }
+    info->seq = be64toh(header->seq_num);
+    info->sent_ns = be64toh(header->timestamp_ns);
+    info->stream_id = ntohl(header->stream_id);
+    info->batch_seq = ntohl(header->batch_seq);
+    info->crc = ntohl(header->crc);
+    info->flags = ntohs(header->flags);
+    info->payload = (const char*)packet + header->header_len;
+    info->payload_size = bytes - header->header_len;
+    return 0;
+}
+
+int packet_samples_match(uint64_t seq, const uint8_t* head, const uint8_t* tail, size_t sample) {
+    const int expected_char = 'A' + (seq % 26);
+    return all_bytes_equal(head, expected_char, sample) && all_bytes_equal(tail, expected_char, sample);
+}
+
+int packet_verify(const packet_info_t* info) {
+    if (info->flags & PACKET_FLAG_CRC) {
+        return crc32c(0, info->payload, info->payload_size) == info->crc;
+    }
+    if (info->payload_size <= PAYLOAD_FULL_CHECK) {
+        return all_bytes_equal(info->payload, 'A' + (info->seq % 26), info->payload_size);
+    }
+    // Only check first/last 8 bytes to reduce CPU load
+    return packet_samples_match(info->seq, (const uint8_t*)info->payload,
+                                (const uint8_t*)info->payload + info->payload_size - PAYLOAD_SAMPLE,
+                                PAYLOAD_SAMPLE);
+}
+
+// CRC32C, reflected polynomial 0x82F63B78; slicing-by-8 tables for the
+// software fallback
+static uint32_t crc_table[8][256];
+static uint32_t (*crc_update)(uint32_t crc, const uint8_t* p, size_t len);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        v = htole64(v) ^ crc;
+        crc = crc_table[7][v & 0xFF] ^ crc_table[6][(v >> 8) & 0xFF] ^
+              crc_table[5][(v >> 16) & 0xFF] ^ crc_table[4][(v >> 24) & 0xFF] ^
+              crc_table[3][(v >> 32) & 0xFF] ^ crc_table[2][(v >> 40) & 0xFF] ^
+              crc_table[1][(v >> 48) & 0xFF] ^ crc_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+    while (len-- > 0) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (int t = 1; t < 8; t++) {
+        for (int i = 0; i < 256; i++) {
+            crc_table[t][i] = crc_table[0][crc_table[t - 1][i] & 0xFF] ^ (crc_table[t - 1][i] >> 8);
+        }
+    }
+    crc_update = crc32c_sw;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) crc_update = crc32c_sse42;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+    pthread_once(&crc_once, crc_init);
+    return ~crc_update(~crc, data, len);
+}
@@ -1,7 +1,7 @@
 #include "mini_iperf.h"
 
-extern pthread_mutex_t lock;
-extern int line;
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+int line=0;
 void safe_print(char* message) {
     pthread_mutex_lock(&lock);
     printf("%d. Buffer: %s\n", line++,message);
@@ -17,6 +17,16 @@ void init_arguments(struct arguments* args) {
     args->port = 5201;             // 5201 default port
     args->bandwidth = 0;        // Default no bandwidth limit
     args->wait_duration = 0;    // Default no wait duration
+    args->batch_size = 32;      // Default 32 packets per batch
+    args->engine = ENGINE_SENDTO; // Default one system call per packet
+    args->search_loss = -1;     // Default no rate search
+    args->workers = sysconf(_SC_NPROCESSORS_ONLN);  // Default one event worker per CPU, up to 4
+    if (args->workers > 4) args->workers = 4;
+    if (args->workers < 1) args->workers = 1;
+    args->feedback_ms = 50;     // Default feedback every 50ms in adaptive mode
+    args->clients = 1;          // Default one client per run
+    args->verify = 1;           // Default payload patterns written and checked
+    snprintf(args->metrics_address, sizeof(args->metrics_address), "127.0.0.1");
     // All other fields are initialized to 0/NULL by memset
 }
 
@@ -31,6 +41,19 @@ void init_arguments(struct arguments* args) {
         free(args->filename);
         args->filename = NULL;
     }
+    if (args->results_file) {
+        free(args->results_file);
+        args->results_file = NULL;
+    }
+    if (args->replay_file) {
+        free(args->replay_file);
+        args->replay_file = NULL;
+    }
+    free(args->targets);
+    args->targets = NULL;
+    args->num_targets = 0;
+    free(args->impair.log_file);
+    args->impair.log_file = NULL;
 }
 
 
@@ -45,19 +68,10 @@ void init_arguments(struct arguments* args) {
     init_arguments(args);
 
     // Parse each command line option
-    while ((opt = getopt(argc, argv, "a:p:i:f:scl:b:n:t:dw:h")) != -1) {
+    while ((opt = getopt(argc, argv, "a:p:i:f:scl:b:n:t:dw:B:e:o:R:P:S:L:Q:r:T:j:A:F:D:k:CVGm:N:M:I:X:h")) != -1) {
         switch (opt) {
-           case 'a':  // IP address
-               if (args->ip_address) free(args->ip_address);
-               if (!is_valid_ip(optarg)) {
-                   fprintf(stderr, "Error: Invalid IP address\n");
-                   return -1;
-               }
-               args->ip_address = strdup(optarg);
-               if (!args->ip_address) {
-                   perror("Error: Memory allocation failed for IP address");
-                   return -1;
-               }
+           case 'a':  // IP address, or the servers of a fan-out
+               if (parse_targets(optarg, args) != 0) return -1;
                break;
 
 
@@ -137,6 +151,176 @@ void init_arguments(struct arguments* args) {
                 }
                 break;
 
+            case 'B':  // Batch size
+                args->batch_size = atoi(optarg);
+                if (args->batch_size <= 0 || args->batch_size > MAX_BATCH_SIZE) {
+                    fprintf(stderr, "Error: Batch size must be between 1 and %d\n", MAX_BATCH_SIZE);
+                    return -1;
+                }
+                break;
+
+            case 'e':  // Engine
+                args->engine = parse_engine(optarg);
+                if (args->engine < 0) {
+                    fprintf(stderr, "Error: Unknown engine '%s' (use sendto, mmsg or event)\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'o':  // Output format
+                args->output_format = parse_output_format(optarg);
+                if (args->output_format < 0) {
+                    fprintf(stderr, "Error: Unknown output format '%s' (use text, json or csv)\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'R':  // Results file
+                if (args->results_file) free(args->results_file);
+                args->results_file = strdup(optarg);
+                if (!args->results_file) {
+                    perror("Error: Memory allocation failed for results file");
+                    return -1;
+                }
+                break;
+
+            case 'P':  // Traffic profile
+                if (parse_profile(optarg, args) != 0) return -1;
+                break;
+
+            case 'S':  // Packet size distribution
+                if (parse_size_distribution(optarg, &args->sizes) != 0) return -1;
+                break;
+
+            case 'L':  // Rate search loss target
+                args->search_loss = atof(optarg);
+                if (args->search_loss < 0 || args->search_loss >= 100) {
+                    fprintf(stderr, "Error: Loss target must be between 0 and 100 percent\n");
+                    return -1;
+                }
+                break;
+
+            case 'Q':  // Rate search delay target
+                if (sscanf(optarg, "%lf:%lf", &args->search_delay_pct, &args->search_delay_ms) != 2 ||
+                    (args->search_delay_pct != 50 && args->search_delay_pct != 90 &&
+                     args->search_delay_pct != 99 && args->search_delay_pct != 99.9) ||
+                    args->search_delay_ms <= 0) {
+                    fprintf(stderr, "Error: Delay target must be <50|90|99|99.9>:<ms>\n");
+                    return -1;
+                }
+                break;
+
+            case 'r':  // Latency probe rate
+                args->probe_rate = atoi(optarg);
+                if (args->probe_rate <= 0 || args->probe_rate > 10000) {
+                    fprintf(stderr, "Error: Probe rate must be between 1 and 10000 per second\n");
+                    return -1;
+                }
+                break;
+
+            case 'T':  // Transaction mode
+                args->transactions = atoi(optarg);
+                if (args->transactions <= 0 || args->transactions > MAX_BATCH_SIZE) {
+                    fprintf(stderr, "Error: Outstanding requests must be between 1 and %d\n", MAX_BATCH_SIZE);
+                    return -1;
+                }
+                break;
+
+            case 'j':  // Event engine workers
+                args->workers = atoi(optarg);
+                if (args->workers <= 0 || args->workers > 256) {
+                    fprintf(stderr, "Error: Workers must be between 1 and 256\n");
+                    return -1;
+                }
+                break;
+
+            case 'A':  // Adaptive rate controller
+                if (parse_adapt(optarg, args) != 0) return -1;
+                break;
+
+            case 'F':  // Feedback interval
+                args->feedback_ms = atoi(optarg);
+                if (args->feedback_ms < 10 || args->feedback_ms > 10000) {
+                    fprintf(stderr, "Error: Feedback interval must be between 10 and 10000 ms\n");
+                    return -1;
+                }
+                break;
+
+            case 'D':  // First data port
+                args->data_port = atoi(optarg);
+                if (args->data_port <= 0 || args->data_port > 65535) {
+                    fprintf(stderr, "Error: Invalid data port number\n");
+                    return -1;
+                }
+                break;
+
+            case 'k':  // Analysis threads of the receive pipeline
+                args->analysis_threads = atoi(optarg);
+                if (args->analysis_threads < 0 || args->analysis_threads > 256) {
+                    fprintf(stderr, "Error: Analysis threads must be between 0 and 256\n");
+                    return -1;
+                }
+                break;
+
+            case 'C':  // Payload CRC
+                args->crc = 1;
+                break;
+
+            case 'V':  // No payload patterns
+                args->verify = 0;
+                break;
+
+            case 'G':  // One timestamp per send batch
+                args->batch_stamp = 1;
+                break;
+
+            case 'M': {  // Metrics listener, [<address>:]<port>
+                const char* port = strrchr(optarg, ':');
+                if (port) {
+                    const size_t len = port - optarg;
+                    if (len >= sizeof(args->metrics_address)) {
+                        fprintf(stderr, "Error: Invalid metrics address\n");
+                        return -1;
+                    }
+                    memcpy(args->metrics_address, optarg, len);
+                    args->metrics_address[len] = '\0';
+                    port++;
+                } else {
+                    port = optarg;
+                }
+                args->metrics_port = atoi(port);
+                if (!is_valid_ip(args->metrics_address) || args->metrics_port <= 0 ||
+                    args->metrics_port > 65535) {
+                    fprintf(stderr, "Error: Invalid metrics listener '%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            }
+
+            case 'N':  // Clients of an incast run
+                args->clients = atoi(optarg);
+                if (args->clients <= 0 || args->clients > MAX_CLIENTS) {
+                    fprintf(stderr, "Error: Clients must be between 1 and %d\n", MAX_CLIENTS);
+                    return -1;
+                }
+                break;
+
+            case 'I':  // Source addresses or interfaces
+                if (parse_sources(optarg, args) != 0) return -1;
+                break;
+
+            case 'X':  // Impairments of the sent packets
+                if (parse_impair(optarg, args) != 0) return -1;
+                break;
+
+            case 'm':  // Direction of the data
+                args->direction = parse_direction(optarg);
+                if (args->direction < 0) {
+                    fprintf(stderr, "Error: Unknown direction '%s' (use forward, reverse or duplex)\n", optarg);
+                    return -1;
+                }
+                break;
+
             case 'h':  // Help
             default:
                 print_help();
@@ -161,12 +345,112 @@ void init_arguments(struct arguments* args) {
         return -1;
     }
 
+    if (args->is_server && args->num_targets > 1) {
+        fprintf(stderr, "Error: A server binds one address (-a)\n");
+        return -1;
+    }
+
+    if (args->is_server && args->num_sources > 0) {
+        fprintf(stderr, "Error: Source bindings (-I) are for the client's streams\n");
+        return -1;
+    }
+
+    // Every server of a client gets its own control port (default -p) and,
+    // without -D, the data ports after it
+    const int explicit_data_port = args->data_port != 0;
+    for (int i = 0; i < args->num_targets; i++) {
+        server_target_t* target = &args->targets[i];
+        if (target->port == 0) target->port = args->port;
+        target->data_port = explicit_data_port ? args->data_port : target->port + 1;
+        snprintf(target->label, sizeof(target->label), "%s:%d", target->address, target->port);
+    }
+    if (args->num_targets > 0 && args->is_client) args->port = args->targets[0].port;
+    if (args->data_port == 0) args->data_port = args->port + 1;
+
+    // Duplex mode also uses the ports after the client-to-server ones
+    const int data_ports = (args->engine == ENGINE_EVENT ? 1 : args->num_streams) *
+                           (args->direction == DIRECTION_DUPLEX ? 2 : 1);
+    for (int i = 0; i < (args->num_targets > 0 ? args->num_targets : 1); i++) {
+        const int port = args->num_targets > 0 ? args->targets[i].port : args->port;
+        const int data_port = args->num_targets > 0 ? args->targets[i].data_port : args->data_port;
+        if (data_port + data_ports - 1 > 65535 || (data_port <= port && port < data_port + data_ports)) {
+            fprintf(stderr, "Error: Data ports %d-%d are out of range or overlap the control port\n",
+                    data_port, data_port + data_ports - 1);
+            return -1;
+        }
+    }
+
+    if (args->engine == ENGINE_EVENT && args->workers > args->num_streams) {
+        args->workers = args->num_streams;  // No idle workers
+    }
+
     if (args->is_client) {
         if (!args->ip_address) {
             fprintf(stderr, "Error: Server address (-a) is required in client mode\n");
             return -1;
         }
-        
+        if (args->search_loss >= 0 && args->bandwidth <= 0) {
+            fprintf(stderr, "Error: Rate search needs the highest rate to try (-b)\n");
+            return -1;
+        }
+        if (args->adapt != ADAPT_OFF) {
+            if (args->bandwidth <= 0) {
+                fprintf(stderr, "Error: Adaptive rate needs the highest rate to try (-b)\n");
+                return -1;
+            }
+            if (args->engine == ENGINE_EVENT || args->profile != PROFILE_CBR ||
+                args->transactions > 0 || args->search_loss >= 0) {
+                fprintf(stderr, "Error: Adaptive rate only drives constant bit rate streams "
+                        "(no -e event, -P, -T or -L)\n");
+                return -1;
+            }
+        }
+        if (args->num_targets > 1 &&
+            (args->direction != DIRECTION_FORWARD || args->transactions > 0 ||
+             args->search_loss >= 0 || args->adapt != ADAPT_OFF)) {
+            fprintf(stderr, "Error: A fan-out to several servers only runs client to server "
+                    "(no -m, -T, -L or -A)\n");
+            return -1;
+        }
+        if (args->num_sources > 0 &&
+            (args->num_targets > 1 || args->direction == DIRECTION_REVERSE ||
+             args->engine == ENGINE_EVENT || args->transactions > 0)) {
+            fprintf(stderr, "Error: -I spreads the client-to-server streams of the sendto or mmsg "
+                    "engine to one server (no -m reverse, -T or fan-out)\n");
+            return -1;
+        }
+        if (args->impair.enabled && (args->engine == ENGINE_EVENT || args->transactions > 0)) {
+            fprintf(stderr, "Error: Impairments (-X) need the sendto or mmsg engine, without -T\n");
+            return -1;
+        }
+        if (args->num_sources > args->num_streams) {
+            fprintf(stderr, "Error: %d sources need at least as many streams (-n)\n", args->num_sources);
+            return -1;
+        }
+        if (args->direction != DIRECTION_FORWARD &&
+            (args->transactions > 0 || args->search_loss >= 0 ||
+             (args->direction == DIRECTION_REVERSE && args->adapt != ADAPT_OFF))) {
+            fprintf(stderr, "Error: -T, -L and -A need the client to send (-m forward, or duplex for -A)\n");
+            return -1;
+        }
+        if (!args->verify && (args->crc || args->engine == ENGINE_EVENT || args->transactions > 0)) {
+            fprintf(stderr, "Error: -V needs the sendto or mmsg engine, without -C or -T\n");
+            return -1;
+        }
+        if (args->batch_stamp && (args->engine == ENGINE_EVENT || args->transactions > 0 ||
+                                  args->profile != PROFILE_CBR)) {
+            fprintf(stderr, "Error: -G needs constant bit rate streams of the sendto or mmsg engine, without -T\n");
+            return -1;
+        }
+        if (args->engine == ENGINE_EVENT && (args->transactions > 0 || args->profile != PROFILE_CBR)) {
+            fprintf(stderr, "Error: The event engine only sends constant bit rate flows\n");
+            return -1;
+        }
+        if ((args->profile == PROFILE_POISSON || args->profile == PROFILE_ONOFF) &&
+            args->bandwidth <= 0) {
+            fprintf(stderr, "Error: Poisson and on/off profiles need a bandwidth (-b)\n");
+            return -1;
+        }
     }
 
     return 0;
@@ -180,11 +464,14 @@ void print_arguments(const struct arguments* args) {
                                       (args->is_client ? "CLIENT" : "NONE"));
     printf("IP Address:         %s\n", args->ip_address ? args->ip_address : "(null)");
     printf("Port:               %d\n", args->port);
-    printf("Output File:        %s\n", args->filename ? args->filename : "(none)");
+    printf("Trace File:         %s\n", args->filename ? args->filename : "(none)");
+    printf("Results File:       %s\n", args->results_file ? args->results_file : "(stdout)");
     
     // Timing parameters
     printf("Update Interval:    %d seconds\n", args->interval);
     printf("Wait Duration:      %d seconds\n", args->wait_duration);
+    printf("Engine:             %s\n", engine_name(args->engine));
+    printf("Batch Size:         %d packets\n", args->batch_size);
     
     if (args->is_client) {
         // Client-specific parameters
@@ -211,43 +498,287 @@ void print_arguments(const struct arguments* args) {
     printf("Mini-Iperf - Network Measurement Tool\n\n");
     printf("Usage: mini_iperf [options]\n\n");
     printf("Common options:\n");
-    printf("  -a <address>    Server: bind address, Client: server address\n");
+    printf("  -a <address>    Server: bind address, Client: server address, or a comma\n");
+    printf("                  separated list <address>[:<port>],... to fan out to\n");
     printf("  -p <port>       Server: listening port, Client: server port (required)\n");
     printf("  -i <seconds>    Interval for progress updates (default: 1)\n");
-    printf("  -f <filename>   Output file for results\n");
+    printf("  -f <filename>   Binary per-packet trace file (receiver)\n");
+    printf("  -o <format>     Report format: text, json, csv (default: text)\n");
+    printf("  -R <filename>   Write the report to a file instead of stdout\n");
+    printf("  -n <number>     Number of parallel streams (default: 1)\n");
+    printf("  -e <engine>     Data path engine: sendto, mmsg, event (default: sendto);\n");
+    printf("                  event drives -n flows (e.g. 10000) from -j workers\n");
+    printf("  -j <workers>    Worker threads of the event engine (default: CPUs, up to 4)\n");
+    printf("  -B <packets>    Packets per send/receive batch (default: 32)\n");
+    printf("  -C              Carry a CRC32C of the payload in every packet; receivers\n");
+    printf("                  check it instead of sampling the payload pattern\n");
+    printf("  -V              Client: send payloads without a pattern; the receivers only\n");
+    printf("                  account headers (no corruption check, less CPU per packet)\n");
+    printf("  -G              Client: constant rate senders stamp each batch once instead\n");
+    printf("                  of every packet (delay and jitter then include batching)\n");
+    printf("  -M [<addr>:]<port>  Serve live counters for Prometheus at\n");
+    printf("                  http://<addr>:<port>/metrics (default addr: 127.0.0.1)\n");
+    printf("  -X <list>       Impair our sent packets before the socket, seeded:\n");
+    printf("                  drop=<%%>, dup=<%%>, corrupt=<%%>, reorder=<%%>[:<ms>] (held\n");
+    printf("                  back, default 1 ms), delay=<ms>[:<jitter ms>], seed=<n>,\n");
+    printf("                  log=<file> (ground truth in the -f trace format)\n");
+    printf("  -D <port>       Client: first UDP data port, stream i uses port + i\n");
+    printf("                  (default: -p + 1; the server takes it from the client)\n");
     printf("  -h              Show this help message\n\n");
     printf("Server mode (requires -s):\n");
-    printf("  -s              Run in server mode\n\n");
+    printf("  -s              Run in server mode\n");
+    printf("  -N <clients>    Wait for this many clients and run their streams as one\n");
+    printf("                  many-to-one (incast) test (default: 1)\n");
+    printf("  -k <threads>    Analyze packets on this many threads, fed by the receive\n");
+    printf("                  threads through lock-free rings (default: 0, inline)\n\n");
     printf("Client mode (requires -c):\n");
     printf("  -c              Run in client mode\n");
     printf("  -l <bytes>      UDP packet size (default: 1024)\n");
     printf("  -b <bps>        Bandwidth in bits per second (required for throughput)\n");
-    printf("  -n <number>     Number of parallel streams (default: 1)\n");
     printf("  -t <seconds>    Experiment duration (default: unlimited)\n");
     printf("  -d              Measure one-way delay instead of throughput\n");
     printf("  -w <seconds>    Wait time before transmission (default: 0)\n");
+    printf("  -P <profile>    Traffic profile: cbr, poisson, onoff:<on_ms>:<off_ms>,\n");
+    printf("                  replay:<file> (default: cbr; -b is the mean rate)\n");
+    printf("  -S <sizes>      Packet sizes: uniform:<min>:<max> or <size>[:<weight>],...\n");
+    printf("  -L <percent>    Search the highest rate up to -b with loss below this;\n");
+    printf("                  -t is then the duration of each trial (default: 2)\n");
+    printf("  -Q <pct>:<ms>   Also keep this OWD percentile (50, 90, 99, 99.9) within\n");
+    printf("                  <ms> of the minimum delay during the search\n");
+    printf("  -r <rate>       Send this many latency probes per second to the server's\n");
+    printf("                  echo responder, idle and under load (client only)\n");
+    printf("  -T <count>      Request/response mode: keep <count> requests outstanding per\n");
+    printf("                  stream, echoed by the server; reports transactions/sec\n");
+    printf("  -A <controller> Adapt the rate to the server's feedback, starting at -b/10\n");
+    printf("                  with -b as the ceiling: aimd[:<loss%%>] (default: 1) or\n");
+    printf("                  delay[:<ms>] (queueing delay target, default: 5)\n");
+    printf("  -F <ms>         Interval of the server's feedback with -A (default: 50)\n");
+    printf("  -I <src>,...    Spread the streams across these local IPv4 addresses or\n");
+    printf("                  interfaces (SO_BINDTODEVICE), in blocks of consecutive\n");
+    printf("                  streams; both ends report each source separately\n");
+    printf("  -m <direction>  forward (client sends), reverse (server sends to the client's\n");
+    printf("                  data ports) or duplex (both at once); default: forward.\n");
+    printf("                  The server sends at -b with -l byte packets (no -P, -S)\n");
+}
+
+int parse_engine(const char* name) {
+    if (strcmp(name, "sendto") == 0) return ENGINE_SENDTO;
+    if (strcmp(name, "mmsg") == 0) return ENGINE_MMSG;
+    if (strcmp(name, "event") == 0) return ENGINE_EVENT;
+    return -1;
+}
+
+const char* engine_name(int engine) {
+    switch (engine) {
+        case ENGINE_SENDTO: return "sendto";
+        case ENGINE_MMSG:   return "mmsg";
+        case ENGINE_EVENT:  return "event";
+        default:            return "unknown";
+    }
+}
+
+int parse_sources(const char* list, struct arguments* args) {
+    char* copy = strdup(list);
+    if (!copy) {
+        perror("Error: Memory allocation failed for the source list");
+        return -1;
+    }
+    int count = 0;
+    char* saveptr = NULL;
+    for (char* tok = strtok_r(copy, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        if (count == MAX_SOURCES) {
+            fprintf(stderr, "Error: At most %d sources\n", MAX_SOURCES);
+            free(copy);
+            return -1;
+        }
+        // An IPv4 address is bound as it is, anything else must name an interface
+        source_binding_t* source = &args->sources[count];
+        memset(source, 0, sizeof(*source));
+        if (inet_pton(AF_INET, tok, &source->address) != 1) {
+            if (strlen(tok) >= IFNAMSIZ || if_nametoindex(tok) == 0) {
+                fprintf(stderr, "Error: '%s' is neither an IPv4 address nor an interface\n", tok);
+                free(copy);
+                return -1;
+            }
+            source->device = 1;
+        }
+        snprintf(source->name, sizeof(source->name), "%s", tok);
+        count++;
+    }
+    free(copy);
+    if (count == 0) {
+        fprintf(stderr, "Error: No source address or interface given\n");
+        return -1;
+    }
+    args->num_sources = count;
+    return 0;
+}
+
+int parse_targets(const char* list, struct arguments* args) {
+    char* copy = strdup(list);
+    server_target_t* targets = calloc(MAX_TARGETS, sizeof(server_target_t));
+    if (!copy || !targets) {
+        perror("Error: Memory allocation failed for the server list");
+        free(copy);
+        free(targets);
+        return -1;
+    }
+    int count = 0;
+    char* saveptr = NULL;
+    for (char* tok = strtok_r(copy, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        char* port = strchr(tok, ':');
+        if (port) *port++ = '\0';
+        if (count == MAX_TARGETS || !is_valid_ip(tok) ||
+            (port && (atoi(port) <= 0 || atoi(port) > 65535))) {
+            fprintf(stderr, count == MAX_TARGETS ? "Error: At most %d servers\n" :
+                    "Error: Invalid IP address\n", MAX_TARGETS);
+            free(copy);
+            free(targets);
+            return -1;
+        }
+        snprintf(targets[count].address, sizeof(targets[count].address), "%s", tok);
+        targets[count].port = port ? atoi(port) : 0;
+        count++;
+    }
+    free(copy);
+    if (count == 0) {
+        fprintf(stderr, "Error: Invalid IP address\n");
+        free(targets);
+        return -1;
+    }
+
+    free(args->ip_address);
+    args->ip_address = strdup(targets[0].address);
+    if (!args->ip_address) {
+        perror("Error: Memory allocation failed for IP address");
+        free(targets);
+        return -1;
+    }
+    free(args->targets);
+    args->targets = targets;
+    args->num_targets = count;
+    return 0;
+}
+
+int parse_direction(const char* name) {
+    if (strcmp(name, "forward") == 0) return DIRECTION_FORWARD;
+    if (strcmp(name, "reverse") == 0) return DIRECTION_REVERSE;
+    if (strcmp(name, "duplex") == 0) return DIRECTION_DUPLEX;
+    return -1;
+}
+
+const char* direction_name(int direction) {
+    switch (direction) {
+        case DIRECTION_FORWARD: return "forward";
+        case DIRECTION_REVERSE: return "reverse";
+        case DIRECTION_DUPLEX:  return "duplex";
+        default:                return "unknown";
+    }
+}
+
+int parse_adapt(const char* spec, struct arguments* args) {
+    const char* target = strchr(spec, ':');
+    const size_t name_len = target ? (size_t)(target - spec) : strlen(spec);
+    if (name_len == 4 && strncmp(spec, "aimd", 4) == 0) {
+        args->adapt = ADAPT_AIMD;
+        args->adapt_target = 1.0;
+    } else if (name_len == 5 && strncmp(spec, "delay", 5) == 0) {
+        args->adapt = ADAPT_DELAY;
+        args->adapt_target = 5.0;
+    } else {
+        fprintf(stderr, "Error: Unknown controller '%s' (use aimd or delay)\n", spec);
+        return -1;
+    }
+    if (target) {
+        char* end;
+        args->adapt_target = strtod(target + 1, &end);
+        if (*end != '\0' || args->adapt_target < 0 ||
+            (args->adapt == ADAPT_AIMD && args->adapt_target >= 100) ||
+            (args->adapt == ADAPT_DELAY && args->adapt_target == 0)) {
+            fprintf(stderr, "Error: Invalid controller target '%s'\n", target + 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+const char* adapt_name(int adapt) {
+    switch (adapt) {
+        case ADAPT_AIMD:  return "aimd";
+        case ADAPT_DELAY: return "delay";
+        default:          return "off";
+    }
+}
+
+int parse_output_format(const char* name) {
+    if (strcmp(name, "text") == 0) return OUTPUT_TEXT;
+    if (strcmp(name, "json") == 0) return OUTPUT_JSON;
+    if (strcmp(name, "csv") == 0) return OUTPUT_CSV;
+    return -1;
 }
 
 int send_tcp_message(int sock, uint8_t msg_type, const void* payload, uint32_t payload_len) {
     tcp_header_t header = {
         .msg_type = msg_type,
-        .payload_len = payload_len,
-        .timestamp_ns = get_monotonic_time()
+        .payload_len = htonl(payload_len),
+        .timestamp_ns = htobe64(get_monotonic_time())
     };
-    
-    // Send header
-    if (send(sock, &header, sizeof(header), 0) < 0) {
-        perror("TCP header send failed");
-        return -1;
-    }
-    
-    // Send payload if exists
-    if (payload_len > 0 && payload != NULL) {
-        if (send(sock, payload, payload_len, 0) < 0) {
-            perror("TCP payload send failed");
+
+    // Header and payload in one system call, resumed where a partial send stopped
+    struct iovec iov[2] = {
+        {.iov_base = &header, .iov_len = sizeof(header)},
+        {.iov_base = (void*)payload, .iov_len = payload ? payload_len : 0}
+    };
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+    while (msg.msg_iovlen > 0) {
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            perror("TCP message send failed");
             return -1;
         }
+        while (msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
     }
-    
     return 0;
-}
\ No newline at end of file
+}
+
+int recv_tcp_header(int sock, tcp_header_t* header) {
+    if (recv(sock, header, sizeof(*header), MSG_WAITALL) != sizeof(*header)) return -1;
+    header->payload_len = ntohl(header->payload_len);
+    header->crc = ntohs(header->crc);
+    header->timestamp_ns = be64toh(header->timestamp_ns);
+    header->clock_offset = (int64_t)be64toh((uint64_t)header->clock_offset);
+    if (header->payload_len > MAX_CONTROL_PAYLOAD) {
+        fprintf(stderr, "Error: Control message of %u bytes\n", header->payload_len);
+        return -1;
+    }
+    return 0;
+}
+
+void experiment_stats_swap(experiment_stats_t* stats) {
+    // Every field is 64 bits wide (integers and IEEE 754 doubles alike)
+    _Static_assert(sizeof(experiment_stats_t) % sizeof(uint64_t) == 0,
+                   "experiment_stats_t must consist of 64-bit fields");
+    uint64_t words[sizeof(experiment_stats_t) / sizeof(uint64_t)];
+    memcpy(words, stats, sizeof(words));
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        words[i] = htobe64(words[i]);
+    }
+    memcpy(stats, words, sizeof(words));
+}
+
+void interim_report_swap(interim_report_t* report) {
+    report->seq = htonl(report->seq);
+    report->interval_us = htonl(report->interval_us);
+    report->packets = htobe64(report->packets);
+    report->lost = htobe64(report->lost);
+    report->owd_avg_ns = (int64_t)htobe64((uint64_t)report->owd_avg_ns);
+}
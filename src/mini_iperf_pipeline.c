@@ -0,0 +1,169 @@
+/*
+ * mini_iperf_pipeline.c
+ *
+ * Two-stage receive path (-k). The stream threads only drain their sockets:
+ * every datagram becomes a compact record (sequence, timestamps, size and a
+ * sample of the payload) in a lock-free single-producer single-consumer
+ * ring. Verification, sequence tracking, delay and jitter accounting run on
+ * the analysis threads, so expensive analysis no longer lowers the receive
+ * rate; it shows up as ring overflows instead.
+ *
+ * Stream i is analyzed by thread i % -k, which keeps each ring and each
+ * stream's statistics single-writer.
+ */
+#include "mini_iperf.h"
+
+#define RX_RING_RECORDS 65536       // Per stream (a power of two); 2.5 MB of records
+#define RX_ANALYSIS_BURST 256       // Records taken from a ring at a time
+#define RX_IDLE_NS 20000            // Pause of an analysis thread that found every ring empty
+
+static struct {
+    rx_ring_t* rings;               // One per stream, NULL when analysis is inline
+    int count;
+    pthread_t* threads;
+    int threads_count;
+    atomic_int stopping;            // Set once every capture thread has returned
+    _Atomic uint64_t cpu_ns;        // CPU time of the finished analysis threads
+} pipeline;
+
+static int ring_init(rx_ring_t* ring, uint64_t capacity) {
+    memset(ring, 0, sizeof(*ring));
+    ring->records = malloc(capacity * sizeof(rx_record_t));
+    if (!ring->records) return -1;
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->stream, NULL);
+    return 0;
+}
+
+void rx_ring_push(rx_ring_t* ring, const rx_record_t* records, int count) {
+    const uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const uint64_t capacity = ring->mask + 1;
+    if (head + count - ring->cached_tail > capacity) {
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+    uint64_t space = capacity - (head - ring->cached_tail);
+    if ((uint64_t)count > space) {
+        ring->overflows += count - space;
+        count = space;
+    }
+    for (int i = 0; i < count; i++) {
+        ring->records[(head + i) & ring->mask] = records[i];
+    }
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+}
+
+// Analyze up to one burst of a ring; returns the number of records taken
+static int ring_drain(rx_ring_t* ring) {
+    udp_stream_t* stream = atomic_load_explicit(&ring->stream, memory_order_acquire);
+    if (!stream) return 0;  // Capture not started (or failed before binding)
+
+    const uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == ring->cached_head) {
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == ring->cached_head) return 0;
+    }
+    uint64_t count = ring->cached_head - tail;
+    if (count > RX_ANALYSIS_BURST) count = RX_ANALYSIS_BURST;
+    for (uint64_t i = 0; i < count; i++) {
+        account_record(stream, &ring->records[(tail + i) & ring->mask]);
+    }
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    publish_progress(stream);
+    return count;
+}
+
+static void* analysis_main(void* arg) {
+    const int first = (int)(intptr_t)arg;
+    const struct timespec idle = {.tv_sec = 0, .tv_nsec = RX_IDLE_NS};
+
+    while (1) {
+        // Read before the pass: once it is set no producer adds records, so
+        // an empty pass after it means every ring of this thread is drained
+        const int stopping = atomic_load(&pipeline.stopping);
+        int taken = 0;
+        for (int i = first; i < pipeline.count; i += pipeline.threads_count) {
+            taken += ring_drain(&pipeline.rings[i]);
+        }
+        if (taken > 0) continue;
+        if (stopping) break;
+        nanosleep(&idle, NULL);
+    }
+
+    // The trace buffers of the streams are written from here
+    for (int i = first; i < pipeline.count; i += pipeline.threads_count) {
+        udp_stream_t* stream = atomic_load(&pipeline.rings[i].stream);
+        if (stream) trace_buffer_release(&stream->trace);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    atomic_fetch_add(&pipeline.cpu_ns, (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+    return NULL;
+}
+
+int rx_pipeline_start(const struct arguments* args) {
+    const int threads = args->analysis_threads < args->num_streams ?
+                        args->analysis_threads : args->num_streams;
+    pipeline.rings = aligned_alloc(64, args->num_streams * sizeof(rx_ring_t));
+    pipeline.threads = calloc(threads, sizeof(pthread_t));
+    if (!pipeline.rings || !pipeline.threads) {
+        perror("Failed to allocate the receive pipeline");
+        free(pipeline.rings);
+        free(pipeline.threads);
+        pipeline.rings = NULL;
+        return -1;
+    }
+    for (pipeline.count = 0; pipeline.count < args->num_streams; pipeline.count++) {
+        if (ring_init(&pipeline.rings[pipeline.count], RX_RING_RECORDS) != 0) {
+            perror("Failed to allocate a capture ring");
+            uint64_t overflows, cpu_ns;
+            rx_pipeline_stop(&overflows, &cpu_ns);
+            return -1;
+        }
+    }
+    atomic_store(&pipeline.stopping, 0);
+    atomic_store(&pipeline.cpu_ns, 0);
+
+    pipeline.threads_count = threads;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pipeline.threads[i], NULL, analysis_main, (void*)(intptr_t)i) != 0) {
+            perror("Failed to start analysis thread");
+            // Some rings would have no thread draining them
+            atomic_store(&pipeline.stopping, 1);
+            for (int j = 0; j < i; j++) pthread_join(pipeline.threads[j], NULL);
+            pipeline.threads_count = 0;
+            uint64_t overflows, cpu_ns;
+            rx_pipeline_stop(&overflows, &cpu_ns);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+rx_ring_t* rx_pipeline_attach(udp_stream_t* stream) {
+    if (!pipeline.rings || stream->stream_id >= pipeline.count) return NULL;
+    rx_ring_t* ring = &pipeline.rings[stream->stream_id];
+    atomic_store_explicit(&ring->stream, stream, memory_order_release);
+    return ring;
+}
+
+void rx_pipeline_stop(uint64_t* overflows, uint64_t* cpu_ns) {
+    atomic_store(&pipeline.stopping, 1);
+    for (int i = 0; i < pipeline.threads_count; i++) {
+        pthread_join(pipeline.threads[i], NULL);
+    }
+    *overflows = 0;
+    for (int i = 0; i < pipeline.count; i++) {
+        *overflows += pipeline.rings[i].overflows;
+        free(pipeline.rings[i].records);
+    }
+    *cpu_ns = atomic_load(&pipeline.cpu_ns);
+    free(pipeline.rings);
+    free(pipeline.threads);
+    pipeline.rings = NULL;
+    pipeline.threads = NULL;
+    pipeline.count = 0;
+    pipeline.threads_count = 0;
+}
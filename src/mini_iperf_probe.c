@@ -0,0 +1,224 @@
+/*
+ * mini_iperf_probe.c
+ *
+ * Latency under load. A probe thread on the client sends small timestamped
+ * packets at a fixed rate to an echo responder on the server (UDP, same port
+ * number as the control connection) and measures their round-trip time on
+ * the client's own clock, so no clock synchronization is needed.
+ *
+ * Probing starts before the bulk streams (idle phase) and continues while
+ * they run (loaded phase). Comparing the RTT percentiles of the two phases
+ * shows how much queueing the bulk traffic adds (bufferbloat) in one run.
+ */
+#include "mini_iperf.h"
+
+#define NS_PER_SEC 1000000000L
+#define PROBE_LINGER_NS 200000000ULL   // Wait for late replies after stopping
+#define PROBE_INITIAL_SAMPLES 1024
+
+extern volatile sig_atomic_t stop_flag;
+
+enum ProbePhase {
+  PROBE_IDLE = 0,
+  PROBE_LOADED = 1,
+  PROBE_PHASES = 2
+};
+
+/* Probe as sent and echoed back unchanged */
+typedef struct {
+  uint32_t seq;
+  uint32_t phase;
+  uint64_t tx_ns;
+} __attribute__((packed)) probe_packet_t;
+
+/* RTT samples of one phase */
+typedef struct {
+  uint64_t sent;
+  uint64_t answered;
+  uint64_t* rtt_ns;
+  size_t count;
+  size_t capacity;
+} probe_phase_t;
+
+static struct {
+  int sock;
+  uint64_t interval_ns;
+  pthread_t thread;
+  atomic_int phase;
+  atomic_int running;
+  probe_phase_t phases[PROBE_PHASES];
+} probe;
+
+void* probe_echo(void* arg) {
+    struct arguments* args = (struct arguments*)arg;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("Error: Probe echo socket creation failed");
+        return NULL;
+    }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(args->port);
+    addr.sin_addr.s_addr = args->ip_address ? inet_addr(args->ip_address) : INADDR_ANY;
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Error: Probe echo bind failed");
+        close(sock);
+        return NULL;
+    }
+
+    // Echo every probe straight back to its sender
+    probe_packet_t packet;
+    struct sockaddr_in peer;
+    socklen_t peer_len;
+    while (1) {
+        peer_len = sizeof(peer);
+        ssize_t n = recvfrom(sock, &packet, sizeof(packet), 0, (struct sockaddr*)&peer, &peer_len);
+        if (n == (ssize_t)sizeof(packet)) {
+            sendto(sock, &packet, sizeof(packet), 0, (struct sockaddr*)&peer, peer_len);
+        }
+    }
+    return NULL;
+}
+
+static void record_rtt(probe_phase_t* phase, uint64_t rtt_ns) {
+    if (phase->count == phase->capacity) {
+        size_t capacity = phase->capacity ? phase->capacity * 2 : PROBE_INITIAL_SAMPLES;
+        uint64_t* grown = realloc(phase->rtt_ns, capacity * sizeof(uint64_t));
+        if (!grown) return;   // Keep the samples we have
+        phase->rtt_ns = grown;
+        phase->capacity = capacity;
+    }
+    phase->rtt_ns[phase->count++] = rtt_ns;
+    phase->answered++;
+}
+
+// Account every reply waiting on the socket
+static void collect_replies(void) {
+    probe_packet_t packet;
+    while (recv(probe.sock, &packet, sizeof(packet), MSG_DONTWAIT) == (ssize_t)sizeof(packet)) {
+        if (packet.phase >= PROBE_PHASES) continue;
+        record_rtt(&probe.phases[packet.phase], get_monotonic_time() - packet.tx_ns);
+    }
+}
+
+// Wait until the socket is readable or the deadline passes
+static void wait_reply(uint64_t deadline) {
+    uint64_t now = get_monotonic_time();
+    if (deadline <= now) return;
+    struct pollfd pfd = {.fd = probe.sock, .events = POLLIN};
+    struct timespec timeout = {
+        .tv_sec = (deadline - now) / NS_PER_SEC,
+        .tv_nsec = (deadline - now) % NS_PER_SEC
+    };
+    ppoll(&pfd, 1, &timeout, NULL);
+}
+
+static void* probe_loop(void* unused) {
+    (void)unused;
+    uint32_t seq = 0;
+    uint64_t next_send = get_monotonic_time();
+
+    while (atomic_load(&probe.running) && stop_flag) {
+        uint64_t now = get_monotonic_time();
+        if (now >= next_send) {
+            probe_packet_t packet = {
+                .seq = seq++,
+                .phase = atomic_load(&probe.phase),
+                .tx_ns = now
+            };
+            if (send(probe.sock, &packet, sizeof(packet), 0) == (ssize_t)sizeof(packet)) {
+                probe.phases[packet.phase].sent++;
+            }
+            next_send += probe.interval_ns;
+            if (next_send < now) next_send = now + probe.interval_ns;  // Do not burst after a stall
+        }
+        wait_reply(next_send);
+        collect_replies();
+    }
+
+    // Give replies still in flight a chance to arrive
+    const uint64_t deadline = get_monotonic_time() + PROBE_LINGER_NS;
+    while (get_monotonic_time() < deadline) {
+        wait_reply(deadline);
+        collect_replies();
+    }
+    return NULL;
+}
+
+int probe_start(const struct arguments* args) {
+    memset(&probe.phases, 0, sizeof(probe.phases));
+    probe.interval_ns = NS_PER_SEC / args->probe_rate;
+    atomic_store(&probe.phase, PROBE_IDLE);
+    atomic_store(&probe.running, 1);
+
+    probe.sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (probe.sock < 0) {
+        perror("Error: Probe socket creation failed");
+        return -1;
+    }
+    struct sockaddr_in server = {0};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(args->port);
+    server.sin_addr.s_addr = inet_addr(args->ip_address);
+    if (connect(probe.sock, (struct sockaddr*)&server, sizeof(server)) < 0) {
+        perror("Error: Probe connect failed");
+        close(probe.sock);
+        return -1;
+    }
+
+    if (pthread_create(&probe.thread, NULL, probe_loop, NULL) != 0) {
+        perror("Error: Cannot start probe thread");
+        close(probe.sock);
+        return -1;
+    }
+    return 0;
+}
+
+void probe_set_loaded(void) {
+    atomic_store(&probe.phase, PROBE_LOADED);
+}
+
+static int compare_uint64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double rtt_percentile_ms(const probe_phase_t* phase, double p) {
+    if (phase->count == 0) return 0.0;
+    return phase->rtt_ns[(size_t)(p / 100.0 * (phase->count - 1) + 0.5)] / 1e6;
+}
+
+void probe_stop(void) {
+    atomic_store(&probe.running, 0);
+    pthread_join(probe.thread, NULL);
+    close(probe.sock);
+
+    double idle_p50_ms = 0.0;
+    for (int i = 0; i < PROBE_PHASES; i++) {
+        probe_phase_t* phase = &probe.phases[i];
+        qsort(phase->rtt_ns, phase->count, sizeof(uint64_t), compare_uint64);
+
+        result_record_t record = {.type = RESULT_LATENCY};
+        result_latency_t* l = &record.latency;
+        l->phase = i == PROBE_IDLE ? "idle" : "loaded";
+        l->sent = phase->sent;
+        l->answered = phase->answered;
+        l->loss_pct = l->sent > 0 ? 100.0 * (l->sent - l->answered) / l->sent : 0.0;
+        l->min_ms = rtt_percentile_ms(phase, 0);
+        l->p50_ms = rtt_percentile_ms(phase, 50);
+        l->p90_ms = rtt_percentile_ms(phase, 90);
+        l->p99_ms = rtt_percentile_ms(phase, 99);
+        l->max_ms = rtt_percentile_ms(phase, 100);
+        if (i == PROBE_IDLE) {
+            idle_p50_ms = l->p50_ms;
+        } else {
+            l->added_p50_ms = l->p50_ms - idle_p50_ms;
+        }
+        results_emit(&record);
+
+        free(phase->rtt_ns);
+        phase->rtt_ns = NULL;
+        phase->count = phase->capacity = 0;
+    }
+}
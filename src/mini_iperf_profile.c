@@ -0,0 +1,257 @@
+/*
+ * mini_iperf_profile.c
+ *
+ * Traffic profiles for the UDP sender. Instead of computing departure times
+ * in the send loop, every stream precomputes a schedule of (time, size)
+ * departures before the experiment starts and the sender only walks it,
+ * so the cost of the random draws never limits the achievable rate.
+ *
+ * The -b bandwidth is the mean offered rate of every profile (split evenly
+ * across streams); the on/off profile sends at a correspondingly higher
+ * peak rate during its bursts. Replayed traces keep their own timing.
+ */
+#include "mini_iperf.h"
+
+#define NS_PER_SEC 1000000000L
+#define MIN_PACKET_SIZE ((int)sizeof(MiniIperfHeader) + 1)
+
+uint64_t rng_next(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+double rng_uniform(uint64_t* state) {
+    return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int parse_profile(const char* spec, struct arguments* args) {
+    if (strcmp(spec, "cbr") == 0) {
+        args->profile = PROFILE_CBR;
+    } else if (strcmp(spec, "poisson") == 0) {
+        args->profile = PROFILE_POISSON;
+    } else if (strncmp(spec, "onoff:", 6) == 0) {
+        if (sscanf(spec + 6, "%d:%d", &args->on_ms, &args->off_ms) != 2 ||
+            args->on_ms <= 0 || args->off_ms < 0) {
+            fprintf(stderr, "Error: On/off profile must be onoff:<on_ms>:<off_ms>\n");
+            return -1;
+        }
+        args->profile = PROFILE_ONOFF;
+    } else if (strncmp(spec, "replay:", 7) == 0 && spec[7] != '\0') {
+        if (args->replay_file) free(args->replay_file);
+        args->replay_file = strdup(spec + 7);
+        if (!args->replay_file) {
+            perror("Error: Memory allocation failed for replay file");
+            return -1;
+        }
+        args->profile = PROFILE_REPLAY;
+    } else {
+        fprintf(stderr, "Error: Unknown profile '%s' (use cbr, poisson, onoff:<on>:<off>, replay:<file>)\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+static int valid_size(int size) {
+    if (size < MIN_PACKET_SIZE || size > MAX_PACKET_SIZE) {
+        fprintf(stderr, "Error: Packet sizes must be between %d and %d bytes\n",
+                MIN_PACKET_SIZE, MAX_PACKET_SIZE);
+        return 0;
+    }
+    return 1;
+}
+
+int parse_size_distribution(const char* spec, size_distribution_t* dist) {
+    memset(dist, 0, sizeof(*dist));
+
+    if (strncmp(spec, "uniform:", 8) == 0) {
+        if (sscanf(spec + 8, "%d:%d", &dist->sizes[0], &dist->sizes[1]) != 2 ||
+            dist->sizes[0] > dist->sizes[1]) {
+            fprintf(stderr, "Error: Uniform sizes must be uniform:<min>:<max>\n");
+            return -1;
+        }
+        if (!valid_size(dist->sizes[0]) || !valid_size(dist->sizes[1])) return -1;
+        dist->uniform = 1;
+        dist->count = 2;
+        return 0;
+    }
+
+    char* copy = strdup(spec);
+    char* saveptr = NULL;
+    if (!copy) {
+        perror("Error: Memory allocation failed");
+        return -1;
+    }
+    for (char* tok = strtok_r(copy, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        if (dist->count == MAX_SIZE_CLASSES) {
+            fprintf(stderr, "Error: At most %d packet sizes\n", MAX_SIZE_CLASSES);
+            free(copy);
+            return -1;
+        }
+        int size = 0;
+        double weight = 1.0;
+        if (sscanf(tok, "%d:%lf", &size, &weight) < 1 || weight <= 0 || !valid_size(size)) {
+            fprintf(stderr, "Error: Invalid size class '%s' (use <size>[:<weight>])\n", tok);
+            free(copy);
+            return -1;
+        }
+        dist->sizes[dist->count] = size;
+        dist->weights[dist->count] = weight;
+        dist->count++;
+    }
+    free(copy);
+    return dist->count > 0 ? 0 : -1;
+}
+
+int profile_uses_schedule(const struct arguments* args) {
+    return args->profile != PROFILE_CBR || args->sizes.count > 0;
+}
+
+// Draw one packet size from the distribution
+static int draw_size(const struct arguments* args, uint64_t* rng, double total_weight) {
+    const size_distribution_t* dist = &args->sizes;
+    if (dist->count == 0) return args->packet_size;
+    if (dist->uniform) {
+        return dist->sizes[0] + (int)(rng_uniform(rng) * (dist->sizes[1] - dist->sizes[0] + 1));
+    }
+    double pick = rng_uniform(rng) * total_weight;
+    for (int i = 0; i < dist->count; i++) {
+        if (pick < dist->weights[i]) return dist->sizes[i];
+        pick -= dist->weights[i];
+    }
+    return dist->sizes[dist->count - 1];
+}
+
+static double mean_size(const struct arguments* args, double* total_weight) {
+    const size_distribution_t* dist = &args->sizes;
+    *total_weight = 0.0;
+    if (dist->count == 0) return args->packet_size;
+    if (dist->uniform) return (dist->sizes[0] + dist->sizes[1]) / 2.0;
+
+    double sum = 0.0;
+    for (int i = 0; i < dist->count; i++) {
+        sum += dist->sizes[i] * dist->weights[i];
+        *total_weight += dist->weights[i];
+    }
+    return sum / *total_weight;
+}
+
+// Load "<seconds> <bytes>" lines; times are made relative to the first line
+static int load_replay(traffic_schedule_t* schedule, const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        perror("Error: Cannot open replay file");
+        return -1;
+    }
+
+    size_t capacity = 4096;
+    schedule->entries = malloc(capacity * sizeof(schedule_entry_t));
+    schedule->count = 0;
+    if (!schedule->entries) {
+        perror("Error: Memory allocation failed for replay schedule");
+        fclose(file);
+        return -1;
+    }
+
+    char line[256];
+    double first = 0.0, previous = 0.0;
+    while (fgets(line, sizeof(line), file) && schedule->count < MAX_REPLAY_ENTRIES) {
+        double ts;
+        int size;
+        if (line[0] == '#' || sscanf(line, "%lf %d", &ts, &size) != 2) continue;
+        if (size < MIN_PACKET_SIZE) size = MIN_PACKET_SIZE;
+        if (size > MAX_PACKET_SIZE) size = MAX_PACKET_SIZE;
+        if (schedule->count == 0) first = previous = ts;
+        if (ts < previous) ts = previous;   // Keep departures monotonic
+        previous = ts;
+
+        if (schedule->count == capacity) {
+            capacity *= 2;
+            schedule_entry_t* grown = realloc(schedule->entries, capacity * sizeof(schedule_entry_t));
+            if (!grown) {
+                perror("Error: Memory allocation failed for replay schedule");
+                fclose(file);
+                schedule_free(schedule);
+                return -1;
+            }
+            schedule->entries = grown;
+        }
+        schedule->entries[schedule->count].offset_ns = (uint64_t)((ts - first) * NS_PER_SEC);
+        schedule->entries[schedule->count].size = size;
+        schedule->count++;
+    }
+    fclose(file);
+
+    if (schedule->count == 0) {
+        fprintf(stderr, "Error: Replay file %s has no \"<seconds> <bytes>\" lines\n", filename);
+        schedule_free(schedule);
+        return -1;
+    }
+    // Repeat after the last departure plus the mean gap
+    const uint64_t last = schedule->entries[schedule->count - 1].offset_ns;
+    schedule->period_ns = last + (schedule->count > 1 ? last / (schedule->count - 1) : NS_PER_SEC);
+    if (schedule->period_ns == 0) schedule->period_ns = 1;
+    return 0;
+}
+
+int schedule_build(traffic_schedule_t* schedule, const struct arguments* args, int stream_id) {
+    memset(schedule, 0, sizeof(*schedule));
+    if (args->profile == PROFILE_REPLAY) {
+        return load_replay(schedule, args->replay_file);
+    }
+
+    schedule->entries = malloc(SCHEDULE_LENGTH * sizeof(schedule_entry_t));
+    if (!schedule->entries) {
+        perror("Error: Memory allocation failed for schedule");
+        return -1;
+    }
+    schedule->count = SCHEDULE_LENGTH;
+
+    uint64_t rng = 0x5EEDULL + (uint64_t)stream_id * 0x100000001B3ULL;
+    double total_weight;
+    const double avg_size = mean_size(args, &total_weight);
+    const double stream_rate = (double)args->bandwidth / args->num_streams;
+
+    // Peak rate during bursts keeps the mean rate at -b for the on/off profile
+    double rate = stream_rate;
+    const uint64_t on_ns = (uint64_t)args->on_ms * 1000000ULL;
+    const uint64_t cycle_ns = on_ns + (uint64_t)args->off_ms * 1000000ULL;
+    if (args->profile == PROFILE_ONOFF) rate = stream_rate * cycle_ns / on_ns;
+
+    double t = 0.0;
+    for (size_t i = 0; i < schedule->count; i++) {
+        const int size = draw_size(args, &rng, total_weight);
+
+        if (args->profile == PROFILE_ONOFF) {
+            // Move departures that fall into a silence to the next burst
+            const uint64_t phase = (uint64_t)t % cycle_ns;
+            if (phase >= on_ns) t += cycle_ns - phase;
+        }
+        schedule->entries[i].offset_ns = (uint64_t)t;
+        schedule->entries[i].size = size;
+
+        if (rate <= 0) continue;   // Unpaced: everything is due immediately
+        const double gap = size * 8.0 / rate * NS_PER_SEC;
+        if (args->profile == PROFILE_POISSON) {
+            // Exponential gap with the mean of the size-based gap
+            const double mean_gap = avg_size * 8.0 / rate * NS_PER_SEC;
+            t += -log(1.0 - rng_uniform(&rng)) * mean_gap;
+        } else {
+            t += gap;
+        }
+    }
+
+    schedule->period_ns = (uint64_t)t;
+    if (args->profile == PROFILE_ONOFF) {
+        // Whole cycles only, so bursts line up when the schedule repeats
+        schedule->period_ns = (schedule->period_ns + cycle_ns - 1) / cycle_ns * cycle_ns;
+    }
+    return 0;
+}
+
+void schedule_free(traffic_schedule_t* schedule) {
+    free(schedule->entries);
+    schedule->entries = NULL;
+    schedule->count = 0;
+}
@@ -0,0 +1,580 @@
+/*
+ * mini_iperf_results.c
+ *
+ * Results model and writer thread. Every report (configuration, interval,
+ * per-stream and summary metrics) is queued as a result_record_t into a
+ * bounded queue and formatted as text, JSON or CSV by a dedicated writer
+ * thread, so no data path thread ever formats output or waits on I/O.
+ */
+#include "mini_iperf.h"
+
+static struct {
+    result_record_t ring[RESULTS_QUEUE_DEPTH];
+    int head;                   // Next record to write out
+    int count;                  // Records in the queue
+    int running;
+    int format;
+    int measure_delay;
+    int csv_header_done;
+    int csv_trial_header_done;
+    int csv_latency_header_done;
+    int csv_transact_header_done;
+    int csv_flows_header_done;
+    int csv_adapt_header_done;
+    int csv_impair_header_done;
+    FILE* out;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} results = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER
+};
+
+// CPU cost of one end, if it was measured
+static void write_text_cpu(FILE* out, const char* label, const cpu_report_t* c) {
+    if (c->cpu_pct <= 0) return;
+    fprintf(out, "%s%.1f%% of a core (streams %.1f%%), %.2f MB per CPU-second\n",
+            label, c->cpu_pct, c->threads_cpu_pct, c->bytes_per_cpu_s / 1e6);
+    fprintf(out, "                 host user %.1f%%, sys %.1f%%, softirq %.1f%%\n",
+            c->host_user_pct, c->host_sys_pct, c->host_softirq_pct);
+}
+
+static void write_text(FILE* out, const result_record_t* r) {
+    const result_metrics_t* m = &r->metrics;
+    switch (r->type) {
+        case RESULT_CONFIG:
+            break;
+
+        case RESULT_INTERVAL:
+            if (m->stream_id < 0) {
+                fprintf(out, "[SUM] ");
+            } else {
+                fprintf(out, "[%3d] ", m->stream_id);
+            }
+            fprintf(out, "%6.2f-%-6.2f sec  %8.2f MB  %8.2f Mbps  %lu packets",
+                    m->start_s, m->end_s, m->bytes / 1e6, m->throughput_mbps, m->packets);
+            if (strcmp(m->side, "receiver") == 0) fprintf(out, "  %lu lost", m->lost);
+            fprintf(out, "\n");
+            break;
+
+        case RESULT_STREAM:
+        case RESULT_SUMMARY:
+            if (r->type == RESULT_STREAM) {
+                fprintf(out, "\n=== Stream %d ===\n", m->stream_id);
+            } else {
+                fprintf(out, "\n=== UDP Statistics (%s%s%s) ===\n", m->direction,
+                        m->peer[0] ? ", " : "", m->peer);
+            }
+            fprintf(out, "Duration:        %.3f sec\n", m->end_s - m->start_s);
+            fprintf(out, "Total Bytes:     %.2f MB\n", m->bytes / 1e6);
+            fprintf(out, "Payload Bytes:   %.2f MB\n", m->payload_bytes / 1e6);
+            fprintf(out, "Valid Packets:   %lu\n", m->packets);
+            fprintf(out, "Corrupt Packets: %lu\n", m->corrupt);
+            fprintf(out, "Out-of-Order:    %lu\n", m->out_of_order);
+            fprintf(out, "Lost Packets:    %lu (%.2f%%)\n", m->lost, m->loss_pct);
+            fprintf(out, "Throughput:      %.2f Mbps\n", m->throughput_mbps);
+            fprintf(out, "Goodput:         %.2f Mbps\n", m->goodput_mbps);
+            if (m->jitter_ms > 0) {
+                fprintf(out, "Avg Jitter:      %.3f ms\n", m->jitter_ms);
+                fprintf(out, "Jitter Std Dev:  %.3f ms\n", m->jitter_stddev_ms);
+            }
+            if (r->type == RESULT_SUMMARY) {
+                fprintf(out, "Loss by Cause:   network %lu, socket buffer %lu, receiver CPU %lu",
+                        m->lost_network, m->lost_socket, m->lost_cpu);
+                if (m->ring_overflows > 0) fprintf(out, ", analysis ring %lu", m->lost_pipeline);
+                fprintf(out, "\n");
+                if (m->rcvbuf_bytes > 0) {
+                    fprintf(out, "Socket Buffers:  receive %.2f MB", m->rcvbuf_bytes / 1e6);
+                    if (m->sndbuf_bytes > 0) fprintf(out, ", send %.2f MB", m->sndbuf_bytes / 1e6);
+                    fprintf(out, " (granted by the kernel)\n");
+                }
+                if (m->sndbuf_errors > 0) {
+                    fprintf(out, "Send Refusals:   %lu (no send buffer space)\n", m->sndbuf_errors);
+                }
+                write_text_cpu(out, "Receiver CPU:    ", &m->rx_cpu);
+                write_text_cpu(out, "Sender CPU:      ", &m->tx_cpu);
+            }
+            if (results.measure_delay) {
+                fprintf(out, "One-Way Delay:   %.3f ms (min %.3f, max %.3f)\n",
+                        m->avg_owd_ms, m->min_owd_ms, m->max_owd_ms);
+                fprintf(out, "OWD Percentiles: p50 %.3f ms, p99 %.3f ms\n",
+                        m->p50_owd_ms, m->p99_owd_ms);
+            }
+            fprintf(out, "========================\n");
+            break;
+
+        case RESULT_TRIAL: {
+            const result_trial_t* t = &r->trial;
+            fprintf(out, "Trial %2d: offered %9.2f Mbps  received %9.2f Mbps  loss %7.4f%%  "
+                    "delay %7.3f ms  %s\n", t->trial, t->offered_mbps, t->received_mbps,
+                    t->loss_pct, t->delay_ms, t->pass ? "PASS" : "FAIL");
+            break;
+        }
+
+        case RESULT_SEARCH: {
+            const result_trial_t* t = &r->trial;
+            fprintf(out, "\n=== Rate Search ===\n");
+            fprintf(out, "Max Sustainable: %.2f Mbps\n", t->offered_mbps);
+            fprintf(out, "Received:        %.2f Mbps\n", t->received_mbps);
+            fprintf(out, "Loss:            %.4f%%\n", t->loss_pct);
+            fprintf(out, "Delay:           %.3f ms\n", t->delay_ms);
+            fprintf(out, "========================\n");
+            break;
+        }
+
+        case RESULT_LATENCY: {
+            const result_latency_t* l = &r->latency;
+            fprintf(out, "\n=== Latency (%s) ===\n", l->phase);
+            fprintf(out, "Probes:          %lu sent, %lu answered (%.2f%% lost)\n",
+                    l->sent, l->answered, l->loss_pct);
+            fprintf(out, "RTT:             min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f ms\n",
+                    l->min_ms, l->p50_ms, l->p90_ms, l->p99_ms, l->max_ms);
+            if (strcmp(l->phase, "loaded") == 0) {
+                fprintf(out, "Added by Load:   %.3f ms (p50)\n", l->added_p50_ms);
+            }
+            fprintf(out, "========================\n");
+            break;
+        }
+
+        case RESULT_TRANSACT: {
+            const result_transact_t* t = &r->transact;
+            if (t->stream_id < 0) {
+                fprintf(out, "\n=== Transactions ===\n");
+            } else {
+                fprintf(out, "\n=== Transactions, Stream %d ===\n", t->stream_id);
+            }
+            fprintf(out, "Duration:        %.3f sec\n", t->duration_s);
+            fprintf(out, "Transactions:    %lu (%lu timed out)\n", t->transactions, t->timeouts);
+            fprintf(out, "Rate:            %.0f trans/sec\n", t->tps);
+            fprintf(out, "Latency:         min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f ms\n",
+                    t->min_ms, t->p50_ms, t->p90_ms, t->p99_ms, t->p999_ms, t->max_ms);
+            fprintf(out, "========================\n");
+            break;
+        }
+
+        case RESULT_FLOWS: {
+            const result_flows_t* f = &r->flows;
+            fprintf(out, "\n=== Flows ===\n");
+            fprintf(out, "Flows Seen:      %d of %d\n", f->flows_seen, f->flows_expected);
+            fprintf(out, "Per Flow:        min %.3f, p50 %.3f, max %.3f Mbps\n",
+                    f->min_mbps, f->p50_mbps, f->max_mbps);
+            fprintf(out, "Fairness:        %.4f (Jain)\n", f->fairness);
+            fprintf(out, "Worst Loss:      %.4f%%\n", f->max_loss_pct);
+            if (f->untracked_packets > 0) {
+                fprintf(out, "Untracked:       %lu packets (flow table full)\n", f->untracked_packets);
+            }
+            fprintf(out, "========================\n");
+            break;
+        }
+
+        case RESULT_IMPAIR: {
+            const result_impair_t* i = &r->impair;
+            fprintf(out, "\n=== Impairments (seed %lu) ===\n", i->seed);
+            fprintf(out, "Offered:         %lu packets\n", i->offered);
+            fprintf(out, "Applied:         dropped %lu, duplicated %lu, corrupted %lu, reordered %lu, "
+                    "delayed %lu\n", i->dropped, i->duplicated, i->corrupted, i->reordered, i->delayed);
+            fprintf(out, "Held:            mean %.3f, max %.3f ms\n", i->mean_held_ms, i->max_held_ms);
+            fprintf(out, "Receiver Should: valid %lu, lost %lu, out-of-order %lu, corrupt %lu\n",
+                    i->expect_packets, i->expect_lost, i->expect_out_of_order, i->expect_corrupt);
+            fprintf(out, "========================\n");
+            break;
+        }
+
+        case RESULT_ADAPT: {
+            const result_adapt_t* a = &r->adapt;
+            fprintf(out, "\n=== Adaptive Rate (%s) ===\n", a->controller);
+            fprintf(out, "Reports:         %lu (%lu decreases)\n", a->reports, a->decreases);
+            fprintf(out, "Rate:            start %.2f, final %.2f, mean %.2f Mbps\n",
+                    a->start_mbps, a->final_mbps, a->mean_mbps);
+            fprintf(out, "Range:           %.2f - %.2f Mbps\n", a->min_mbps, a->max_mbps);
+            fprintf(out, "========================\n");
+            break;
+        }
+    }
+}
+
+static const char* type_name(int type) {
+    switch (type) {
+        case RESULT_CONFIG:   return "config";
+        case RESULT_INTERVAL: return "interval";
+        case RESULT_STREAM:   return "stream";
+        case RESULT_SUMMARY:  return "summary";
+        case RESULT_TRIAL:    return "trial";
+        case RESULT_SEARCH:   return "search";
+        case RESULT_LATENCY:  return "latency";
+        case RESULT_TRANSACT: return "transact";
+        case RESULT_FLOWS:    return "flows";
+        case RESULT_ADAPT:    return "adapt";
+        case RESULT_IMPAIR:   return "impair";
+        default:              return "unknown";
+    }
+}
+
+static void write_json_cpu(FILE* out, const char* prefix, const cpu_report_t* c) {
+    fprintf(out, ",\"%s_cpu_pct\":%.2f,\"%s_threads_cpu_pct\":%.2f,\"%s_host_user_pct\":%.2f,"
+            "\"%s_host_sys_pct\":%.2f,\"%s_host_softirq_pct\":%.2f,\"%s_bytes_per_cpu_s\":%.0f",
+            prefix, c->cpu_pct, prefix, c->threads_cpu_pct, prefix, c->host_user_pct,
+            prefix, c->host_sys_pct, prefix, c->host_softirq_pct, prefix, c->bytes_per_cpu_s);
+}
+
+static void write_json(FILE* out, const result_record_t* r) {
+    if (r->type == RESULT_IMPAIR) {
+        const result_impair_t* i = &r->impair;
+        fprintf(out, "{\"type\":\"impair\",\"seed\":%lu,\"offered\":%lu,\"dropped\":%lu,"
+                "\"duplicated\":%lu,\"corrupted\":%lu,\"reordered\":%lu,\"delayed\":%lu,"
+                "\"mean_held_ms\":%.4f,\"max_held_ms\":%.4f,\"expect_packets\":%lu,"
+                "\"expect_lost\":%lu,\"expect_out_of_order\":%lu,\"expect_corrupt\":%lu}\n",
+                i->seed, i->offered, i->dropped, i->duplicated, i->corrupted, i->reordered,
+                i->delayed, i->mean_held_ms, i->max_held_ms, i->expect_packets, i->expect_lost,
+                i->expect_out_of_order, i->expect_corrupt);
+        return;
+    }
+    if (r->type == RESULT_ADAPT) {
+        const result_adapt_t* a = &r->adapt;
+        fprintf(out, "{\"type\":\"adapt\",\"controller\":\"%s\",\"reports\":%lu,\"decreases\":%lu,"
+                "\"start_mbps\":%.3f,\"final_mbps\":%.3f,\"mean_mbps\":%.3f,\"min_mbps\":%.3f,"
+                "\"max_mbps\":%.3f}\n",
+                a->controller, a->reports, a->decreases, a->start_mbps, a->final_mbps,
+                a->mean_mbps, a->min_mbps, a->max_mbps);
+        return;
+    }
+    if (r->type == RESULT_FLOWS) {
+        const result_flows_t* f = &r->flows;
+        fprintf(out, "{\"type\":\"flows\",\"flows_expected\":%d,\"flows_seen\":%d,"
+                "\"untracked_packets\":%lu,\"min_mbps\":%.3f,\"p50_mbps\":%.3f,\"max_mbps\":%.3f,"
+                "\"fairness\":%.4f,\"max_loss_pct\":%.4f}\n",
+                f->flows_expected, f->flows_seen, f->untracked_packets, f->min_mbps, f->p50_mbps,
+                f->max_mbps, f->fairness, f->max_loss_pct);
+        return;
+    }
+    if (r->type == RESULT_TRANSACT) {
+        const result_transact_t* t = &r->transact;
+        fprintf(out, "{\"type\":\"transact\",\"stream\":%d,\"duration_s\":%.3f,\"transactions\":%lu,"
+                "\"timeouts\":%lu,\"tps\":%.1f,\"min_ms\":%.4f,\"p50_ms\":%.4f,\"p90_ms\":%.4f,"
+                "\"p99_ms\":%.4f,\"p999_ms\":%.4f,\"max_ms\":%.4f}\n",
+                t->stream_id, t->duration_s, t->transactions, t->timeouts, t->tps, t->min_ms,
+                t->p50_ms, t->p90_ms, t->p99_ms, t->p999_ms, t->max_ms);
+        return;
+    }
+    if (r->type == RESULT_LATENCY) {
+        const result_latency_t* l = &r->latency;
+        fprintf(out, "{\"type\":\"latency\",\"phase\":\"%s\",\"sent\":%lu,\"answered\":%lu,"
+                "\"loss_pct\":%.4f,\"min_rtt_ms\":%.4f,\"p50_rtt_ms\":%.4f,\"p90_rtt_ms\":%.4f,"
+                "\"p99_rtt_ms\":%.4f,\"max_rtt_ms\":%.4f,\"added_p50_ms\":%.4f}\n",
+                l->phase, l->sent, l->answered, l->loss_pct, l->min_ms, l->p50_ms, l->p90_ms,
+                l->p99_ms, l->max_ms, l->added_p50_ms);
+        return;
+    }
+    if (r->type == RESULT_TRIAL || r->type == RESULT_SEARCH) {
+        const result_trial_t* t = &r->trial;
+        fprintf(out, "{\"type\":\"%s\",\"trial\":%d,\"offered_mbps\":%.3f,\"received_mbps\":%.3f,"
+                "\"sent_packets\":%lu,\"received_packets\":%lu,\"loss_pct\":%.4f,\"delay_ms\":%.4f,"
+                "\"pass\":%s}\n", type_name(r->type), t->trial, t->offered_mbps, t->received_mbps,
+                t->sent_packets, t->received_packets, t->loss_pct, t->delay_ms,
+                t->pass ? "true" : "false");
+        return;
+    }
+    if (r->type == RESULT_CONFIG) {
+        const result_config_t* c = &r->config;
+        fprintf(out, "{\"type\":\"config\",\"mode\":\"%s\",\"address\":\"%s\",\"port\":%d,"
+                "\"packet_size\":%d,\"bandwidth_bps\":%ld,\"streams\":%d,\"duration_s\":%d,"
+                "\"interval_s\":%d,\"engine\":\"%s\",\"batch\":%d}\n",
+                c->mode, c->address, c->port, c->packet_size, c->bandwidth, c->num_streams,
+                c->duration, c->interval, engine_name(c->engine), c->batch_size);
+        return;
+    }
+    const result_metrics_t* m = &r->metrics;
+    fprintf(out, "{\"type\":\"%s\",\"side\":\"%s\",\"direction\":\"%s\",\"peer\":\"%s\","
+            "\"stream\":%d,\"start_s\":%.3f,\"end_s\":%.3f,"
+            "\"packets\":%lu,\"bytes\":%lu,\"payload_bytes\":%lu,\"lost\":%lu,\"corrupt\":%lu,"
+            "\"out_of_order\":%lu,\"loss_pct\":%.4f,\"throughput_mbps\":%.3f,\"goodput_mbps\":%.3f,"
+            "\"jitter_ms\":%.4f,\"jitter_stddev_ms\":%.4f,\"avg_owd_ms\":%.4f,\"min_owd_ms\":%.4f,"
+            "\"max_owd_ms\":%.4f,\"p50_owd_ms\":%.4f,\"p99_owd_ms\":%.4f,\"lost_network\":%lu,"
+            "\"lost_socket\":%lu,\"lost_cpu\":%lu,\"lost_pipeline\":%lu,\"rcvbuf_bytes\":%lu,"
+            "\"sndbuf_bytes\":%lu,\"sndbuf_errors\":%lu,\"ring_overflows\":%lu",
+            type_name(r->type), m->side, m->direction, m->peer, m->stream_id,
+            m->start_s, m->end_s,
+            m->packets, m->bytes, m->payload_bytes, m->lost, m->corrupt, m->out_of_order,
+            m->loss_pct, m->throughput_mbps, m->goodput_mbps, m->jitter_ms, m->jitter_stddev_ms,
+            m->avg_owd_ms, m->min_owd_ms, m->max_owd_ms, m->p50_owd_ms, m->p99_owd_ms,
+            m->lost_network, m->lost_socket, m->lost_cpu, m->lost_pipeline, m->rcvbuf_bytes,
+            m->sndbuf_bytes, m->sndbuf_errors, m->ring_overflows);
+    write_json_cpu(out, "rx", &m->rx_cpu);
+    write_json_cpu(out, "tx", &m->tx_cpu);
+    fprintf(out, "}\n");
+}
+
+static void write_csv_cpu(FILE* out, const cpu_report_t* c) {
+    fprintf(out, ",%.2f,%.2f,%.2f,%.2f,%.2f,%.0f", c->cpu_pct, c->threads_cpu_pct,
+            c->host_user_pct, c->host_sys_pct, c->host_softirq_pct, c->bytes_per_cpu_s);
+}
+
+static void write_csv(FILE* out, const result_record_t* r) {
+    if (r->type == RESULT_IMPAIR) {
+        if (!results.csv_impair_header_done) {
+            fprintf(out, "type,seed,offered,dropped,duplicated,corrupted,reordered,delayed,"
+                    "mean_held_ms,max_held_ms,expect_packets,expect_lost,expect_out_of_order,"
+                    "expect_corrupt\n");
+            results.csv_impair_header_done = 1;
+        }
+        const result_impair_t* i = &r->impair;
+        fprintf(out, "impair,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.4f,%.4f,%lu,%lu,%lu,%lu\n",
+                i->seed, i->offered, i->dropped, i->duplicated, i->corrupted, i->reordered,
+                i->delayed, i->mean_held_ms, i->max_held_ms, i->expect_packets, i->expect_lost,
+                i->expect_out_of_order, i->expect_corrupt);
+        return;
+    }
+    if (r->type == RESULT_ADAPT) {
+        if (!results.csv_adapt_header_done) {
+            fprintf(out, "type,controller,reports,decreases,start_mbps,final_mbps,mean_mbps,"
+                    "min_mbps,max_mbps\n");
+            results.csv_adapt_header_done = 1;
+        }
+        const result_adapt_t* a = &r->adapt;
+        fprintf(out, "adapt,%s,%lu,%lu,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                a->controller, a->reports, a->decreases, a->start_mbps, a->final_mbps,
+                a->mean_mbps, a->min_mbps, a->max_mbps);
+        return;
+    }
+    if (r->type == RESULT_FLOWS) {
+        if (!results.csv_flows_header_done) {
+            fprintf(out, "type,flows_expected,flows_seen,untracked_packets,min_mbps,p50_mbps,"
+                    "max_mbps,fairness,max_loss_pct\n");
+            results.csv_flows_header_done = 1;
+        }
+        const result_flows_t* f = &r->flows;
+        fprintf(out, "flows,%d,%d,%lu,%.3f,%.3f,%.3f,%.4f,%.4f\n",
+                f->flows_expected, f->flows_seen, f->untracked_packets, f->min_mbps, f->p50_mbps,
+                f->max_mbps, f->fairness, f->max_loss_pct);
+        return;
+    }
+    if (r->type == RESULT_TRANSACT) {
+        if (!results.csv_transact_header_done) {
+            fprintf(out, "type,stream,duration_s,transactions,timeouts,tps,min_ms,p50_ms,p90_ms,"
+                    "p99_ms,p999_ms,max_ms\n");
+            results.csv_transact_header_done = 1;
+        }
+        const result_transact_t* t = &r->transact;
+        fprintf(out, "transact,%d,%.3f,%lu,%lu,%.1f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+                t->stream_id, t->duration_s, t->transactions, t->timeouts, t->tps, t->min_ms,
+                t->p50_ms, t->p90_ms, t->p99_ms, t->p999_ms, t->max_ms);
+        return;
+    }
+    if (r->type == RESULT_LATENCY) {
+        if (!results.csv_latency_header_done) {
+            fprintf(out, "type,phase,sent,answered,loss_pct,min_rtt_ms,p50_rtt_ms,p90_rtt_ms,"
+                    "p99_rtt_ms,max_rtt_ms,added_p50_ms\n");
+            results.csv_latency_header_done = 1;
+        }
+        const result_latency_t* l = &r->latency;
+        fprintf(out, "latency,%s,%lu,%lu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+                l->phase, l->sent, l->answered, l->loss_pct, l->min_ms, l->p50_ms, l->p90_ms,
+                l->p99_ms, l->max_ms, l->added_p50_ms);
+        return;
+    }
+    if (r->type == RESULT_TRIAL || r->type == RESULT_SEARCH) {
+        // Search trials form their own table with its own header
+        if (!results.csv_trial_header_done) {
+            fprintf(out, "type,trial,offered_mbps,received_mbps,sent_packets,received_packets,"
+                    "loss_pct,delay_ms,pass\n");
+            results.csv_trial_header_done = 1;
+        }
+        const result_trial_t* t = &r->trial;
+        fprintf(out, "%s,%d,%.3f,%.3f,%lu,%lu,%.4f,%.4f,%d\n", type_name(r->type), t->trial,
+                t->offered_mbps, t->received_mbps, t->sent_packets, t->received_packets,
+                t->loss_pct, t->delay_ms, t->pass);
+        return;
+    }
+    if (r->type == RESULT_CONFIG) {
+        // Configuration goes into a comment row so the table stays rectangular
+        const result_config_t* c = &r->config;
+        fprintf(out, "# mode=%s,address=%s,port=%d,packet_size=%d,bandwidth_bps=%ld,streams=%d,"
+                "duration_s=%d,interval_s=%d,engine=%s,batch=%d\n",
+                c->mode, c->address, c->port, c->packet_size, c->bandwidth, c->num_streams,
+                c->duration, c->interval, engine_name(c->engine), c->batch_size);
+        return;
+    }
+    if (!results.csv_header_done) {
+        fprintf(out, "type,side,direction,peer,stream,start_s,end_s,packets,bytes,payload_bytes,lost,corrupt,"
+                "out_of_order,loss_pct,throughput_mbps,goodput_mbps,jitter_ms,jitter_stddev_ms,"
+                "avg_owd_ms,min_owd_ms,max_owd_ms,p50_owd_ms,p99_owd_ms,lost_network,lost_socket,"
+                "lost_cpu,lost_pipeline,rcvbuf_bytes,sndbuf_bytes,sndbuf_errors,ring_overflows,rx_cpu_pct,rx_threads_cpu_pct,"
+                "rx_host_user_pct,rx_host_sys_pct,rx_host_softirq_pct,rx_bytes_per_cpu_s,tx_cpu_pct,"
+                "tx_threads_cpu_pct,tx_host_user_pct,tx_host_sys_pct,tx_host_softirq_pct,"
+                "tx_bytes_per_cpu_s\n");
+        results.csv_header_done = 1;
+    }
+    const result_metrics_t* m = &r->metrics;
+    fprintf(out, "%s,%s,%s,%s,%d,%.3f,%.3f,%lu,%lu,%lu,%lu,%lu,%lu,%.4f,%.3f,%.3f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,"
+            "%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu",
+            type_name(r->type), m->side, m->direction, m->peer, m->stream_id,
+            m->start_s, m->end_s,
+            m->packets, m->bytes, m->payload_bytes, m->lost, m->corrupt, m->out_of_order,
+            m->loss_pct, m->throughput_mbps, m->goodput_mbps, m->jitter_ms, m->jitter_stddev_ms,
+            m->avg_owd_ms, m->min_owd_ms, m->max_owd_ms, m->p50_owd_ms, m->p99_owd_ms,
+            m->lost_network, m->lost_socket, m->lost_cpu, m->lost_pipeline, m->rcvbuf_bytes,
+            m->sndbuf_bytes, m->sndbuf_errors, m->ring_overflows);
+    write_csv_cpu(out, &m->rx_cpu);
+    write_csv_cpu(out, &m->tx_cpu);
+    fprintf(out, "\n");
+}
+
+// Writer thread: formats queued records until stopped and drained
+static void* results_writer(void* unused) {
+    (void)unused;
+    pthread_mutex_lock(&results.mutex);
+    while (results.running || results.count > 0) {
+        if (results.count == 0) {
+            pthread_cond_wait(&results.not_empty, &results.mutex);
+            continue;
+        }
+        result_record_t record = results.ring[results.head];
+        results.head = (results.head + 1) % RESULTS_QUEUE_DEPTH;
+        results.count--;
+        pthread_cond_signal(&results.not_full);
+        pthread_mutex_unlock(&results.mutex);
+
+        switch (results.format) {
+            case OUTPUT_JSON: write_json(results.out, &record); break;
+            case OUTPUT_CSV:  write_csv(results.out, &record); break;
+            default:          write_text(results.out, &record); break;
+        }
+        fflush(results.out);
+
+        pthread_mutex_lock(&results.mutex);
+    }
+    pthread_mutex_unlock(&results.mutex);
+    return NULL;
+}
+
+int results_start(const struct arguments* args) {
+    FILE* out = stdout;
+    if (args->results_file) {
+        out = fopen(args->results_file, "w");
+        if (!out) {
+            perror("Error: Cannot open results file");
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&results.mutex);
+    results.head = 0;
+    results.count = 0;
+    results.format = args->output_format;
+    results.measure_delay = args->measure_delay;
+    results.csv_header_done = 0;
+    results.csv_trial_header_done = 0;
+    results.csv_latency_header_done = 0;
+    results.csv_transact_header_done = 0;
+    results.csv_flows_header_done = 0;
+    results.csv_adapt_header_done = 0;
+    results.csv_impair_header_done = 0;
+    results.out = out;
+    results.running = 1;
+    pthread_mutex_unlock(&results.mutex);
+
+    if (pthread_create(&results.thread, NULL, results_writer, NULL) != 0) {
+        perror("Error: Cannot start results writer");
+        results.running = 0;
+        if (out != stdout) fclose(out);
+        return -1;
+    }
+    return 0;
+}
+
+void results_emit(const result_record_t* record) {
+    pthread_mutex_lock(&results.mutex);
+    while (results.running && results.count == RESULTS_QUEUE_DEPTH) {
+        pthread_cond_wait(&results.not_full, &results.mutex);
+    }
+    if (results.running) {
+        int tail = (results.head + results.count) % RESULTS_QUEUE_DEPTH;
+        results.ring[tail] = *record;
+        results.count++;
+        pthread_cond_signal(&results.not_empty);
+    }
+    pthread_mutex_unlock(&results.mutex);
+}
+
+void results_emit_config(const struct arguments* args) {
+    result_record_t record = {.type = RESULT_CONFIG};
+    result_config_t* c = &record.config;
+    snprintf(c->mode, sizeof(c->mode), "%s", args->is_server ? "server" : "client");
+    snprintf(c->address, sizeof(c->address), "%s", args->ip_address ? args->ip_address : "0.0.0.0");
+    c->port = args->port;
+    c->packet_size = args->packet_size;
+    c->bandwidth = args->bandwidth;
+    c->num_streams = args->num_streams;
+    c->duration = args->duration;
+    c->interval = args->interval;
+    c->engine = args->engine;
+    c->batch_size = args->batch_size;
+    results_emit(&record);
+}
+
+void results_emit_summary(const experiment_stats_t* stats, const char* direction, const char* peer) {
+    result_record_t record = {.type = RESULT_SUMMARY};
+    result_metrics_t* m = &record.metrics;
+    m->side = "receiver";
+    m->direction = direction;
+    if (peer) snprintf(m->peer, sizeof(m->peer), "%s", peer);
+    m->stream_id = -1;
+    m->start_s = 0.0;
+    m->end_s = stats->duration_sec;
+    m->packets = stats->total_packets;
+    m->bytes = stats->total_bytes;
+    m->payload_bytes = stats->payload_bytes;
+    m->lost = stats->lost_packets;
+    m->corrupt = stats->corrupt_packets;
+    m->out_of_order = stats->out_of_order;
+    m->loss_pct = stats->expected_packets > 0 ? 100.0 * stats->lost_packets / stats->expected_packets : 0.0;
+    m->throughput_mbps = stats->throughput_mbps;
+    m->goodput_mbps = stats->goodput_mbps;
+    m->jitter_ms = stats->jitter_ms;
+    m->jitter_stddev_ms = stats->jitter_stddev_ms;
+    m->avg_owd_ms = stats->avg_owd_ms;
+    m->min_owd_ms = stats->min_owd_ms;
+    m->max_owd_ms = stats->max_owd_ms;
+    m->p50_owd_ms = stats->owd_p50_ms;
+    m->p99_owd_ms = stats->owd_p99_ms;
+    m->rcvbuf_bytes = stats->rcvbuf_bytes;
+    m->sndbuf_bytes = stats->sndbuf_bytes;
+    m->sndbuf_errors = stats->sndbuf_errors;
+    m->rx_cpu = stats->rx_cpu;
+    m->tx_cpu = stats->tx_cpu;
+
+    // Split the loss by cause: records the receiver captured but could not
+    // analyze, drops the socket itself reported, then input backlog drops on
+    // the receiving host, and whatever remains was lost on the way
+    uint64_t pipeline = stats->ring_overflows;
+    if (pipeline > m->lost) pipeline = m->lost;
+    uint64_t socket = stats->socket_drops > stats->rcvbuf_errors ? stats->socket_drops : stats->rcvbuf_errors;
+    if (socket > m->lost - pipeline) socket = m->lost - pipeline;
+    uint64_t cpu = stats->backlog_drops;
+    if (cpu > m->lost - pipeline - socket) cpu = m->lost - pipeline - socket;
+    m->ring_overflows = stats->ring_overflows;
+    m->lost_pipeline = pipeline;
+    m->lost_socket = socket;
+    m->lost_cpu = cpu;
+    m->lost_network = m->lost - pipeline - socket - cpu;
+    results_emit(&record);
+}
+
+void results_stop(void) {
+    pthread_mutex_lock(&results.mutex);
+    if (!results.running) {
+        pthread_mutex_unlock(&results.mutex);
+        return;
+    }
+    results.running = 0;
+    pthread_cond_broadcast(&results.not_empty);
+    pthread_cond_broadcast(&results.not_full);
+    pthread_mutex_unlock(&results.mutex);
+
+    pthread_join(results.thread, NULL);
+    if (results.out != stdout) fclose(results.out);
+    results.out = NULL;
+}
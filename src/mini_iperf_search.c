@@ -0,0 +1,85 @@
+/*
+ * mini_iperf_search.c
+ *
+ * Maximum lossless rate search in the spirit of RFC 2544. Short trials are
+ * run back to back over the existing control connection, and the offered
+ * rate is bisected between 0 and -b until the highest passing rate is known
+ * to within SEARCH_RESOLUTION of -b.
+ *
+ * A trial passes when the loss seen by the receiver, relative to what the
+ * sender sent, is at most -L percent and, if -Q is given, the chosen OWD
+ * percentile is at most the limit above the trial's minimum OWD. Using the
+ * delay above the minimum (the queueing delay) keeps the check meaningful
+ * when the two hosts' clocks are not synchronized.
+ */
+#include "mini_iperf.h"
+
+#define SEARCH_TRIAL_SECONDS 2    // Trial duration when -t is not given
+#define SEARCH_MAX_TRIALS 20
+#define SEARCH_RESOLUTION 0.01    // Stop when the bracket is within 1% of -b
+
+extern volatile sig_atomic_t stop_flag;
+
+// Delay percentile above the minimum OWD requested by -Q
+static double queueing_delay_ms(const struct arguments* args, const experiment_stats_t* stats) {
+    double owd;
+    if (args->search_delay_pct == 50) owd = stats->owd_p50_ms;
+    else if (args->search_delay_pct == 90) owd = stats->owd_p90_ms;
+    else if (args->search_delay_pct == 99) owd = stats->owd_p99_ms;
+    else owd = stats->owd_p999_ms;
+    return owd - stats->min_owd_ms;
+}
+
+int rate_search(struct arguments* args) {
+    const long max_rate = args->bandwidth;
+    long passed = 0;          // Highest rate known to pass
+    long failed = max_rate;   // Lowest rate known to fail (or not yet tried)
+    long rate = max_rate;
+    result_record_t best = {.type = RESULT_SEARCH};
+    best.trial.trial = -1;
+
+    if (args->duration <= 0) args->duration = SEARCH_TRIAL_SECONDS;
+
+    for (int trial = 1; trial <= SEARCH_MAX_TRIALS && stop_flag; trial++) {
+        experiment_stats_t stats;
+        args->bandwidth = rate;
+        if (client_run_trial(&stats, NULL) < 0) {
+            fprintf(stderr, "Error: Rate search aborted\n");
+            args->bandwidth = max_rate;
+            return -1;
+        }
+
+        result_record_t record = {.type = RESULT_TRIAL};
+        result_trial_t* t = &record.trial;
+        t->trial = trial;
+        t->offered_mbps = rate / 1e6;
+        t->received_mbps = stats.throughput_mbps;
+        t->sent_packets = udp_stats.sent_packets;
+        t->received_packets = stats.total_packets;
+        t->loss_pct = t->sent_packets > t->received_packets ?
+                      100.0 * (t->sent_packets - t->received_packets) / t->sent_packets : 0.0;
+        t->delay_ms = args->search_delay_pct > 0 ? queueing_delay_ms(args, &stats) : 0.0;
+        t->pass = t->loss_pct <= args->search_loss &&
+                  (args->search_delay_pct == 0 || t->delay_ms <= args->search_delay_ms);
+        results_emit(&record);
+
+        if (t->pass) {
+            passed = rate;
+            best.trial = *t;
+            best.trial.trial = -1;
+            if (rate == max_rate) break;  // Even the highest rate is sustainable
+        } else {
+            failed = rate;
+        }
+        if (failed - passed <= max_rate * SEARCH_RESOLUTION) break;
+
+        rate = passed + (failed - passed) / 2;
+        if (rate <= 0) break;  // 0 would mean an unlimited sender
+    }
+
+    // Report the maximum sustainable rate (0 if no trial passed)
+    best.trial.offered_mbps = passed / 1e6;
+    results_emit(&best);
+    args->bandwidth = max_rate;
+    return 0;
+}
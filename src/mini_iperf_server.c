@@ -17,8 +17,47 @@
 int server_socket=-1;
 extern volatile sig_atomic_t stop_flag;
 extern pthread_t udp_receiver_thread;
+extern pthread_t udp_sender_thread;
 extern struct arguments args;
 
+// One control connection; its two channel threads share it
+typedef struct {
+  int sock;
+  atomic_uint feedback_us;              // MSG_INTERIM interval requested by the client (0: off)
+  atomic_int closed;
+  pthread_mutex_t mutex;                // One message at a time on the socket
+  pthread_t recv_thread, send_thread;
+  pthread_t sender_thread;              // Server-to-client streams
+  // Server-to-client streams of a reverse or duplex test: the spec's
+  // parameters, aimed at the client's address and data ports
+  struct arguments reverse_args;
+  char peer_address[INET_ADDRSTRLEN];
+  char label[INET_ADDRSTRLEN + 6];      // address:port of the client
+  int sources;                          // -I sources of the client's test (0: none)
+} server_session_t;
+
+// Client-to-server streams of a run: those of one client, or with -N those
+// of every client on one set of receivers. Each client's streams get their
+// own range of data ports, in the order the clients sent MSG_START_EXP.
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int expected;                         // Clients of a run (-N)
+  int joined;                           // Clients that sent MSG_START_EXP
+  int finished;                         // Clients that sent MSG_STOP_EXP or left
+  int collected;                        // Clients that took their statistics
+  int state;                            // RUN_*
+  struct arguments args;                // Receivers of the run
+  server_session_t* sessions[MAX_CLIENTS];  // In join order
+  experiment_stats_t stats;             // Whole run
+  char error[256];
+} run = {.mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .expected = 1};
+
+enum {RUN_IDLE, RUN_RECEIVING, RUN_FAILED, RUN_DONE};
+
+#define RECEIVER_SETUP_TIMEOUT_NS 2000000000ULL  // Time the receivers get to bind before MSG_ERROR
+#define RUN_JOIN_TIMEOUT_S 30   // Time the clients of an incast run get to send MSG_START_EXP
+
 int server_start(const char* ip, int port) {
     // Create a socket for the server
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -104,14 +143,169 @@ int server_close(int server_socket) {
 }
 
 
-void* server_channel_recv(void* client_socket) {
-    int sock = *(int*)client_socket;
+static int session_send(server_session_t* session, uint8_t type, const void* payload, uint32_t len) {
+    pthread_mutex_lock(&session->mutex);
+    const int rc = send_tcp_message(session->sock, type, payload, len);
+    pthread_mutex_unlock(&session->mutex);
+    return rc;
+}
+
+// Run the server's senders, then hand their side of the report to the client
+static void* server_sender_main(void* session_ptr) {
+    server_session_t* session = session_ptr;
+    udp_sendto(&session->reverse_args);
+
+    experiment_stats_t stats = {0};
+    stats.sndbuf_bytes = udp_stats.sndbuf_bytes;
+    stats.sndbuf_errors = udp_stats.host.sndbuf_errors;
+    stats.tx_cpu = udp_stats.tx_cpu;
+    experiment_stats_swap(&stats);
+    session_send(session, MSG_SEND_DONE, &stats, sizeof(stats));
+    return NULL;
+}
+
+// Add a client's streams to the run. The last client to join starts the
+// receivers for all of them; the others wait for it (or for the join
+// timeout). On success *data_port is the client's first data port.
+static int run_join(server_session_t* session, const struct arguments* client_args, int* data_port,
+                    char* error, size_t error_size) {
+    const int incast = run.expected > 1;
+    if (incast && (client_args->engine == ENGINE_EVENT || client_args->direction != DIRECTION_FORWARD ||
+                   client_args->transactions > 0 || client_args->feedback_ms > 0 ||
+                   client_args->num_sources > 1)) {
+        snprintf(error, error_size, "an incast run (-N) takes client-to-server streams of the sendto "
+                 "or mmsg engine, without -T, -A or -I");
+        return -1;
+    }
+
+    pthread_mutex_lock(&run.mutex);
+    while (run.state != RUN_IDLE) pthread_cond_wait(&run.cond, &run.mutex);
+
+    // An incast run's receivers use our own data ports, one range per client
+    const int first_port = incast ? args.data_port : client_args->data_port;
+    const int streams = (run.joined == 0 ? 0 : run.args.num_streams) + client_args->num_streams;
+    if (incast && (run.joined == MAX_CLIENTS || first_port + streams - 1 > 65535 ||
+                   (first_port <= args.port && args.port < first_port + streams))) {
+        snprintf(error, error_size, "data ports %d-%d are not usable", first_port, first_port + streams - 1);
+        pthread_mutex_unlock(&run.mutex);
+        return -1;
+    }
+    const int group = run.joined++;
+    if (group == 0) {
+        run.args = *client_args;
+        run.args.data_port = first_port;
+    }
+    *data_port = first_port + streams - client_args->num_streams;
+    run.args.num_streams = streams;
+    run.sessions[group] = session;
+    udp_stats.group_streams[group] = client_args->num_streams;
+
+    if (run.joined == run.expected) {
+        udp_stats.groups = incast ? run.joined : 0;
+        // A single client's streams leave from its -I sources in blocks
+        if (!incast && run.args.num_sources > 1) {
+            udp_stats.groups = run.args.num_sources;
+            memset(udp_stats.group_streams, 0, sizeof(udp_stats.group_streams));
+            for (int i = 0; i < streams; i++) {
+                udp_stats.group_streams[stream_source(i, streams, run.args.num_sources)]++;
+            }
+        }
+        stop_flag=1;
+        run.state = RUN_RECEIVING;
+        if (pthread_create(&udp_receiver_thread, NULL, udp_recv, (void*)&run.args) != 0) {
+            snprintf(run.error, sizeof(run.error), "cannot start the receiver");
+            run.state = RUN_FAILED;
+        } else if (udp_receivers_ready(RECEIVER_SETUP_TIMEOUT_NS) != 0) {
+            snprintf(run.error, sizeof(run.error), "cannot bind data ports %d-%d", run.args.data_port,
+                     run.args.data_port + (run.args.engine == ENGINE_EVENT ? 0 : run.args.num_streams - 1));
+            stop_flag=0;
+            pthread_join(udp_receiver_thread, NULL);
+            run.state = RUN_FAILED;
+        }
+        pthread_cond_broadcast(&run.cond);
+    } else {
+        printf("Waiting for %d more client(s) to start\n", run.expected - run.joined);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += RUN_JOIN_TIMEOUT_S;
+        while (run.state == RUN_IDLE) {
+            if (pthread_cond_timedwait(&run.cond, &run.mutex, &deadline) == ETIMEDOUT &&
+                run.state == RUN_IDLE) {
+                snprintf(run.error, sizeof(run.error), "only %d of %d clients started the test",
+                         run.joined, run.expected);
+                run.state = RUN_FAILED;
+                pthread_cond_broadcast(&run.cond);
+            }
+        }
+    }
+
+    // The clients of a failed run leave it one by one
+    const int failed = run.state == RUN_FAILED;
+    if (failed) {
+        snprintf(error, error_size, "%s", run.error);
+        if (--run.joined == 0) {
+            run.state = RUN_IDLE;
+            pthread_cond_broadcast(&run.cond);
+        }
+    }
+    pthread_mutex_unlock(&run.mutex);
+    return failed ? -1 : 0;
+}
+
+// A client is done with the run (MSG_STOP_EXP or gone). Once every client
+// is, the receivers are stopped and the run reported. *stats is the
+// client's share of the run (all of it when it is the only client).
+static void run_finish(server_session_t* session, experiment_stats_t* stats) {
+    pthread_mutex_lock(&run.mutex);
+    if (++run.finished == run.joined) {
+        // Wait for the receivers so their report and trace are complete
+        stop_flag=0;
+        pthread_join(udp_receiver_thread, NULL);
+        udp_get_experiment_stats(&run.stats);
+        if (run.joined > 1) {
+            for (int g = 0; g < run.joined; g++) {
+                results_emit_summary(&udp_stats.group_stats[g], "client-to-server", run.sessions[g]->label);
+            }
+            results_emit_summary(&run.stats, "client-to-server", "aggregate");
+        } else if (udp_stats.groups > 1) {
+            for (int g = 0; g < udp_stats.groups; g++) {
+                char label[32];
+                snprintf(label, sizeof(label), "source %d", g + 1);
+                results_emit_summary(&udp_stats.group_stats[g], "client-to-server", label);
+            }
+            results_emit_summary(&run.stats, "client-to-server", "aggregate");
+        } else {
+            results_emit_summary(&run.stats, "client-to-server", NULL);
+        }
+        run.state = RUN_DONE;
+        pthread_cond_broadcast(&run.cond);
+    }
+    while (run.state != RUN_DONE) pthread_cond_wait(&run.cond, &run.mutex);
+
+    *stats = run.stats;
+    for (int g = 0; run.joined > 1 && g < run.joined; g++) {
+        if (run.sessions[g] == session) *stats = udp_stats.group_stats[g];
+    }
+    if (++run.collected == run.joined) {
+        run.joined = run.finished = run.collected = 0;
+        run.state = RUN_IDLE;
+        pthread_cond_broadcast(&run.cond);
+    }
+    pthread_mutex_unlock(&run.mutex);
+}
+
+void* server_channel_recv(void* session_ptr) {
+    server_session_t* session = session_ptr;
+    int sock = session->sock;
     tcp_header_t header;
     int64_t clock_offset = 0;
+    int receiving = 0;                  // Client-to-server streams running
+    int sending = 0;                    // Server-to-client streams running
+    experiment_stats_t stats;
 
     while (1) {
         // Receive header
-        if (recv(sock, &header, sizeof(header), MSG_WAITALL) <= 0) {
+        if (recv_tcp_header(sock, &header) != 0) {
             break; // Client disconnected
         }
 
@@ -119,19 +313,100 @@ void* server_channel_recv(void* client_socket) {
             case MSG_SYNC: {
                 // Clock synchronization
                 uint64_t t2 = get_monotonic_time();
-                send_tcp_message(sock, MSG_SYNC_RESP, &header.timestamp_ns, sizeof(uint64_t));
+                const uint64_t t1 = htobe64(header.timestamp_ns);
+                session_send(session, MSG_SYNC_RESP, &t1, sizeof(t1));
                 break;
             }
             
             case MSG_START_EXP: {
-                printf("Experiment started by client\n");
-                pthread_create(&udp_receiver_thread, NULL, udp_recv, (void*)&args);
+                printf("Experiment started by client %s\n", session->label);
+                // The payload is the client's test spec; the receivers and
+                // senders are sized from it, and the client only starts
+                // sending once the receivers are bound (MSG_ACK, with the
+                // data ports to use) or the spec was refused (MSG_ERROR)
+                uint8_t spec[MAX_CONTROL_PAYLOAD];
+                if (recv(sock, spec, header.payload_len, MSG_WAITALL) != (ssize_t)header.payload_len) break;
+                char error[256];
+                if (receiving || sending) {
+                    snprintf(error, sizeof(error), "test already running");
+                    session_send(session, MSG_ERROR, error, strlen(error));
+                    break;
+                }
+
+                struct arguments client_args = args;
+                if (test_spec_apply(spec, header.payload_len, &client_args, error, sizeof(error)) != 0) {
+                    fprintf(stderr, "Error: Rejected test spec: %s\n", error);
+                    session_send(session, MSG_ERROR, error, strlen(error));
+                    break;
+                }
+                int failed = 0;
+                int data_port = client_args.data_port;
+                if (client_args.direction != DIRECTION_REVERSE) {
+                    failed = run_join(session, &client_args, &data_port, error, sizeof(error)) != 0;
+                    receiving = !failed;
+                }
+                // The client bound its receivers before sending the spec
+                session->sources = client_args.num_sources > 1 && run.expected == 1 ?
+                                   client_args.num_sources : 0;
+                if (!failed && client_args.direction != DIRECTION_FORWARD) {
+                    session->reverse_args = client_args;
+                    session->reverse_args.ip_address = session->peer_address;
+                    session->reverse_args.data_port = reverse_data_port(&client_args);
+                    session->reverse_args.num_sources = 0;  // Ours leave as the kernel routes them
+                    if (!receiving) stop_flag=1;
+                    if (pthread_create(&session->sender_thread, NULL, server_sender_main, session) != 0) {
+                        snprintf(error, sizeof(error), "cannot start the sender");
+                        failed = 1;
+                        if (receiving) {
+                            run_finish(session, &stats);
+                            receiving = 0;
+                        }
+                    } else {
+                        sending = 1;
+                    }
+                }
+                if (receiving) atomic_store(&session->feedback_us, client_args.feedback_ms * 1000);
+                if (!failed) {
+                    start_ack_t ack = {.data_port = htons(data_port), .clients = htons(run.expected)};
+                    session_send(session, MSG_ACK, &ack, sizeof(ack));
+                } else {
+                    fprintf(stderr, "Error: Test not started: %s\n", error);
+                    session_send(session, MSG_ERROR, error, strlen(error));
+                }
                 break;
             }
             
             case MSG_STOP_EXP: {
-                printf("Experiment stopped by client\n");
-                stop_flag=0;
+                printf("Experiment stopped by client %s\n", session->label);
+                atomic_store(&session->feedback_us, 0);
+                if (sending) stop_flag=0;
+                if (receiving) {
+                    run_finish(session, &stats);
+                    receiving = 0;
+                    // Share the final statistics so both ends report the same summary,
+                    // followed by those of each -I source of the client
+                    experiment_stats_t reports[1 + MAX_SOURCES];
+                    reports[0] = stats;
+                    for (int i = 0; i < session->sources; i++) reports[1 + i] = udp_stats.group_stats[i];
+                    for (int i = 0; i <= session->sources; i++) experiment_stats_swap(&reports[i]);
+                    session_send(session, MSG_STATS, reports, (1 + session->sources) * sizeof(stats));
+                }
+                if (sending) {
+                    pthread_join(session->sender_thread, NULL);
+                    sending = 0;
+                }
+                break;
+            }
+
+            case MSG_STATS: {
+                // The client's report of the server-to-client streams
+                if (header.payload_len != sizeof(stats) ||
+                    recv(sock, &stats, sizeof(stats), MSG_WAITALL) != sizeof(stats)) {
+                    fprintf(stderr, "Error: Malformed statistics report\n");
+                    goto disconnected;
+                }
+                experiment_stats_swap(&stats);
+                results_emit_summary(&stats, "server-to-client", NULL);
                 break;
             }
             
@@ -140,22 +415,103 @@ void* server_channel_recv(void* client_socket) {
         }
     }
     
-    printf("Client disconnected\n");
+disconnected:
+    atomic_store(&session->feedback_us, 0);
+    atomic_store(&session->closed, 1);
+    if (sending) stop_flag=0;
+    if (receiving) run_finish(session, &stats);
+    if (sending) pthread_join(session->sender_thread, NULL);
+    printf("Client %s disconnected\n", session->label);
     return NULL;
 }
 
-void* server_channel_send(void* client_socket) {
-    // This thread can now be used for:
-    // 1. Periodic statistics reporting
-    // 2. Unsolicited server notifications
-    // 3. Keepalive messages
-    
-    int sock = *(int*)client_socket;
-    
-    while (1) {
-        sleep(1); // Example: Send periodic updates every second
-        // You can add periodic reporting here if needed
+void* server_channel_send(void* session_ptr) {
+    // Interim feedback for the client's adaptive rate controller: the
+    // packets, gaps and mean one-way delay of every interval it asked for
+    server_session_t* session = session_ptr;
+    udp_live_t last = {0};
+    uint32_t seq = 0;
+    uint64_t last_ns = 0;
+
+    while (!atomic_load(&session->closed)) {
+        const uint32_t interval_us = atomic_load(&session->feedback_us);
+        udp_live_t now;
+        if (interval_us == 0 || udp_live_totals(&now) != 0) {
+            // Nothing asked for or no receiver yet: start the next run afresh
+            last_ns = 0;
+            usleep(10000);
+            continue;
+        }
+        const uint64_t now_ns = get_monotonic_time();
+        if (last_ns == 0 || now.packets < last.packets) {
+            last = now;
+            last_ns = now_ns;
+            usleep(interval_us);
+            continue;
+        }
+
+        interim_report_t report = {
+            .seq = seq++,
+            .interval_us = (now_ns - last_ns) / 1000,
+            .packets = now.packets - last.packets,
+            .lost = now.lost - last.lost
+        };
+        if (report.packets > 0) {
+            report.owd_avg_ns = (int64_t)(now.owd_sum_ns - last.owd_sum_ns) / (int64_t)report.packets;
+        }
+        last = now;
+        last_ns = now_ns;
+        interim_report_swap(&report);
+
+        if (session_send(session, MSG_INTERIM, &report, sizeof(report)) < 0) break;
+        usleep(interval_us);
     }
-    
     return NULL;
-}
\ No newline at end of file
+}
+
+int server_serve(int server_socket, int clients) {
+    server_session_t* sessions = calloc(clients, sizeof(server_session_t));
+    if (!sessions) {
+        perror("Error: Memory allocation failed for client sessions");
+        return -1;
+    }
+    run.expected = clients;
+
+    int accepted = 0;
+    while (accepted < clients) {
+        server_session_t* session = &sessions[accepted];
+        session->sock = server_accept(server_socket);
+        if (session->sock < 0) break;
+
+        // The reverse streams go to the address the client connected from
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        if (getpeername(session->sock, (struct sockaddr*)&peer, &peer_len) != 0 ||
+            !inet_ntop(AF_INET, &peer.sin_addr, session->peer_address, sizeof(session->peer_address))) {
+            snprintf(session->peer_address, sizeof(session->peer_address), "127.0.0.1");
+            peer.sin_port = 0;
+        }
+        snprintf(session->label, sizeof(session->label), "%s:%d", session->peer_address,
+                 ntohs(peer.sin_port));
+        pthread_mutex_init(&session->mutex, NULL);
+        atomic_init(&session->feedback_us, 0);
+        atomic_init(&session->closed, 0);
+        if (clients > 1) printf("Client %d of %d connected from %s\n", accepted + 1, clients, session->label);
+
+        if (pthread_create(&session->recv_thread, NULL, server_channel_recv, session) != 0) {
+            perror("Error: Cannot start the control channel");
+            close(session->sock);
+            break;
+        }
+        pthread_create(&session->send_thread, NULL, server_channel_send, session);
+        accepted++;
+    }
+
+    for (int i = 0; i < accepted; i++) {
+        pthread_join(sessions[i].recv_thread, NULL);
+        pthread_join(sessions[i].send_thread, NULL);
+        close(sessions[i].sock);
+    }
+    free(sessions);
+    return accepted == clients ? 0 : -1;
+}
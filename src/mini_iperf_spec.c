@@ -0,0 +1,179 @@
+/*
+ * mini_iperf_spec.c
+ *
+ * Test spec carried by MSG_START_EXP. The client describes the test it is
+ * about to run (streams, packet sizes, rate, duration, engine, data ports,
+ * direction), and the server checks it and sizes its receivers and senders
+ * from it instead of from its own command line, so the two ends cannot
+ * silently disagree.
+ *
+ * The spec is versioned and length-prefixed: new fields are appended, a
+ * server accepts a longer spec than it knows, and any other version is
+ * rejected with MSG_ERROR.
+ */
+#include "mini_iperf.h"
+
+#define MAX_SPEC_STREAMS 1024      // Thread-per-stream engines
+#define MAX_SPEC_FLOWS 1000000     // Event engine
+#define MAX_SPEC_WORKERS 256
+
+int reverse_data_port(const struct arguments* args) {
+    if (args->direction != DIRECTION_DUPLEX) return args->data_port;
+    return args->data_port + (args->engine == ENGINE_EVENT ? 1 : args->num_streams);
+}
+
+const char* data_direction(const struct arguments* args, const char* side) {
+    const int receiving = strcmp(side, "receiver") == 0;
+    return receiving == (args->is_server != 0) ? "client-to-server" : "server-to-client";
+}
+
+void test_spec_encode(const struct arguments* args, test_spec_t* spec) {
+    // The size distribution may go above -l
+    int max_packet_size = args->packet_size;
+    for (int i = 0; i < args->sizes.count; i++) {
+        if (args->sizes.sizes[i] > max_packet_size) max_packet_size = args->sizes.sizes[i];
+    }
+
+    memset(spec, 0, sizeof(*spec));
+    spec->version = htons(TEST_SPEC_VERSION);
+    spec->length = htons(sizeof(*spec));
+    spec->num_streams = htonl(args->num_streams);
+    spec->packet_size = htonl(args->packet_size);
+    spec->max_packet_size = htonl(max_packet_size);
+    spec->bandwidth = htobe64(args->bandwidth > 0 ? args->bandwidth : 0);
+    spec->duration = (int32_t)htonl(args->duration);
+    spec->engine = htonl(args->engine);
+    spec->batch_size = htonl(args->batch_size);
+    spec->workers = htonl(args->workers);
+    spec->data_port = htons(args->data_port);
+    spec->transactions = htonl(args->transactions);
+    spec->feedback_us = htonl(args->adapt != ADAPT_OFF ? args->feedback_ms * 1000 : 0);
+    spec->direction = htons(args->direction);
+    spec->flags = htonl((args->crc ? SPEC_FLAG_CRC : 0) | (args->verify ? 0 : SPEC_FLAG_NO_VERIFY) |
+                        (args->batch_stamp ? SPEC_FLAG_BATCH_STAMP : 0));
+    spec->sources = htonl(args->num_sources);
+}
+
+int test_spec_apply(const void* data, uint32_t len, struct arguments* args,
+                    char* error, size_t error_size) {
+    test_spec_t spec = {0};
+    if (len < 2 * sizeof(uint16_t)) {
+        snprintf(error, error_size, "test spec of %u bytes is truncated", len);
+        return -1;
+    }
+    memcpy(&spec, data, len < sizeof(spec) ? len : sizeof(spec));
+
+    const uint16_t version = ntohs(spec.version);
+    const uint16_t length = ntohs(spec.length);
+    if (version != TEST_SPEC_VERSION) {
+        snprintf(error, error_size, "test spec version %u is not supported (server speaks %d)",
+                 version, TEST_SPEC_VERSION);
+        return -1;
+    }
+    // Specs from before the source count have none
+    if (length < offsetof(test_spec_t, sources) || length > len) {
+        snprintf(error, error_size, "test spec length %u does not match the %u bytes received",
+                 length, len);
+        return -1;
+    }
+
+    const uint32_t streams = ntohl(spec.num_streams);
+    const uint32_t packet_size = ntohl(spec.packet_size);
+    const uint32_t max_packet_size = ntohl(spec.max_packet_size);
+    const uint64_t bandwidth = be64toh(spec.bandwidth);
+    const int32_t duration = (int32_t)ntohl(spec.duration);
+    const uint32_t engine = ntohl(spec.engine);
+    const uint32_t batch_size = ntohl(spec.batch_size);
+    const uint32_t workers = ntohl(spec.workers);
+    const uint32_t data_port = ntohs(spec.data_port);
+    const uint32_t transactions = ntohl(spec.transactions);
+    const uint32_t feedback_us = ntohl(spec.feedback_us);
+    const uint16_t direction = ntohs(spec.direction);
+    const uint32_t flags = ntohl(spec.flags);
+    const uint32_t sources = length >= sizeof(spec) ? ntohl(spec.sources) : 0;
+
+    const int event = engine == ENGINE_EVENT;
+    if (engine != ENGINE_SENDTO && engine != ENGINE_MMSG && !event) {
+        snprintf(error, error_size, "unknown engine %u", engine);
+        return -1;
+    }
+    if (streams == 0 || streams > (event ? MAX_SPEC_FLOWS : MAX_SPEC_STREAMS)) {
+        snprintf(error, error_size, "%u streams is out of range (1-%d)", streams,
+                 event ? MAX_SPEC_FLOWS : MAX_SPEC_STREAMS);
+        return -1;
+    }
+    if (packet_size <= sizeof(MiniIperfHeader) || max_packet_size < packet_size ||
+        max_packet_size > MAX_PACKET_SIZE) {
+        snprintf(error, error_size, "packet sizes %u-%u are out of range (%zu-%d)",
+                 packet_size, max_packet_size, sizeof(MiniIperfHeader) + 1, MAX_PACKET_SIZE);
+        return -1;
+    }
+    if (batch_size == 0 || batch_size > MAX_BATCH_SIZE) {
+        snprintf(error, error_size, "batch size %u is out of range (1-%d)", batch_size, MAX_BATCH_SIZE);
+        return -1;
+    }
+    if (event && (workers == 0 || workers > MAX_SPEC_WORKERS)) {
+        snprintf(error, error_size, "%u workers is out of range (1-%d)", workers, MAX_SPEC_WORKERS);
+        return -1;
+    }
+    if (direction != DIRECTION_FORWARD && direction != DIRECTION_REVERSE &&
+        direction != DIRECTION_DUPLEX) {
+        snprintf(error, error_size, "unknown direction %u", direction);
+        return -1;
+    }
+    if ((direction != DIRECTION_FORWARD && transactions > 0) ||
+        (direction == DIRECTION_REVERSE && feedback_us != 0)) {
+        snprintf(error, error_size, "transaction mode and adaptive rate need the client to send");
+        return -1;
+    }
+    // The event engine shares one data port between all flows; none may be
+    // the control port, whose number the probe echo responder uses for UDP.
+    // In duplex mode the client's ports for the reverse streams follow ours.
+    const uint32_t ports = event ? 1 : streams;
+    if (data_port == 0 || data_port + (direction == DIRECTION_DUPLEX ? 2 : 1) * ports - 1 > 65535 ||
+        (data_port <= (uint32_t)args->port && (uint32_t)args->port < data_port + ports)) {
+        snprintf(error, error_size, "data ports %u-%u are not usable", data_port, data_port + ports - 1);
+        return -1;
+    }
+    if (transactions > MAX_BATCH_SIZE || (transactions > 0 && event)) {
+        snprintf(error, error_size, "transaction mode with %u outstanding requests is not supported",
+                 transactions);
+        return -1;
+    }
+    if (feedback_us != 0 && (feedback_us < 10000 || feedback_us > 10000000)) {
+        snprintf(error, error_size, "feedback interval of %u us is out of range", feedback_us);
+        return -1;
+    }
+    if ((flags & SPEC_FLAG_NO_VERIFY) && ((flags & SPEC_FLAG_CRC) || event || transactions > 0)) {
+        snprintf(error, error_size, "unverified payloads need the sendto or mmsg engine, without "
+                 "a CRC or transaction mode");
+        return -1;
+    }
+    if (sources > MAX_SOURCES || (sources > 0 && (event || transactions > 0 || sources > streams ||
+                                                  direction == DIRECTION_REVERSE))) {
+        snprintf(error, error_size, "%u sources do not fit the test (at most %d, one stream each, "
+                 "client-to-server streams of the sendto or mmsg engine)", sources, MAX_SOURCES);
+        return -1;
+    }
+    if (duration == 0 || duration < -1) {
+        snprintf(error, error_size, "duration %d is invalid", duration);
+        return -1;
+    }
+
+    args->num_streams = streams;
+    args->packet_size = packet_size;
+    args->bandwidth = bandwidth;
+    args->duration = duration;
+    args->engine = engine;
+    args->batch_size = batch_size;
+    args->workers = event ? (int)(workers < streams ? workers : streams) : args->workers;
+    args->data_port = data_port;
+    args->transactions = transactions;
+    args->feedback_ms = feedback_us / 1000;
+    args->direction = direction;
+    args->crc = (flags & SPEC_FLAG_CRC) != 0;
+    args->verify = (flags & SPEC_FLAG_NO_VERIFY) == 0;
+    args->batch_stamp = (flags & SPEC_FLAG_BATCH_STAMP) != 0;
+    args->num_sources = sources;
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * mini_iperf_sysstat.c
+ *
+ * Host-wide kernel counters sampled before and after a run, used to tell
+ * where packets the receiver never saw were dropped. The counters cover all
+ * UDP traffic of the host, not only this experiment's.
+ *
+ * CPU times of the process and the host are sampled the same way, to tell
+ * whether a run was limited by the host or by the network.
+ */
+#include "mini_iperf.h"
+#include <sys/resource.h>
+
+// Read the counters used here from the "Udp:" table of /proc/net/snmp
+static void read_udp_snmp(host_counters_t* out) {
+    FILE* file = fopen("/proc/net/snmp", "r");
+    if (!file) return;
+
+    char names[512], values[512];
+    while (fgets(names, sizeof(names), file)) {
+        if (strncmp(names, "Udp:", 4) != 0) continue;
+        // The first "Udp:" line holds the column names, the second the values
+        if (!fgets(values, sizeof(values), file)) break;
+
+        char* name_save = NULL;
+        char* value_save = NULL;
+        char* name = strtok_r(names + 4, " \n", &name_save);
+        char* value = strtok_r(values + 4, " \n", &value_save);
+        while (name && value) {
+            const uint64_t v = strtoull(value, NULL, 10);
+            if (strcmp(name, "InDatagrams") == 0) out->in_datagrams = v;
+            else if (strcmp(name, "InErrors") == 0) out->in_errors = v;
+            else if (strcmp(name, "RcvbufErrors") == 0) out->rcvbuf_errors = v;
+            else if (strcmp(name, "SndbufErrors") == 0) out->sndbuf_errors = v;
+            name = strtok_r(NULL, " \n", &name_save);
+            value = strtok_r(NULL, " \n", &value_save);
+        }
+        break;
+    }
+    fclose(file);
+}
+
+// Sum the per-CPU input backlog drops (second column, hexadecimal)
+static void read_softnet(host_counters_t* out) {
+    FILE* file = fopen("/proc/net/softnet_stat", "r");
+    if (!file) return;
+
+    char line[512];
+    unsigned int processed, dropped;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%x %x", &processed, &dropped) == 2) out->backlog_drops += dropped;
+    }
+    fclose(file);
+}
+
+void host_counters_sample(host_counters_t* out) {
+    memset(out, 0, sizeof(*out));
+    read_udp_snmp(out);
+    read_softnet(out);
+}
+
+// Aggregate "cpu" line of /proc/stat, in clock ticks
+static void read_proc_stat(cpu_sample_t* out) {
+    FILE* file = fopen("/proc/stat", "r");
+    if (!file) return;
+
+    uint64_t user, nice, system, idle, iowait, irq, softirq, steal;
+    if (fscanf(file, "cpu %lu %lu %lu %lu %lu %lu %lu %lu",
+               &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) == 8) {
+        out->host_user = user + nice;
+        out->host_sys = system + irq;
+        out->host_softirq = softirq;
+        out->host_total = user + nice + system + idle + iowait + irq + softirq + steal;
+    }
+    fclose(file);
+}
+
+void cpu_sample(cpu_sample_t* out) {
+    memset(out, 0, sizeof(*out));
+    out->wall_ns = get_monotonic_time();
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        out->process_ns = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL +
+                          (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+    }
+    read_proc_stat(out);
+}
+
+void cpu_report(const cpu_sample_t* before, const cpu_sample_t* after, uint64_t threads_ns,
+                uint64_t bytes, cpu_report_t* out) {
+    memset(out, 0, sizeof(*out));
+    const double wall_ns = after->wall_ns - before->wall_ns;
+    const uint64_t process_ns = after->process_ns - before->process_ns;
+    if (wall_ns > 0) {
+        out->cpu_pct = 100.0 * process_ns / wall_ns;
+        out->threads_cpu_pct = 100.0 * threads_ns / wall_ns;
+    }
+    if (process_ns > 0) out->bytes_per_cpu_s = bytes * 1e9 / process_ns;
+
+    const uint64_t ticks = after->host_total - before->host_total;
+    if (ticks > 0) {
+        out->host_user_pct = 100.0 * (after->host_user - before->host_user) / ticks;
+        out->host_sys_pct = 100.0 * (after->host_sys - before->host_sys) / ticks;
+        out->host_softirq_pct = 100.0 * (after->host_softirq - before->host_softirq) / ticks;
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * mini_iperf_trace.c
+ *
+ * Binary per-packet trace (-f). The trace file is preallocated and mapped
+ * into memory before the experiment starts, so receiver threads only copy
+ * records into page cache and never wait on disk. Each thread claims chunks
+ * of TRACE_CHUNK_RECORDS slots with one atomic add and fills them without
+ * any locking. The file is read back by mini_iperf_analyze.
+ */
+#include "mini_iperf.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+int trace_open(trace_writer_t* writer, const char* filename, uint64_t capacity, int num_streams) {
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+
+    // Round up to whole chunks so every claim is either complete or refused
+    capacity = (capacity + TRACE_CHUNK_RECORDS - 1) / TRACE_CHUNK_RECORDS * TRACE_CHUNK_RECORDS;
+    const size_t size = TRACE_HEADER_SIZE + capacity * sizeof(trace_record_t);
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error: Cannot create trace file");
+        return -1;
+    }
+    // Reserve the blocks up front so page writeback never has to allocate
+    int rc = posix_fallocate(fd, 0, size);
+    if (rc != 0) {
+        fprintf(stderr, "Error: Cannot preallocate trace file: %s\n", strerror(rc));
+        close(fd);
+        return -1;
+    }
+    char* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Error: Cannot map trace file");
+        close(fd);
+        return -1;
+    }
+
+    trace_file_header_t* header = (trace_file_header_t*)map;
+    memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+    header->version = TRACE_VERSION;
+    header->record_size = sizeof(trace_record_t);
+    header->num_streams = num_streams;
+    header->start_ns = get_monotonic_time();
+
+    writer->fd = fd;
+    writer->map = map;
+    writer->map_size = size;
+    writer->capacity = capacity;
+    atomic_init(&writer->cursor, 0);
+    atomic_init(&writer->dropped, 0);
+    return 0;
+}
+
+void trace_buffer_init(trace_buffer_t* buffer, trace_writer_t* writer) {
+    buffer->writer = writer;
+    buffer->next = NULL;
+    buffer->end = NULL;
+    buffer->dropped = 0;
+}
+
+// Claim a new chunk of slots; returns 0 if the file is full
+static int trace_refill(trace_buffer_t* buffer) {
+    trace_writer_t* writer = buffer->writer;
+    uint64_t slot = atomic_fetch_add_explicit(&writer->cursor, TRACE_CHUNK_RECORDS,
+                                              memory_order_relaxed);
+    if (slot >= writer->capacity) {
+        buffer->next = buffer->end = NULL;
+        return 0;
+    }
+    buffer->next = (trace_record_t*)(writer->map + TRACE_HEADER_SIZE) + slot;
+    buffer->end = buffer->next + TRACE_CHUNK_RECORDS;
+    return 1;
+}
+
+void trace_log(trace_buffer_t* buffer, uint32_t stream_id, uint64_t seq,
+               uint64_t tx_ts, uint64_t rx_ts, uint16_t size, uint16_t flags) {
+    if (!buffer->writer) return;
+    if (buffer->next == buffer->end && !trace_refill(buffer)) {
+        buffer->dropped++;
+        return;
+    }
+    trace_record_t* record = buffer->next++;
+    record->seq = seq;
+    record->tx_ts = tx_ts;
+    record->rx_ts = rx_ts;
+    record->stream_id = stream_id;
+    record->size = size;
+    record->flags = flags | TRACE_FLAG_VALID;
+}
+
+void trace_buffer_release(trace_buffer_t* buffer) {
+    if (buffer->writer && buffer->dropped > 0) {
+        atomic_fetch_add(&buffer->writer->dropped, buffer->dropped);
+    }
+    trace_buffer_init(buffer, NULL);
+}
+
+void trace_close(trace_writer_t* writer) {
+    if (!writer->map) return;
+
+    uint64_t slots = atomic_load(&writer->cursor);
+    if (slots > writer->capacity) slots = writer->capacity;
+    const uint64_t dropped = atomic_load(&writer->dropped);
+
+    trace_file_header_t* header = (trace_file_header_t*)writer->map;
+    header->record_slots = slots;
+    header->dropped_records = dropped;
+
+    munmap(writer->map, writer->map_size);
+    if (ftruncate(writer->fd, TRACE_HEADER_SIZE + slots * sizeof(trace_record_t)) < 0) {
+        perror("Warning: Cannot trim trace file");
+    }
+    close(writer->fd);
+
+    if (dropped > 0) {
+        fprintf(stderr, "Warning: Trace file full, %lu records dropped\n", dropped);
+    }
+    writer->map = NULL;
+    writer->fd = -1;
+}
@@ -1,17 +1,12 @@
 #include "mini_iperf.h"
 
 
-#define MAX_PACKET_SIZE 1460  // MTU-safe max size
-#define BATCH_SIZE 32
 #define NS_PER_SEC 1000000000L
+#define RXQ_CONTROL_SIZE CMSG_SPACE(sizeof(uint32_t))  // Room for the SO_RXQ_OVFL counter
+#define PACING_BURST_NS 10000000ULL // Senders lagging behind the bucket catch up at most 10ms
+#define STREAM_START_LEAD_NS 20000000ULL // Setup time of the sender threads before their shared start
+#define FORCE_INLINE static inline __attribute__((always_inline)) // Bodies of the specialized loops
 extern volatile sig_atomic_t stop_flag;
-// Utility function to check if all bytes in buffer match expected value
-static int all_bytes_equal(const void *ptr, int c, size_t n) {
-    const unsigned char *p = ptr;
-    while (n-- > 0) if (*p++ != c) return 0;
-    return 1;
-}
-
 // Get current monotonic time in nanoseconds
 uint64_t get_monotonic_time() {
     struct timespec ts;
@@ -19,22 +14,464 @@ uint64_t get_monotonic_time() {
     return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
 }
 // Global statistics accessible from server_channel_send
-typedef struct {
-    uint64_t received_packets;
-    uint64_t lost_packets;
-    uint64_t total_bytes;
-    // Add other needed stats
-} udp_stats_t;
-
 udp_stats_t udp_stats = {0};
-// UDP Sender Thread
-void* udp_sendto(void* args_ptr) {
-    struct arguments* args = (struct arguments*)args_ptr;
-    if (args->packet_size > MAX_PACKET_SIZE) {
-        fprintf(stderr, "Packet size too large (max %d bytes)\n", MAX_PACKET_SIZE);
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Thread entry wrapper marking the stream as done when its loop returns
+static void* stream_main(void* stream_ptr) {
+    udp_stream_t* stream = (udp_stream_t*)stream_ptr;
+    stream->body(stream);
+    stream->cpu_ns = thread_cpu_ns();
+    atomic_store(&stream->done, 1);
+    return NULL;
+}
+
+// CPU time of the stream threads of a run
+static uint64_t streams_cpu_ns(const udp_stream_t* streams, int n) {
+    uint64_t sum = 0;
+    for (int i = 0; i < n; i++) sum += streams[i].cpu_ns;
+    return sum;
+}
+
+// Emit one interval record per stream (and their sum) every args->interval
+// seconds from the published counters, until all stream threads are done
+static void report_intervals(struct arguments* args, udp_stream_t* streams, int n, const char* side) {
+    uint64_t (*last)[4] = calloc(n, sizeof(*last));
+    if (!last) return;
+
+    const uint64_t interval_ns = (uint64_t)args->interval * NS_PER_SEC;
+    const uint64_t start = get_monotonic_time();
+    uint64_t next = start + interval_ns;
+    int k = 0;
+
+    while (1) {
+        int all_done = 1;
+        for (int i = 0; i < n; i++) {
+            if (!atomic_load(&streams[i].done)) all_done = 0;
+        }
+        if (all_done) break;
+
+        const uint64_t now = get_monotonic_time();
+        if (now < next) {
+            // Sleep in short steps so the end of the run is noticed quickly
+            uint64_t wait = next - now < 10000000ULL ? next - now : 10000000ULL;
+            struct timespec delay = {.tv_sec = 0, .tv_nsec = wait};
+            nanosleep(&delay, NULL);
+            continue;
+        }
+
+        result_record_t sum = {.type = RESULT_INTERVAL};
+        sum.metrics.side = side;
+        sum.metrics.direction = data_direction(args, side);
+        sum.metrics.stream_id = -1;
+        sum.metrics.start_s = (double)k * args->interval;
+        sum.metrics.end_s = (double)(k + 1) * args->interval;
+        for (int i = 0; i < n; i++) {
+            udp_progress_t* p = &streams[i].progress;
+            const uint64_t now_counts[4] = {
+                atomic_load_explicit(&p->packets, memory_order_relaxed),
+                atomic_load_explicit(&p->bytes, memory_order_relaxed),
+                atomic_load_explicit(&p->payload_bytes, memory_order_relaxed),
+                atomic_load_explicit(&p->lost, memory_order_relaxed)
+            };
+            result_record_t record = sum;
+            result_metrics_t* m = &record.metrics;
+            m->stream_id = i;
+            m->packets = now_counts[0] - last[i][0];
+            m->bytes = now_counts[1] - last[i][1];
+            m->payload_bytes = now_counts[2] - last[i][2];
+            m->lost = now_counts[3] - last[i][3];
+            memcpy(last[i], now_counts, sizeof(now_counts));
+
+            m->throughput_mbps = m->bytes * 8.0 / (args->interval * 1e6);
+            m->goodput_mbps = m->payload_bytes * 8.0 / (args->interval * 1e6);
+            m->loss_pct = m->packets + m->lost > 0 ? 100.0 * m->lost / (m->packets + m->lost) : 0.0;
+            if (n > 1) results_emit(&record);
+
+            sum.metrics.packets += m->packets;
+            sum.metrics.bytes += m->bytes;
+            sum.metrics.payload_bytes += m->payload_bytes;
+            sum.metrics.lost += m->lost;
+        }
+        result_metrics_t* m = &sum.metrics;
+        m->throughput_mbps = m->bytes * 8.0 / (args->interval * 1e6);
+        m->goodput_mbps = m->payload_bytes * 8.0 / (args->interval * 1e6);
+        m->loss_pct = m->packets + m->lost > 0 ? 100.0 * m->lost / (m->packets + m->lost) : 0.0;
+        results_emit(&sum);
+
+        k++;
+        next += interval_ns;
+    }
+    free(last);
+}
+
+// Streams currently running, receivers and senders, for udp_live_totals
+// and the metrics endpoint. The lock only covers the registry, taken as a
+// run starts and ends; the stream threads publish through atomics.
+static struct {
+    udp_stream_t* streams;
+    int count;
+} live[2];                              // Indexed by "is receiver"
+static pthread_mutex_t live_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int udp_receivers_ready(uint64_t timeout_ns) {
+    const uint64_t deadline = get_monotonic_time() + timeout_ns;
+    while (get_monotonic_time() < deadline) {
+        int ready = 0, failed = 0;
+        pthread_mutex_lock(&live_mutex);
+        const int registered = live[1].streams != NULL;
+        for (int i = 0; i < live[1].count; i++) {
+            if (atomic_load(&live[1].streams[i].ready)) ready++;
+            else if (atomic_load(&live[1].streams[i].done)) failed++;
+        }
+        const int count = live[1].count;
+        pthread_mutex_unlock(&live_mutex);
+        if (failed > 0) return -1;
+        if (registered && ready == count) return 0;
+        usleep(1000);
+    }
+    return -1;
+}
+
+int udp_live_totals(udp_live_t* out) {
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&live_mutex);
+    const int running = live[1].streams != NULL;
+    for (int i = 0; i < live[1].count; i++) {
+        udp_progress_t* p = &live[1].streams[i].progress;
+        out->packets += atomic_load_explicit(&p->packets, memory_order_relaxed);
+        out->lost += atomic_load_explicit(&p->lost, memory_order_relaxed);
+        out->owd_sum_ns += atomic_load_explicit(&p->owd_sum_ns, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&live_mutex);
+    return running ? 0 : -1;
+}
+
+int udp_live_snapshot(int receiver, udp_live_stream_t** out) {
+    pthread_mutex_lock(&live_mutex);
+    const int count = live[receiver != 0].count;
+    const udp_stream_t* streams = live[receiver != 0].streams;
+    *out = count > 0 ? calloc(count, sizeof(udp_live_stream_t)) : NULL;
+    if (count > 0 && !*out) {
+        pthread_mutex_unlock(&live_mutex);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        const udp_progress_t* p = &streams[i].progress;
+        udp_live_stream_t* s = &(*out)[i];
+        s->stream_id = streams[i].stream_id;
+        s->packets = atomic_load_explicit(&p->packets, memory_order_relaxed);
+        s->bytes = atomic_load_explicit(&p->bytes, memory_order_relaxed);
+        s->payload_bytes = atomic_load_explicit(&p->payload_bytes, memory_order_relaxed);
+        s->lost = atomic_load_explicit(&p->lost, memory_order_relaxed);
+        s->owd_sum_ns = atomic_load_explicit(&p->owd_sum_ns, memory_order_relaxed);
+        for (int b = 0; b < DELAY_BUCKETS; b++) {
+            s->delay_buckets[b] = atomic_load_explicit(&streams[i].stats.delay_buckets[b],
+                                                       memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&live_mutex);
+    return count;
+}
+
+// Start one thread per stream running fn, report intervals and wait for all of them
+static udp_stream_t* run_streams(struct arguments* args, int n, void* (*fn)(void*),
+                                 trace_writer_t* trace, rate_limiter_t* limiter, const char* side) {
+    udp_stream_t* streams = calloc(n, sizeof(udp_stream_t));
+    if (!streams) {
+        perror("Failed to allocate stream contexts");
         return NULL;
     }
 
+    // Senders begin together once every thread had time to set up
+    const uint64_t start_ns = get_monotonic_time() + STREAM_START_LEAD_NS +
+                              (uint64_t)args->wait_duration * NS_PER_SEC;
+    int started = 0;
+    for (int i = 0; i < n; i++) {
+        streams[i].args = args;
+        streams[i].start_ns = start_ns;
+        streams[i].stream_id = i;
+        streams[i].body = fn;
+        streams[i].limiter = limiter;
+        atomic_init(&streams[i].done, 0);
+        atomic_init(&streams[i].ready, 0);
+        trace_buffer_init(&streams[i].trace, trace);
+        if (pthread_create(&streams[i].thread, NULL, stream_main, &streams[i]) != 0) {
+            perror("Failed to start stream thread");
+            break;
+        }
+        started++;
+    }
+    // The feedback sender only reads the receivers (the bench runs both in one process)
+    const int receiver = strcmp(side, "receiver") == 0;
+    pthread_mutex_lock(&live_mutex);
+    live[receiver].streams = streams;
+    live[receiver].count = started;
+    pthread_mutex_unlock(&live_mutex);
+    report_intervals(args, streams, started, side);
+    for (int i = 0; i < started; i++) {
+        pthread_join(streams[i].thread, NULL);
+    }
+    pthread_mutex_lock(&live_mutex);
+    live[receiver].streams = NULL;
+    live[receiver].count = 0;
+    pthread_mutex_unlock(&live_mutex);
+    return streams;
+}
+
+void stream_wait_start(const udp_stream_t* stream) {
+    uint64_t now = get_monotonic_time();
+    while (stop_flag && now < stream->start_ns) {
+        const uint64_t wait = stream->start_ns - now;
+        struct timespec delay = {.tv_sec = wait / NS_PER_SEC, .tv_nsec = wait % NS_PER_SEC};
+        nanosleep(&delay, NULL);
+        now = get_monotonic_time();
+    }
+}
+
+void data_destination(const struct arguments* args, uint32_t index, int per_stream_port,
+                      struct sockaddr_in* addr, uint32_t* local_id) {
+    const server_target_t* target = args->num_targets > 0 ? &args->targets[0] : NULL;
+    uint32_t per_target = args->num_streams;
+    if (args->num_targets > 1) {
+        per_target = args->num_streams / args->num_targets;
+        target = &args->targets[index / per_target];
+    }
+    *local_id = index % per_target;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = inet_addr(target ? target->address : args->ip_address);
+    addr->sin_port = htons((target ? target->data_port : args->data_port) +
+                           (per_stream_port ? *local_id : 0));
+}
+
+int stream_source(int stream, int streams, int sources) {
+    return (int)((int64_t)stream * sources / streams);
+}
+
+int source_bind(int sock, const source_binding_t* source) {
+    if (source->device) {
+        if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, source->name, strlen(source->name) + 1) < 0) {
+            fprintf(stderr, "Error: Cannot bind to interface %s: %s\n", source->name, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+    struct sockaddr_in local = {.sin_family = AF_INET, .sin_addr = source->address};
+    if (bind(sock, (struct sockaddr*)&local, sizeof(local)) < 0) {
+        fprintf(stderr, "Error: Cannot bind to source address %s: %s\n", source->name, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int send_batch(int sock, int engine, struct mmsghdr* msgs, int count) {
+    if (engine == ENGINE_MMSG) {
+        int done = 0;
+        while (done < count) {
+            int sent = sendmmsg(sock, msgs + done, count - done, 0);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                    struct pollfd pfd = {.fd = sock, .events = POLLOUT};
+                    poll(&pfd, 1, 300);
+                    continue;
+                }
+                perror("UDP sendmmsg failed");
+                return -1;
+            }
+            done += sent;
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const struct msghdr* msg = &msgs[i].msg_hdr;
+        ssize_t sent = sendto(sock, msg->msg_iov->iov_base, msg->msg_iov->iov_len, 0,
+                             (const struct sockaddr*)msg->msg_name, msg->msg_namelen);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                struct pollfd pfd = {.fd = sock, .events = POLLOUT};
+                poll(&pfd, 1, 300);
+                i--;  // Retry same packet
+                continue;
+            }
+            perror("UDP sendto failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Hand a batch to the stream's impairment stage (-X), or straight to the socket
+static inline int stream_send(udp_stream_t* stream, int sock, int engine, struct mmsghdr* msgs, int count) {
+    return stream->impair ? impair_send(stream->impair, sock, engine, msgs, count)
+                          : send_batch(sock, engine, msgs, count);
+}
+
+// Sleep until until_ns; the impairment stage keeps releasing its packets meanwhile
+static void stream_sleep(udp_stream_t* stream, int sock, int engine, uint64_t now, uint64_t until_ns) {
+    if (stream->impair) {
+        impair_sleep(stream->impair, sock, engine, until_ns);
+        return;
+    }
+    struct timespec delay = {
+        .tv_sec = (until_ns - now) / NS_PER_SEC,
+        .tv_nsec = (until_ns - now) % NS_PER_SEC
+    };
+    nanosleep(&delay, NULL);
+}
+
+// Make the sender counters visible to the interval reporter
+static void publish_sent(udp_stream_t* stream) {
+    atomic_store_explicit(&stream->progress.packets, stream->sent_packets, memory_order_relaxed);
+    atomic_store_explicit(&stream->progress.bytes, stream->sent_bytes, memory_order_relaxed);
+    atomic_store_explicit(&stream->progress.payload_bytes,
+                          stream->sent_bytes - stream->sent_packets * sizeof(MiniIperfHeader),
+                          memory_order_relaxed);
+}
+
+// Sender loop driven by a precomputed schedule (traffic profiles, size mixes)
+static void send_scheduled(udp_stream_t* stream, int sock, MiniIperfPacket* batch,
+                           struct mmsghdr* msgs, struct iovec* iovs,
+                           const traffic_schedule_t* schedule) {
+    struct arguments* args = stream->args;
+    const uint64_t start_time = get_monotonic_time();
+    const uint64_t duration_ns = args->duration > 0 ? (uint64_t)args->duration * NS_PER_SEC : 0;
+    uint64_t cycle_start = start_time;
+    size_t next = 0;
+    uint64_t seq = 0;
+    uint32_t batch_seq = 0;
+
+    while (stop_flag) {
+        const uint64_t now = get_monotonic_time();
+
+        // Check experiment duration
+        if (duration_ns > 0 && now - start_time >= duration_ns) break;
+
+        // Collect every departure that is due, up to one batch
+        int count = 0;
+        while (count < args->batch_size) {
+            const schedule_entry_t* entry = &schedule->entries[next];
+            if (cycle_start + entry->offset_ns > now) break;
+
+            packet_stamp_header(&batch[count], seq, batch_seq, get_monotonic_time());
+            if (args->verify) packet_fill(&batch[count], seq, entry->size - sizeof(MiniIperfHeader));
+            iovs[count].iov_len = entry->size;
+            stream->sent_bytes += entry->size;
+            seq++;
+            count++;
+
+            if (++next == schedule->count) {
+                next = 0;
+                cycle_start += schedule->period_ns;
+            }
+        }
+
+        if (count == 0) {
+            // Nothing due yet: sleep until the next departure (at most 10ms)
+            uint64_t wait = cycle_start + schedule->entries[next].offset_ns - now;
+            if (wait > 10000000ULL) wait = 10000000ULL;
+            stream_sleep(stream, sock, args->engine, now, now + wait);
+            continue;
+        }
+
+        if (stream_send(stream, sock, args->engine, msgs, count) < 0) break;
+        batch_seq++;
+        stream->sent_packets += count;
+        publish_sent(stream);
+    }
+}
+
+// Constant bit rate sender loop. It is specialized at build time (see
+// SEND_LOOP) for every combination of its flags, which are constants in
+// each copy, so a feature a run does not use costs nothing per packet:
+//   paced       claim every batch from the shared token bucket
+//   fill         write the payload pattern (and CRC) for the receiver to check
+//   batch_stamp  stamp the whole batch once (-G) instead of every packet
+//   mmsg         send the batch with one sendmmsg(); otherwise each packet
+//                goes out in its own sendto(), stamped just before it
+FORCE_INLINE void send_loop(udp_stream_t* stream, int sock, MiniIperfPacket* batch,
+                            struct mmsghdr* msgs, const int paced, const int fill,
+                            const int batch_stamp, const int mmsg) {
+    const struct arguments* args = stream->args;
+    const int batch_size = args->batch_size;
+    const int payload_size = args->packet_size - sizeof(MiniIperfHeader);
+    const uint64_t batch_bytes = (uint64_t)batch_size * args->packet_size;
+    const uint64_t start_time = get_monotonic_time();
+    const uint64_t end_time = args->duration > 0 ?
+                              start_time + (uint64_t)args->duration * NS_PER_SEC : UINT64_MAX;
+    uint64_t seq = 0;
+    uint32_t batch_seq = 0;
+
+    while (stop_flag) {
+        uint64_t now = get_monotonic_time();
+
+        // Check experiment duration
+        if (now >= end_time) break;
+
+        // Throttle if bandwidth limited: wait for this batch's turn in the shared bucket
+        if (paced) {
+            const uint64_t departure = rate_limiter_claim(stream->limiter, batch_bytes, now);
+            now = get_monotonic_time();
+            if (departure > now) {
+                stream_sleep(stream, sock, mmsg ? ENGINE_MMSG : ENGINE_SENDTO, now, departure);
+                now = get_monotonic_time();
+            }
+        }
+
+        int failed = 0;
+        if (!mmsg && !batch_stamp) {
+            for (int i = 0; i < batch_size && !failed; i++) {
+                packet_stamp_header(&batch[i], seq + i, batch_seq, i == 0 ? now : get_monotonic_time());
+                if (fill) packet_fill(&batch[i], seq + i, payload_size);
+                failed = stream_send(stream, sock, ENGINE_SENDTO, &msgs[i], 1) < 0;
+            }
+        } else {
+            for (int i = 0; i < batch_size; i++) {
+                packet_stamp_header(&batch[i], seq + i, batch_seq,
+                                    batch_stamp || i == 0 ? now : get_monotonic_time());
+                if (fill) packet_fill(&batch[i], seq + i, payload_size);
+            }
+            failed = stream_send(stream, sock, mmsg ? ENGINE_MMSG : ENGINE_SENDTO, msgs, batch_size) < 0;
+        }
+        if (failed) break;
+        seq += batch_size;
+        batch_seq++;
+        stream->sent_packets += batch_size;
+        stream->sent_bytes += batch_bytes;
+        publish_sent(stream);
+    }
+}
+
+#define SEND_LOOP(paced, fill, batch_stamp, mmsg) \
+    static void send_loop_##paced##fill##batch_stamp##mmsg(udp_stream_t* stream, int sock, \
+                                                          MiniIperfPacket* batch, struct mmsghdr* msgs) { \
+        send_loop(stream, sock, batch, msgs, paced, fill, batch_stamp, mmsg); \
+    }
+SEND_LOOP(0, 0, 0, 0) SEND_LOOP(0, 0, 0, 1) SEND_LOOP(0, 0, 1, 0) SEND_LOOP(0, 0, 1, 1)
+SEND_LOOP(0, 1, 0, 0) SEND_LOOP(0, 1, 0, 1) SEND_LOOP(0, 1, 1, 0) SEND_LOOP(0, 1, 1, 1)
+SEND_LOOP(1, 0, 0, 0) SEND_LOOP(1, 0, 0, 1) SEND_LOOP(1, 0, 1, 0) SEND_LOOP(1, 0, 1, 1)
+SEND_LOOP(1, 1, 0, 0) SEND_LOOP(1, 1, 0, 1) SEND_LOOP(1, 1, 1, 0) SEND_LOOP(1, 1, 1, 1)
+
+// Indexed [paced][fill][batch_stamp][mmsg]
+static void (* const send_loops[2][2][2][2])(udp_stream_t*, int, MiniIperfPacket*, struct mmsghdr*) = {
+    {{{send_loop_0000, send_loop_0001}, {send_loop_0010, send_loop_0011}},
+     {{send_loop_0100, send_loop_0101}, {send_loop_0110, send_loop_0111}}},
+    {{{send_loop_1000, send_loop_1001}, {send_loop_1010, send_loop_1011}},
+     {{send_loop_1100, send_loop_1101}, {send_loop_1110, send_loop_1111}}}
+};
+
+// UDP Sender Thread (one per stream)
+static void* udp_send_stream(void* stream_ptr) {
+    udp_stream_t* stream = (udp_stream_t*)stream_ptr;
+    struct arguments* args = stream->args;
+    const int batch_size = args->batch_size;
+
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) {
         perror("UDP socket creation failed");
@@ -43,125 +480,436 @@ void* udp_sendto(void* args_ptr) {
     // Optimize socket settings
     int bufsize = 128 * 1024 * 1024;  // 128MB
     setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    // The kernel caps the request at net.core.wmem_max; keep what was granted
+    socklen_t optlen = sizeof(stream->sndbuf_bytes);
+    getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &stream->sndbuf_bytes, &optlen);
     int optval = 1;
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
     int prio = 6; // Higher priority
     setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &prio, sizeof(prio));
-
-    struct sockaddr_in server_addr = {
-        .sin_family = AF_INET,
-        .sin_port = htons(args->port + 1),
-        .sin_addr.s_addr = inet_addr(args->ip_address)
-    };
-
-    // Calculate payload size and validate
-    const int payload_size = args->packet_size - sizeof(MiniIperfHeader);
-    if (payload_size <= 0) {
-        fprintf(stderr, "Invalid packet size (must be > %zu)\n", sizeof(MiniIperfHeader));
+    // Leave through this stream's -I address or interface
+    if (args->num_sources > 0 &&
+        source_bind(sock, &args->sources[stream_source(stream->stream_id, args->num_streams,
+                                                       args->num_sources)]) != 0) {
         close(sock);
         return NULL;
     }
 
+    struct sockaddr_in server_addr;
+    uint32_t stream_id;
+    data_destination(args, stream->stream_id, 1, &server_addr, &stream_id);
+
+    const int payload_size = args->packet_size - sizeof(MiniIperfHeader);
+
     // Pre-fill packet batch
-    MiniIperfPacket* batch = malloc(BATCH_SIZE * sizeof(MiniIperfPacket));
-    if (!batch) {
+    MiniIperfPacket* batch = malloc(batch_size * sizeof(MiniIperfPacket));
+    struct mmsghdr* msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    struct iovec* iovs = calloc(batch_size, sizeof(struct iovec));
+    if (!batch || !msgs || !iovs) {
         perror("malloc failed");
+        free(batch);
+        free(msgs);
+        free(iovs);
         close(sock);
         return NULL;
     }
 
-    for (int i = 0; i < BATCH_SIZE; i++) {
-        MiniIperfHeader* header = &batch[i].header;
-        header->seq_num = 0;
-        header->timestamp_ns = 0;
+    for (int i = 0; i < batch_size; i++) {
+        packet_init(&batch[i], stream_id, args->crc);
         memset(batch[i].payload, 'A', payload_size);
+
+        // Scatter/gather descriptors reused by sendmmsg() for every batch
+        iovs[i].iov_base = &batch[i];
+        iovs[i].iov_len = args->packet_size;
+        msgs[i].msg_hdr.msg_name = &server_addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(server_addr);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
     }
 
-    if (args->wait_duration > 0) sleep(args->wait_duration);
+    // Precompute the departures before the clock starts
+    traffic_schedule_t schedule = {0};
+    const int scheduled = profile_uses_schedule(args);
+    if (scheduled && schedule_build(&schedule, args, stream->stream_id) < 0) {
+        free(batch);
+        free(msgs);
+        free(iovs);
+        close(sock);
+        return NULL;
+    }
 
-    const uint64_t start_time = get_monotonic_time();
-    uint32_t seq = 0;
-    const double packet_bits = args->packet_size * 8.0;
-    const double delay_ns = (packet_bits / args->bandwidth) * 1e9 * BATCH_SIZE;
+    // Packets pass the impairment stage on their way to the socket (-X)
+    if (args->impair.enabled && !(stream->impair = impair_open(stream))) {
+        if (scheduled) schedule_free(&schedule);
+        free(batch);
+        free(msgs);
+        free(iovs);
+        close(sock);
+        return NULL;
+    }
 
-    while (stop_flag) {
-        const uint64_t current_time = get_monotonic_time();
-        const double elapsed_sec = (current_time - start_time) / (double)NS_PER_SEC;
+    stream_wait_start(stream);
 
-        // Check experiment duration
-        if (args->duration > 0 && elapsed_sec >= args->duration) break;
-
-        // Update batch with current sequence numbers and timestamps
-        for (int i = 0; i < BATCH_SIZE; i++) {
-            MiniIperfHeader* header = &batch[i].header;
-            header->seq_num = htonl(seq + i);
-            header->timestamp_ns = get_monotonic_time();
-            
-            // Update payload pattern
-            memset(batch[i].payload, 'A' + ((seq + i) % 26), payload_size);
-        }
-
-        // Send batch with error handling
-        for (int i = 0; i < BATCH_SIZE; i++) {
-            ssize_t sent = sendto(sock, &batch[i], args->packet_size, 0,
-                                 (struct sockaddr*)&server_addr, sizeof(server_addr));
-            if (sent < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    struct pollfd pfd = {.fd = sock, .events = POLLOUT};
-                    poll(&pfd, 1, 300);
-                    i--;  // Retry same packet
-                    continue;
-                }
-                perror("UDP sendto failed");
-                free(batch);
-                close(sock);
-                return NULL;
-            }
-        }
-        seq += BATCH_SIZE;
-
-        // Throttle if bandwidth limited
-        if (args->bandwidth > 0) {
-            const uint64_t target_time = start_time + (uint64_t)((seq * packet_bits / args->bandwidth) * 1e9);
-            const uint64_t now = get_monotonic_time();
-            if (target_time > now) {
-                struct timespec delay = {
-                    .tv_sec = (target_time - now) / NS_PER_SEC,
-                    .tv_nsec = (target_time - now) % NS_PER_SEC
-                };
-                nanosleep(&delay, NULL);
-            }
-        }
+    if (scheduled) {
+        send_scheduled(stream, sock, batch, msgs, iovs, &schedule);
+    } else {
+        // The loop of this stream's configuration, chosen once
+        send_loops[stream->limiter != NULL][args->verify != 0][args->batch_stamp != 0]
+                  [args->engine == ENGINE_MMSG](stream, sock, batch, msgs);
     }
 
+    if (stream->impair) impair_close(stream->impair, sock, args->engine);
+    if (scheduled) schedule_free(&schedule);
+    free(iovs);
+    free(msgs);
     free(batch);
     close(sock);
     return NULL;
 }
 
-// UDP Receiver Thread
-void* udp_recv(void* args_ptr) {
+// UDP Sender: starts one sender thread per stream
+void* udp_sendto(void* args_ptr) {
     struct arguments* args = (struct arguments*)args_ptr;
     if (args->packet_size > MAX_PACKET_SIZE) {
-        fprintf(stderr, "Packet size too large\n");
+        fprintf(stderr, "Packet size too large (max %d bytes)\n", MAX_PACKET_SIZE);
+        return NULL;
+    }
+    // Calculate payload size and validate
+    if (args->packet_size <= (int)sizeof(MiniIperfHeader)) {
+        fprintf(stderr, "Invalid packet size (must be > %zu)\n", sizeof(MiniIperfHeader));
+        return NULL;
+    }
+
+    host_counters_t before, after;
+    cpu_sample_t cpu_before, cpu_after;
+    host_counters_sample(&before);
+    cpu_sample(&cpu_before);
+
+    // One token bucket for all streams keeps the total at -b (or at the
+    // rate the adaptive controller sets, with -b as the ceiling)
+    rate_limiter_t limiter;
+    rate_limiter_t* limiter_ptr = NULL;
+    if (args->bandwidth > 0) {
+        rate_limiter_init(&limiter, args->bandwidth, PACING_BURST_NS);
+        limiter_ptr = &limiter;
+        if (args->adapt != ADAPT_OFF) adapt_start(args, &limiter);
+    }
+
+    // The event engine drives all flows from a few workers, the others use one thread per stream
+    const int event = args->engine == ENGINE_EVENT;
+    const int threads = event ? args->workers : args->num_streams;
+
+    // The impairment stage logs what it does through the streams' trace buffers
+    trace_writer_t* impair_log = NULL;
+    const int impaired = args->impair.enabled && !event;
+    if (args->impair.enabled && event) {
+        fprintf(stderr, "Warning: Impairments (-X) are not applied to the event engine\n");
+    }
+    if (impaired && impair_start(args, &impair_log) != 0) {
+        if (limiter_ptr && args->adapt != ADAPT_OFF) adapt_stop();
         return NULL;
     }
- 
+    if (event) raise_fd_limit(args->num_streams + 64);
+    udp_stream_t* streams = run_streams(args, threads, event ? flow_send_worker : udp_send_stream,
+                                        impair_log, limiter_ptr, "sender");
+    if (limiter_ptr && args->adapt != ADAPT_OFF) adapt_stop();
+    if (impaired) impair_stop();
+    if (!streams) return NULL;
+
+    cpu_sample(&cpu_after);
+    host_counters_sample(&after);
+    udp_stats.host.sndbuf_errors = after.sndbuf_errors - before.sndbuf_errors;
+
+    udp_stats.sent_packets = 0;
+    udp_stats.sent_bytes = 0;
+    udp_stats.sndbuf_bytes = 0;
+    for (int i = 0; i < threads; i++) {
+        udp_stats.sent_packets += streams[i].sent_packets;
+        udp_stats.sent_bytes += streams[i].sent_bytes;
+        if (i == 0 || (uint64_t)streams[i].sndbuf_bytes < udp_stats.sndbuf_bytes) {
+            udp_stats.sndbuf_bytes = streams[i].sndbuf_bytes;
+        }
+    }
+    cpu_report(&cpu_before, &cpu_after, streams_cpu_ns(streams, threads), udp_stats.sent_bytes,
+               &udp_stats.tx_cpu);
+    free(streams);
+    return NULL;
+}
+
+// Must be called before received_packets counts the packet the sample belongs to
+void record_delay(udp_stream_stats_t* stats, int64_t delay_ns) {
+    if (stats->received_packets == 0 || delay_ns < stats->owd_min_ns) stats->owd_min_ns = delay_ns;
+    if (stats->received_packets == 0 || delay_ns > stats->owd_max_ns) stats->owd_max_ns = delay_ns;
+    stats->owd_sum_ns += delay_ns;
+
+    // Histogram bucket k holds delays up to 2^k us; with a single writer a
+    // relaxed load and store is enough
+    const uint64_t us = delay_ns > 0 ? (uint64_t)(delay_ns + 999) / 1000 : 0;
+    int bucket = us <= 1 ? 0 : 64 - __builtin_clzll(us - 1);
+    if (bucket >= DELAY_BUCKETS) bucket = DELAY_BUCKETS - 1;
+    atomic_store_explicit(&stats->delay_buckets[bucket],
+                          atomic_load_explicit(&stats->delay_buckets[bucket], memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    if (stats->owd_samples_count < stats->owd_samples_capacity) {
+        stats->owd_samples[stats->owd_samples_count++] = delay_ns;
+    } else {
+        // Reservoir sampling keeps a uniform sample of the whole run
+        const uint64_t slot = rng_next(&stats->owd_rng) % (stats->received_packets + 1);
+        if (slot < (uint64_t)stats->owd_samples_capacity) stats->owd_samples[slot] = delay_ns;
+    }
+}
+
+// Update the stream statistics with one packet that passed verification
+static void account_valid(udp_stream_t* stream, uint64_t seq, uint64_t sent_ns, ssize_t bytes,
+                          int payload_size, uint64_t recv_time) {
+    udp_stream_stats_t* stats = &stream->stats;
+    trace_log(&stream->trace, stream->stream_id, seq, sent_ns, recv_time, bytes, 0);
+
+    // One-way delay, meaningful when both clocks agree (same host or synced)
+    record_delay(stats, (int64_t)(recv_time - sent_ns));
+
+    // Update sequence tracking
+    if (stats->received_packets == 0) {
+        stats->first_ts = recv_time;
+        stats->expected_seq = seq + 1;
+        stats->last_arrival_ns = recv_time;
+    } else {
+        // Calculate and store inter-arrival time (jitter)
+        uint64_t delta_ns = recv_time - stats->last_arrival_ns;
+        double delta_ms = delta_ns / 1e6; // Convert to milliseconds
+
+        // Store jitter sample if we have space
+        if (stats->jitter_samples_count < stats->jitter_samples_capacity) {
+            stats->jitter_samples[stats->jitter_samples_count++] = delta_ms;
+            stats->jitter_sum += delta_ms;
+            stats->jitter_sum_squares += delta_ms * delta_ms;
+        }
+
+        // Update for next calculation
+        stats->last_arrival_ns = recv_time;
+
+        // Handle sequence numbers
+        if (seq == stats->expected_seq) {
+            stats->expected_seq++;
+        } else if (seq > stats->expected_seq) {
+            stats->lost_packets += (seq - stats->expected_seq);
+            stats->expected_seq = seq + 1;
+        } else {
+            stats->out_of_order++;
+        }
+    }
+
+    // Update statistics
+    stats->last_ts = recv_time;
+    stats->total_bytes += bytes;
+    stats->payload_bytes += payload_size;
+    stats->received_packets++;
+}
+
+// Validate one received packet (its payload too when verify is set) and
+// update the stream statistics
+FORCE_INLINE void account_packet(udp_stream_t* stream, const MiniIperfPacket* packet,
+                                 ssize_t bytes, uint64_t recv_time, const int verify) {
+    packet_info_t info;
+    if (packet_parse(packet, bytes, &info) != 0) {
+        stream->stats.corrupt_packets++;
+        return;
+    }
+    if (verify && !packet_verify(&info)) {
+        stream->stats.corrupt_packets++;
+        trace_log(&stream->trace, stream->stream_id, info.seq, info.sent_ns,
+                  recv_time, bytes, TRACE_FLAG_CORRUPT);
+        return;
+    }
+    account_valid(stream, info.seq, info.sent_ns, bytes, info.payload_size, recv_time);
+}
+
+// Verify one captured packet from its payload samples, as account_packet does
+void account_record(udp_stream_t* stream, const rx_record_t* record) {
+    const int payload_size = record->len - record->header_len;
+    int valid = record->verdict == RX_VERIFIED;
+    if (record->verdict == RX_CHECK_SAMPLES) {
+        const size_t sample = payload_size < (int)sizeof(record->head) ? (size_t)payload_size : sizeof(record->head);
+        valid = packet_samples_match(record->seq, record->head,
+                                     record->tail + sizeof(record->tail) - sample, sample);
+    }
+    if (!valid) {
+        stream->stats.corrupt_packets++;
+        if (record->header_len > 0) {
+            trace_log(&stream->trace, stream->stream_id, record->seq, record->sent_ns,
+                      record->recv_ns, record->len, TRACE_FLAG_CORRUPT);
+        }
+        return;
+    }
+    account_valid(stream, record->seq, record->sent_ns, record->len, payload_size, record->recv_ns);
+}
+
+// Capture side of the receive pipeline: turn a packet into a compact record.
+// A payload CRC is checked here, since the record does not carry the payload.
+FORCE_INLINE void capture_packet(udp_stream_t* stream, const MiniIperfPacket* packet, ssize_t bytes,
+                                 uint64_t recv_time, rx_record_t* record, const int verify) {
+    packet_info_t info;
+    record->len = bytes;
+    record->stream_id = stream->stream_id;
+    record->recv_ns = recv_time;
+    if (packet_parse(packet, bytes, &info) != 0) {
+        record->header_len = 0;
+        record->verdict = RX_CORRUPT;
+        return;
+    }
+    record->header_len = bytes - info.payload_size;
+    record->seq = info.seq;
+    record->sent_ns = info.sent_ns;
+    if (!verify) {
+        record->verdict = RX_VERIFIED;
+        return;
+    }
+    if (info.flags & PACKET_FLAG_CRC) {
+        record->verdict = packet_verify(&info) ? RX_VERIFIED : RX_CORRUPT;
+        return;
+    }
+    record->verdict = RX_CHECK_SAMPLES;
+    const size_t sample = info.payload_size < (int)sizeof(record->head) ?
+                          (size_t)info.payload_size : sizeof(record->head);
+    memcpy(record->head, info.payload, sample);
+    memcpy(record->tail + sizeof(record->tail) - sample, info.payload + info.payload_size - sample, sample);
+}
+
+// Make the receiver counters visible to the interval reporter and the feedback sender
+void publish_progress(udp_stream_t* stream) {
+    const udp_stream_stats_t* stats = &stream->stats;
+    atomic_store_explicit(&stream->progress.packets, stats->received_packets, memory_order_relaxed);
+    atomic_store_explicit(&stream->progress.bytes, stats->total_bytes, memory_order_relaxed);
+    atomic_store_explicit(&stream->progress.payload_bytes, stats->payload_bytes, memory_order_relaxed);
+    atomic_store_explicit(&stream->progress.lost, stats->lost_packets, memory_order_relaxed);
+    atomic_store_explicit(&stream->progress.owd_sum_ns, (uint64_t)(int64_t)stats->owd_sum_ns,
+                          memory_order_relaxed);
+}
+
+// Pick up the socket's drop counter (SO_RXQ_OVFL) and re-arm the descriptor
+// for the next receive
+static void read_drop_count(udp_stream_stats_t* stats, struct msghdr* msg) {
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(&stats->socket_drops, CMSG_DATA(c), sizeof(uint32_t));
+        }
+    }
+    msg->msg_controllen = RXQ_CONTROL_SIZE;
+    msg->msg_namelen = sizeof(struct sockaddr_in);
+}
+
+// Send received packets back to where they came from (transaction mode)
+static int echo_batch(int sock, int engine, struct mmsghdr* msgs, int count) {
+    for (int i = 0; i < count; i++) {
+        msgs[i].msg_hdr.msg_iov->iov_len = msgs[i].msg_len;
+        msgs[i].msg_hdr.msg_controllen = 0;
+    }
+    const int rc = send_batch(sock, engine, msgs, count);
+    for (int i = 0; i < count; i++) {
+        msgs[i].msg_hdr.msg_iov->iov_len = sizeof(MiniIperfPacket);
+        msgs[i].msg_hdr.msg_controllen = RXQ_CONTROL_SIZE;
+    }
+    return rc;
+}
+
+// Read up to one batch without blocking and account for it (or, with a
+// receive pipeline, hand it to the analysis threads as records). Specialized
+// like send_loop: verify checks the payloads, and mmsg reads a batch with
+// one recvmmsg() and one timestamp instead of one packet with recvmsg().
+// Returns the number of packets read, 0 if none were queued, -1 on error
+FORCE_INLINE int receive_batch(udp_stream_t* stream, int sock, MiniIperfPacket* packets,
+                               struct mmsghdr* msgs, rx_record_t* records, int batch_size,
+                               const int verify, const int mmsg) {
+    const int echo = stream->args->transactions > 0;
+    if (mmsg) {
+        int count = recvmmsg(sock, msgs, batch_size, MSG_DONTWAIT, NULL);
+        if (count < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+            perror("UDP recvmmsg failed");
+            return -1;
+        }
+        const uint64_t recv_time = get_monotonic_time();
+        if (stream->ring) {
+            for (int i = 0; i < count; i++) {
+                capture_packet(stream, &packets[i], msgs[i].msg_len, recv_time, &records[i], verify);
+                read_drop_count(&stream->stats, &msgs[i].msg_hdr);
+            }
+            rx_ring_push(stream->ring, records, count);
+            return count;
+        }
+        for (int i = 0; i < count; i++) {
+            account_packet(stream, &packets[i], msgs[i].msg_len, recv_time, verify);
+            read_drop_count(&stream->stats, &msgs[i].msg_hdr);
+        }
+        if (echo && echo_batch(sock, ENGINE_MMSG, msgs, count) < 0) return -1;
+        publish_progress(stream);
+        return count;
+    }
+
+    // Receive packet
+    ssize_t bytes = recvmsg(sock, &msgs[0].msg_hdr, MSG_DONTWAIT);
+    if (bytes < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        perror("UDP recvmsg failed");
+        return -1;
+    }
+    if (stream->ring) {
+        capture_packet(stream, packets, bytes, get_monotonic_time(), records, verify);
+        read_drop_count(&stream->stats, &msgs[0].msg_hdr);
+        rx_ring_push(stream->ring, records, 1);
+        return 1;
+    }
+    account_packet(stream, packets, bytes, get_monotonic_time(), verify);
+    read_drop_count(&stream->stats, &msgs[0].msg_hdr);
+    msgs[0].msg_len = bytes;
+    if (echo && echo_batch(sock, ENGINE_SENDTO, msgs, 1) < 0) return -1;
+    publish_progress(stream);
+    return 1;
+}
+
+#define RECEIVE_BATCH(verify, mmsg) \
+    static int receive_batch_##verify##mmsg(udp_stream_t* stream, int sock, MiniIperfPacket* packets, \
+                                            struct mmsghdr* msgs, rx_record_t* records, int batch_size) { \
+        return receive_batch(stream, sock, packets, msgs, records, batch_size, verify, mmsg); \
+    }
+RECEIVE_BATCH(0, 0) RECEIVE_BATCH(0, 1) RECEIVE_BATCH(1, 0) RECEIVE_BATCH(1, 1)
+
+// Indexed [verify][mmsg]
+static int (* const receive_batches[2][2])(udp_stream_t*, int, MiniIperfPacket*, struct mmsghdr*,
+                                           rx_record_t*, int) = {
+    {receive_batch_00, receive_batch_01}, {receive_batch_10, receive_batch_11}
+};
+
+// UDP Receiver Thread (one per stream)
+static void* udp_recv_stream(void* stream_ptr) {
+    udp_stream_t* stream = (udp_stream_t*)stream_ptr;
+    struct arguments* args = stream->args;
+    udp_stream_stats_t* stats = &stream->stats;
+    const int batch_size = args->engine == ENGINE_MMSG ? args->batch_size : 1;
+
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) {
         perror("UDP socket creation failed");
         return NULL;
     }
-    
+
     // Optimize socket settings
     int bufsize = 256 * 1024 * 1024;  // 256MB
     setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    // The kernel caps the request at net.core.rmem_max; keep what was granted
+    socklen_t optlen = sizeof(stats->rcvbuf_bytes);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &stats->rcvbuf_bytes, &optlen);
+    // Have every datagram carry the socket's count of receive queue overflows
+    int enable = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) < 0) {
+        perror("Warning: SO_RXQ_OVFL unavailable, socket drops are not counted");
+    }
     int prio = 6; // Higher priority
     setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &prio, sizeof(prio));
 
     struct sockaddr_in server_addr = {
         .sin_family = AF_INET,
-        .sin_port = htons(args->port + 1),
+        .sin_port = htons(args->data_port + stream->stream_id),
         .sin_addr.s_addr = INADDR_ANY
     };
 
@@ -171,164 +919,659 @@ void* udp_recv(void* args_ptr) {
         return NULL;
     }
 
-    // Statistics tracking with improved jitter measurement
-    struct {
-        uint64_t total_bytes;
-        uint64_t payload_bytes;
-        uint32_t received_packets;
-        uint32_t corrupt_packets;
-        uint32_t out_of_order;
-        uint32_t lost_packets;
-        uint32_t expected_seq;
-        uint64_t first_ts;
-        uint64_t last_ts;
-        
-        // Jitter calculation variables
-        uint64_t last_arrival_ns;       // Last packet arrival time
-        double *jitter_samples;         // Array to store inter-arrival differences
-        int jitter_samples_count;       // Number of samples collected
-        int jitter_samples_capacity;    // Size of jitter_samples array
-        double jitter_sum;              // Sum of all jitter values
-        double jitter_sum_squares;      // Sum of squares for stddev calculation
-    } stats = {0};
-
     // Initialize jitter samples array
-    stats.jitter_samples_capacity = 100000; // Adjust based on expected packet count
-    stats.jitter_samples = malloc(stats.jitter_samples_capacity * sizeof(double));
-    if (!stats.jitter_samples) {
-        perror("Failed to allocate jitter tracking array");
+    stats->jitter_samples_capacity = 100000; // Adjust based on expected packet count
+    stats->jitter_samples = malloc(stats->jitter_samples_capacity * sizeof(double));
+    stats->owd_samples_capacity = 100000;
+    stats->owd_samples = malloc(stats->owd_samples_capacity * sizeof(int64_t));
+    stats->owd_rng = 0x0DDULL + stream->stream_id;
+    MiniIperfPacket* packets = malloc(batch_size * sizeof(MiniIperfPacket));
+    struct mmsghdr* msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    struct iovec* iovs = calloc(batch_size, sizeof(struct iovec));
+    struct sockaddr_in* peers = calloc(batch_size, sizeof(struct sockaddr_in));
+    char* controls = calloc(batch_size, RXQ_CONTROL_SIZE);
+    rx_record_t* records = calloc(batch_size, sizeof(rx_record_t));
+    if (!stats->jitter_samples || !stats->owd_samples || !packets || !msgs || !iovs || !peers ||
+        !controls || !records) {
+        perror("Failed to allocate receive buffers");
+        free(stats->jitter_samples);
+        stats->jitter_samples = NULL;
+        free(stats->owd_samples);
+        stats->owd_samples = NULL;
+        free(packets);
+        free(msgs);
+        free(iovs);
+        free(peers);
+        free(controls);
+        free(records);
         close(sock);
         return NULL;
     }
-
-    MiniIperfPacket packet;
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
+    for (int i = 0; i < batch_size; i++) {
+        iovs[i].iov_base = &packets[i];
+        iovs[i].iov_len = sizeof(MiniIperfPacket);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        // Source addresses, needed to answer requests in transaction mode
+        msgs[i].msg_hdr.msg_name = &peers[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[i].msg_hdr.msg_control = controls + i * RXQ_CONTROL_SIZE;
+        msgs[i].msg_hdr.msg_controllen = RXQ_CONTROL_SIZE;
+    }
+    // Replies need the packets themselves, so transaction mode is analyzed inline
+    if (args->transactions == 0) stream->ring = rx_pipeline_attach(stream);
+    int (* const receive)(udp_stream_t*, int, MiniIperfPacket*, struct mmsghdr*, rx_record_t*, int) =
+        receive_batches[args->verify != 0][args->engine == ENGINE_MMSG];
+    atomic_store(&stream->ready, 1);
 
     while (stop_flag) {
         struct pollfd pfd = {.fd = sock, .events = POLLIN};
         int ready = poll(&pfd, 1, 10);  // 10ms timeout
-        
+
         if (ready < 0) {
+            if (errno == EINTR) continue;
             perror("poll failed");
             break;
         } else if (ready == 0) {
-            // Timeout - check if we should exit
-            if (args->duration > 0 && stats.received_packets > 0) {
-                const double elapsed = (get_monotonic_time() - stats.first_ts) / (double)NS_PER_SEC;
-                
-            }
-            continue;
+            continue;  // Timeout - re-check stop_flag
         }
 
-        // Receive packet
-        ssize_t bytes = recvfrom(sock, &packet, sizeof(packet), 0,
-                               (struct sockaddr*)&client_addr, &addr_len);
-        if (bytes <= 0) break;
+        if (receive(stream, sock, packets, msgs, records, batch_size) < 0) break;
+    }
 
-        const uint64_t recv_time = get_monotonic_time();
+    // Drain what is already queued so packets sent before the stop are not counted as lost
+    // (bounded, in case the sender is still running)
+    const uint64_t drain_end = get_monotonic_time() + 100000000ULL;
+    while (get_monotonic_time() < drain_end &&
+           receive(stream, sock, packets, msgs, records, batch_size) > 0);
 
-        // Validate packet
-        if (bytes < sizeof(MiniIperfHeader)) {
-            stats.corrupt_packets++;
-            continue;
-        }
+    // With a pipeline, the analysis thread still writes the trace
+    if (!stream->ring) trace_buffer_release(&stream->trace);
+    free(records);
+    free(controls);
+    free(peers);
+    free(iovs);
+    free(msgs);
+    free(packets);
+    close(sock);
+    return NULL;
+}
 
-        const uint32_t seq = ntohl(packet.header.seq_num);
-        const int payload_size = bytes - sizeof(MiniIperfHeader);
-        const uint8_t expected_char = 'A' + (seq % 26);
+static int compare_int64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
 
-        // Replace the full payload check with sampling
-        if (payload_size > 64) {
-            // Only check first/last 8 bytes to reduce CPU load
-            if (!all_bytes_equal(packet.payload, expected_char, 8) || 
-                !all_bytes_equal(packet.payload + payload_size - 8, expected_char, 8)) {
-                stats.corrupt_packets++;
-                continue;
-            }
-        } else {
-            if (!all_bytes_equal(packet.payload, expected_char, payload_size)) {
-                stats.corrupt_packets++;
-                continue;
-            }
+// Percentile of a sorted delay sample, in milliseconds
+static double owd_percentile_ms(const int64_t* sorted, int count, double p) {
+    if (count <= 0) return 0.0;
+    return sorted[(int)(p / 100.0 * (count - 1) + 0.5)] / 1e6;
+}
+
+// Compute the final metrics of one stream (or of the aggregate of all streams)
+static void stream_metrics(const udp_stream_stats_t* stats, int stream_id, result_metrics_t* m) {
+    double duration_sec = (stats->last_ts - stats->first_ts) / (double)NS_PER_SEC;
+    if (duration_sec <= 0) duration_sec = 1e-9;
+
+    memset(m, 0, sizeof(*m));
+    m->side = "receiver";
+    m->stream_id = stream_id;
+    m->end_s = duration_sec;
+    m->packets = stats->received_packets;
+    m->bytes = stats->total_bytes;
+    m->payload_bytes = stats->payload_bytes;
+    m->lost = stats->lost_packets;
+    m->corrupt = stats->corrupt_packets;
+    m->out_of_order = stats->out_of_order;
+    m->loss_pct = stats->expected_seq > 0 ? 100.0 * stats->lost_packets / stats->expected_seq : 0.0;
+    m->throughput_mbps = (stats->total_bytes * 8.0) / (duration_sec * 1e6);
+    m->goodput_mbps = (stats->payload_bytes * 8.0) / (duration_sec * 1e6);
+
+    // Calculate jitter statistics
+    if (stats->jitter_samples_count > 1) {
+        double mean_jitter = stats->jitter_sum / stats->jitter_samples_count;
+
+        // Calculate standard deviation
+        double variance = (stats->jitter_sum_squares / stats->jitter_samples_count) -
+                         (mean_jitter * mean_jitter);
+        m->jitter_ms = mean_jitter;
+        m->jitter_stddev_ms = sqrt(variance > 0 ? variance : 0);
+    }
+
+    if (stats->received_packets > 0) {
+        m->avg_owd_ms = stats->owd_sum_ns / stats->received_packets / 1e6;
+        m->min_owd_ms = stats->owd_min_ns / 1e6;
+        m->max_owd_ms = stats->owd_max_ns / 1e6;
+    }
+    if (stats->owd_samples_count > 0) {
+        // Sorting in place is fine, the run is over
+        qsort(stats->owd_samples, stats->owd_samples_count, sizeof(int64_t), compare_int64);
+        m->p50_owd_ms = owd_percentile_ms(stats->owd_samples, stats->owd_samples_count, 50);
+        m->p99_owd_ms = owd_percentile_ms(stats->owd_samples, stats->owd_samples_count, 99);
+    }
+}
+
+// Sum the statistics of streams [first, first + count), pooling their delay samples
+static void streams_total(const udp_stream_t* streams, int first, int count, udp_stream_stats_t* total) {
+    memset(total, 0, sizeof(*total));
+    for (int i = first; i < first + count; i++) {
+        const udp_stream_stats_t* s = &streams[i].stats;
+        if (s->received_packets > 0) {
+            const int none = total->received_packets == 0;
+            if (none || s->first_ts < total->first_ts) total->first_ts = s->first_ts;
+            if (s->last_ts > total->last_ts) total->last_ts = s->last_ts;
+            if (none || s->owd_min_ns < total->owd_min_ns) total->owd_min_ns = s->owd_min_ns;
+            if (none || s->owd_max_ns > total->owd_max_ns) total->owd_max_ns = s->owd_max_ns;
         }
+        total->total_bytes += s->total_bytes;
+        total->payload_bytes += s->payload_bytes;
+        total->received_packets += s->received_packets;
+        total->corrupt_packets += s->corrupt_packets;
+        total->out_of_order += s->out_of_order;
+        total->lost_packets += s->lost_packets;
+        total->expected_seq += s->expected_seq;
+        total->jitter_samples_count += s->jitter_samples_count;
+        total->jitter_sum += s->jitter_sum;
+        total->jitter_sum_squares += s->jitter_sum_squares;
+        total->owd_sum_ns += s->owd_sum_ns;
+        total->owd_samples_capacity += s->owd_samples_count;
+    }
 
-        // Update sequence tracking
-        if (stats.received_packets == 0) {
-            stats.first_ts = recv_time;
-            stats.expected_seq = seq + 1;
-            stats.last_arrival_ns = recv_time;
-        } else {
-            // Calculate and store inter-arrival time (jitter)
-            uint64_t delta_ns = recv_time - stats.last_arrival_ns;
-            double delta_ms = delta_ns / 1e6; // Convert to milliseconds
-            
-            // Store jitter sample if we have space
-            if (stats.jitter_samples_count < stats.jitter_samples_capacity) {
-                stats.jitter_samples[stats.jitter_samples_count++] = delta_ms;
-                stats.jitter_sum += delta_ms;
-                stats.jitter_sum_squares += delta_ms * delta_ms;
-            }
-            
-            // Update for next calculation
-            stats.last_arrival_ns = recv_time;
-            
-            // Handle sequence numbers
-            if (seq == stats.expected_seq) {
-                stats.expected_seq++;
-            } else if (seq > stats.expected_seq) {
-                stats.lost_packets += (seq - stats.expected_seq);
-                stats.expected_seq = seq + 1;
-            } else {
-                stats.out_of_order++;
-            }
+    // Pool the delay samples of the streams for the percentiles
+    total->owd_samples = malloc((total->owd_samples_capacity + 1) * sizeof(int64_t));
+    if (total->owd_samples) {
+        for (int i = first; i < first + count; i++) {
+            const udp_stream_stats_t* s = &streams[i].stats;
+            memcpy(total->owd_samples + total->owd_samples_count, s->owd_samples,
+                   s->owd_samples_count * sizeof(int64_t));
+            total->owd_samples_count += s->owd_samples_count;
         }
+    }
+}
 
-        // Update statistics
-        stats.last_ts = recv_time;
-        stats.total_bytes += bytes;
-        stats.payload_bytes += payload_size;
-        stats.received_packets++;
+// Summary of the streams of one client of an incast run; the kernel and CPU
+// figures are those of the whole run
+static void group_summary(const udp_stream_t* streams, int first, int count, experiment_stats_t* out) {
+    udp_stream_stats_t total;
+    streams_total(streams, first, count, &total);
+    result_metrics_t m;
+    stream_metrics(&total, -1, &m);
 
-        // Check experiment duration
-        if (args->duration > 0) {
-            const double elapsed = (recv_time - stats.first_ts) / (double)NS_PER_SEC;
+    udp_get_experiment_stats(out);
+    out->total_packets = total.received_packets;
+    out->lost_packets = total.lost_packets;
+    out->corrupt_packets = total.corrupt_packets;
+    out->out_of_order = total.out_of_order;
+    out->expected_packets = total.expected_seq;
+    out->total_bytes = total.total_bytes;
+    out->payload_bytes = total.payload_bytes;
+    out->duration_sec = m.end_s;
+    out->throughput_mbps = m.throughput_mbps;
+    out->goodput_mbps = m.goodput_mbps;
+    out->jitter_ms = m.jitter_ms;
+    out->jitter_stddev_ms = m.jitter_stddev_ms;
+    out->avg_owd_ms = m.avg_owd_ms;
+    out->min_owd_ms = m.min_owd_ms;
+    out->max_owd_ms = m.max_owd_ms;
+    out->owd_p50_ms = owd_percentile_ms(total.owd_samples, total.owd_samples_count, 50);
+    out->owd_p90_ms = owd_percentile_ms(total.owd_samples, total.owd_samples_count, 90);
+    out->owd_p99_ms = owd_percentile_ms(total.owd_samples, total.owd_samples_count, 99);
+    out->owd_p999_ms = owd_percentile_ms(total.owd_samples, total.owd_samples_count, 99.9);
+    out->socket_drops = 0;
+    for (int i = first; i < first + count; i++) out->socket_drops += streams[i].stats.socket_drops;
+    free(total.owd_samples);
+}
+
+void udp_get_experiment_stats(experiment_stats_t* out) {
+    double duration_sec = (udp_stats.last_ts - udp_stats.first_ts) / (double)NS_PER_SEC;
+    if (duration_sec <= 0) duration_sec = 1e-9;
+
+    memset(out, 0, sizeof(*out));
+    out->total_packets = udp_stats.received_packets;
+    out->lost_packets = udp_stats.lost_packets;
+    out->avg_owd_ms = udp_stats.avg_owd_ms;
+    out->min_owd_ms = udp_stats.min_owd_ms;
+    out->max_owd_ms = udp_stats.max_owd_ms;
+    out->jitter_ms = udp_stats.jitter_ms;
+    out->throughput_mbps = (udp_stats.total_bytes * 8.0) / (duration_sec * 1e6);
+    out->total_bytes = udp_stats.total_bytes;
+    out->payload_bytes = udp_stats.payload_bytes;
+    out->corrupt_packets = udp_stats.corrupt_packets;
+    out->out_of_order = udp_stats.out_of_order;
+    out->expected_packets = udp_stats.expected_packets;
+    out->duration_sec = duration_sec;
+    out->goodput_mbps = (udp_stats.payload_bytes * 8.0) / (duration_sec * 1e6);
+    out->jitter_stddev_ms = udp_stats.jitter_stddev_ms;
+    out->owd_p50_ms = udp_stats.owd_p50_ms;
+    out->owd_p90_ms = udp_stats.owd_p90_ms;
+    out->owd_p99_ms = udp_stats.owd_p99_ms;
+    out->owd_p999_ms = udp_stats.owd_p999_ms;
+    out->rcvbuf_bytes = udp_stats.rcvbuf_bytes;
+    out->socket_drops = udp_stats.socket_drops;
+    out->ring_overflows = udp_stats.ring_overflows;
+    out->rcvbuf_errors = udp_stats.host.rcvbuf_errors;
+    out->in_errors = udp_stats.host.in_errors;
+    out->backlog_drops = udp_stats.host.backlog_drops;
+    out->rx_cpu = udp_stats.rx_cpu;
+}
+
+// UDP Receiver: starts one receiver thread per stream and reports the results
+void* udp_recv(void* args_ptr) {
+    struct arguments* args = (struct arguments*)args_ptr;
+    if (args->packet_size > MAX_PACKET_SIZE) {
+        fprintf(stderr, "Packet size too large\n");
+        return NULL;
+    }
+
+    // Optional per-packet trace, sized from the expected packet count when known
+    trace_writer_t trace;
+    trace_writer_t* trace_ptr = NULL;
+    if (args->filename) {
+        uint64_t capacity = TRACE_DEFAULT_RECORDS;
+        if (args->bandwidth > 0 && args->duration > 0) {
+            capacity = (uint64_t)(1.25 * args->bandwidth * args->duration / (args->packet_size * 8.0))
+                       + (uint64_t)args->num_streams * TRACE_CHUNK_RECORDS;
+        }
+        if (trace_open(&trace, args->filename, capacity, args->num_streams) == 0) {
+            trace_ptr = &trace;
+        }
+    }
+
+    host_counters_t before, after;
+    cpu_sample_t cpu_before, cpu_after;
+    host_counters_sample(&before);
+    cpu_sample(&cpu_before);
+    const int event = args->engine == ENGINE_EVENT;
+    const int threads = event ? args->workers : args->num_streams;
+    // Capture and analysis on separate threads (-k); the event engine keeps its own
+    const int pipelined = args->analysis_threads > 0 && !event && args->transactions == 0 &&
+                          rx_pipeline_start(args) == 0;
+    udp_stream_t* streams = run_streams(args, threads, event ? flow_recv_worker : udp_recv_stream,
+                                        trace_ptr, NULL, "receiver");
+    uint64_t analysis_cpu_ns = 0;
+    udp_stats.ring_overflows = 0;
+    if (pipelined) rx_pipeline_stop(&udp_stats.ring_overflows, &analysis_cpu_ns);
+    cpu_sample(&cpu_after);
+    host_counters_sample(&after);
+    if (trace_ptr) trace_close(trace_ptr);
+    if (!streams) return NULL;
+
+    // Kernel view of the run: what the sockets were granted and dropped
+    udp_stats.host.in_datagrams = after.in_datagrams - before.in_datagrams;
+    udp_stats.host.in_errors = after.in_errors - before.in_errors;
+    udp_stats.host.rcvbuf_errors = after.rcvbuf_errors - before.rcvbuf_errors;
+    udp_stats.host.backlog_drops = after.backlog_drops - before.backlog_drops;
+    udp_stats.socket_drops = 0;
+    udp_stats.rcvbuf_bytes = 0;
+    for (int i = 0; i < threads; i++) {
+        const udp_stream_stats_t* s = &streams[i].stats;
+        udp_stats.socket_drops += s->socket_drops;
+        if (i == 0 || (uint64_t)s->rcvbuf_bytes < udp_stats.rcvbuf_bytes) {
+            udp_stats.rcvbuf_bytes = s->rcvbuf_bytes;
         }
     }
 
     // Calculate final statistics
-    double duration_sec = (stats.last_ts - stats.first_ts) / (double)NS_PER_SEC;
-    if (duration_sec <= 0) duration_sec = 1e-9;
+    udp_stream_stats_t total;
+    streams_total(streams, 0, threads, &total);
 
-    printf("\n=== UDP Statistics ===\n");
-    printf("Duration:        %.3f sec\n", duration_sec);
-    printf("Total Bytes:     %.2f MB\n", stats.total_bytes / 1e6);
-    printf("Payload Bytes:   %.2f MB\n", stats.payload_bytes / 1e6);
-    printf("Valid Packets:   %u\n", stats.received_packets);
-    printf("Corrupt Packets: %u\n", stats.corrupt_packets);
-    printf("Out-of-Order:    %u\n", stats.out_of_order);
-    printf("Lost Packets:    %u (%.2f%%)\n", stats.lost_packets,
-           stats.expected_seq > 0 ? 100.0 * stats.lost_packets / stats.expected_seq : 0.0);
-    printf("Throughput:      %.2f Mbps\n", (stats.total_bytes * 8.0) / (duration_sec * 1e6));
-    printf("Goodput:         %.2f Mbps\n", (stats.payload_bytes * 8.0) / (duration_sec * 1e6));
-    
-    // Calculate jitter statistics
-    if (stats.jitter_samples_count > 1) {
-        double mean_jitter = stats.jitter_sum / stats.jitter_samples_count;
-        
-        // Calculate standard deviation
-        double variance = (stats.jitter_sum_squares / stats.jitter_samples_count) - 
-                         (mean_jitter * mean_jitter);
-        double stddev = sqrt(variance > 0 ? variance : 0);
-        
-        printf("Avg Jitter:      %.3f ms\n", mean_jitter);
-        printf("Jitter Std Dev:  %.3f ms\n", stddev);
+    // Per-stream (or per-flow) reports; the summary is emitted by the end
+    // that runs the control session, once both ends' figures are known
+    result_record_t record = {.type = RESULT_STREAM};
+    if (event) {
+        flow_report(args, streams, threads);
+    } else if (args->num_streams > 1) {
+        for (int i = 0; i < threads; i++) {
+            stream_metrics(&streams[i].stats, i, &record.metrics);
+            record.metrics.direction = data_direction(args, "receiver");
+            results_emit(&record);
+        }
+    }
+    result_metrics_t* m = &record.metrics;
+    stream_metrics(&total, -1, m);
+
+    udp_stats.received_packets = total.received_packets;
+    udp_stats.lost_packets = total.lost_packets;
+    udp_stats.corrupt_packets = total.corrupt_packets;
+    udp_stats.out_of_order = total.out_of_order;
+    udp_stats.total_bytes = total.total_bytes;
+    udp_stats.payload_bytes = total.payload_bytes;
+    udp_stats.first_ts = total.first_ts;
+    udp_stats.last_ts = total.last_ts;
+    udp_stats.expected_packets = total.expected_seq;
+    udp_stats.jitter_ms = m->jitter_ms;
+    udp_stats.jitter_stddev_ms = m->jitter_stddev_ms;
+    udp_stats.avg_owd_ms = m->avg_owd_ms;
+    udp_stats.min_owd_ms = m->min_owd_ms;
+    udp_stats.max_owd_ms = m->max_owd_ms;
+    udp_stats.owd_p50_ms = owd_percentile_ms(total.owd_samples, total.owd_samples_count, 50);
+    udp_stats.owd_p90_ms = owd_percentile_ms(total.owd_samples, total.owd_samples_count, 90);
+    udp_stats.owd_p99_ms = owd_percentile_ms(total.owd_samples, total.owd_samples_count, 99);
+    udp_stats.owd_p999_ms = owd_percentile_ms(total.owd_samples, total.owd_samples_count, 99.9);
+    free(total.owd_samples);
+    cpu_report(&cpu_before, &cpu_after, streams_cpu_ns(streams, threads) + analysis_cpu_ns,
+               total.total_bytes, &udp_stats.rx_cpu);
+
+    // Each client's share of an incast run
+    if (!event && udp_stats.groups > 1) {
+        for (int g = 0, first = 0; g < udp_stats.groups; first += udp_stats.group_streams[g++]) {
+            group_summary(streams, first, udp_stats.group_streams[g], &udp_stats.group_stats[g]);
+        }
     }
-    
-    printf("========================\n");
 
     // Clean up
-    free(stats.jitter_samples);
+    for (int i = 0; i < threads; i++) {
+        free(streams[i].stats.jitter_samples);
+        free(streams[i].stats.owd_samples);
+        free(streams[i].flows);
+    }
+    free(streams);
+    return NULL;
+}
+
+#define TRANSACT_TIMEOUT_NS 100000000ULL  // Outstanding requests are presumed lost after this
+#define TRANSACT_SCAN_NS 10000000ULL      // How often the window is checked for expired requests
+
+// Requests in flight of one transaction stream: one slot per request with its
+// sequence number and send time, found by sequence number through an
+// open-addressed index (linear probing, buckets hold slot + 1, 0 when empty)
+typedef struct {
+    uint64_t* seqs;
+    uint64_t* sent_ns;                    // 0 for a free slot
+    int* free_slots;
+    int free_count;
+    uint32_t* index;
+    uint32_t mask;
+} transact_window_t;
+
+static int window_init(transact_window_t* w, int size) {
+    uint32_t buckets = 1;
+    while (buckets < 2U * size) buckets <<= 1;
+    w->seqs = calloc(size, sizeof(uint64_t));
+    w->sent_ns = calloc(size, sizeof(uint64_t));
+    w->free_slots = malloc(size * sizeof(int));
+    w->index = calloc(buckets, sizeof(uint32_t));
+    w->mask = buckets - 1;
+    w->free_count = size;
+    if (!w->seqs || !w->sent_ns || !w->free_slots || !w->index) return -1;
+    for (int i = 0; i < size; i++) w->free_slots[i] = size - 1 - i;
+    return 0;
+}
+
+static void window_free(transact_window_t* w) {
+    free(w->seqs);
+    free(w->sent_ns);
+    free(w->free_slots);
+    free(w->index);
+}
+
+static void window_add(transact_window_t* w, uint64_t seq, uint64_t now) {
+    const int slot = w->free_slots[--w->free_count];
+    w->seqs[slot] = seq;
+    w->sent_ns[slot] = now;
+    uint32_t bucket = (uint32_t)seq & w->mask;
+    while (w->index[bucket]) bucket = (bucket + 1) & w->mask;
+    w->index[bucket] = slot + 1;
+}
+
+// Bucket of the request with this sequence number, or -1 when it is not in flight
+static int64_t window_find(const transact_window_t* w, uint64_t seq) {
+    for (uint32_t bucket = (uint32_t)seq & w->mask; w->index[bucket]; bucket = (bucket + 1) & w->mask) {
+        if (w->seqs[w->index[bucket] - 1] == seq) return bucket;
+    }
+    return -1;
+}
+
+// Free the request in this bucket, shifting back the entries probed past it
+static void window_remove(transact_window_t* w, uint32_t bucket) {
+    const int slot = w->index[bucket] - 1;
+    w->sent_ns[slot] = 0;
+    w->free_slots[w->free_count++] = slot;
+    uint32_t hole = bucket;
+    for (uint32_t next = (hole + 1) & w->mask; w->index[next]; next = (next + 1) & w->mask) {
+        const uint32_t home = (uint32_t)w->seqs[w->index[next] - 1] & w->mask;
+        if (((next - home) & w->mask) >= ((next - hole) & w->mask)) {
+            w->index[hole] = w->index[next];
+            hole = next;
+        }
+    }
+    w->index[hole] = 0;
+}
+
+// Expire the requests sent before deadline; returns how many
+static int window_expire(transact_window_t* w, int size, uint64_t deadline) {
+    int expired = 0;
+    for (int slot = 0; slot < size; slot++) {
+        if (w->sent_ns[slot] == 0 || w->sent_ns[slot] > deadline) continue;
+        window_remove(w, window_find(w, w->seqs[slot]));
+        expired++;
+    }
+    return expired;
+}
+
+// Account one reply of the transaction mode; the round-trip time goes into
+// the delay fields of the stream statistics
+static void account_reply(udp_stream_stats_t* stats, const MiniIperfPacket* packet,
+                          ssize_t bytes, uint64_t recv_time) {
+    record_delay(stats, (int64_t)(recv_time - be64toh(packet->header.timestamp_ns)));
+    stats->total_bytes += bytes;
+    stats->received_packets++;
+}
+
+// Transaction Thread (one per stream): keeps args->transactions requests in
+// flight and sends a new one for every reply, in batches of replies
+static void* udp_transact_stream(void* stream_ptr) {
+    udp_stream_t* stream = (udp_stream_t*)stream_ptr;
+    struct arguments* args = stream->args;
+    udp_stream_stats_t* stats = &stream->stats;
+    const int window = args->transactions;
+    const int payload_size = args->packet_size - sizeof(MiniIperfHeader);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("UDP socket creation failed");
+        return NULL;
+    }
+    struct sockaddr_in server_addr;
+    uint32_t stream_id;
+    data_destination(args, stream->stream_id, 1, &server_addr, &stream_id);
+
+    // Requests and replies each get a window of buffers and descriptors
+    MiniIperfPacket* requests = malloc(window * sizeof(MiniIperfPacket));
+    MiniIperfPacket* replies = malloc(window * sizeof(MiniIperfPacket));
+    struct mmsghdr* tx_msgs = calloc(window, sizeof(struct mmsghdr));
+    struct mmsghdr* rx_msgs = calloc(window, sizeof(struct mmsghdr));
+    struct iovec* iovs = calloc(2 * window, sizeof(struct iovec));
+    stats->owd_samples_capacity = 100000;
+    stats->owd_samples = malloc(stats->owd_samples_capacity * sizeof(int64_t));
+    stats->owd_rng = 0x0DDULL + stream->stream_id;
+    transact_window_t pending;
+    const int pending_ok = window_init(&pending, window) == 0;
+    if (!requests || !replies || !tx_msgs || !rx_msgs || !iovs || !stats->owd_samples || !pending_ok) {
+        perror("Failed to allocate transaction buffers");
+        window_free(&pending);
+        free(requests);
+        free(replies);
+        free(tx_msgs);
+        free(rx_msgs);
+        free(iovs);
+        free(stats->owd_samples);
+        stats->owd_samples = NULL;
+        close(sock);
+        return NULL;
+    }
+    for (int i = 0; i < window; i++) {
+        packet_init(&requests[i], stream_id, args->crc);
+        iovs[i].iov_base = &requests[i];
+        iovs[i].iov_len = args->packet_size;
+        tx_msgs[i].msg_hdr.msg_name = &server_addr;
+        tx_msgs[i].msg_hdr.msg_namelen = sizeof(server_addr);
+        tx_msgs[i].msg_hdr.msg_iov = &iovs[i];
+        tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        iovs[window + i].iov_base = &replies[i];
+        iovs[window + i].iov_len = sizeof(MiniIperfPacket);
+        rx_msgs[i].msg_hdr.msg_iov = &iovs[window + i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    stream_wait_start(stream);
+
+    const uint64_t start_time = get_monotonic_time();
+    uint64_t last_scan = start_time;
+    uint64_t seq = 0;
+    uint32_t batch_seq = 0;
+    stats->first_ts = start_time;
+
+    while (stop_flag) {
+        const uint64_t now = get_monotonic_time();
+        if (args->duration > 0 && now - start_time >= (uint64_t)args->duration * NS_PER_SEC) break;
+
+        // Requests unanswered for TRANSACT_TIMEOUT_NS are lost, and free their slot
+        if (now - last_scan >= TRANSACT_SCAN_NS) {
+            if (now > TRANSACT_TIMEOUT_NS) {
+                stats->lost_packets += window_expire(&pending, window, now - TRANSACT_TIMEOUT_NS);
+            }
+            last_scan = now;
+        }
+
+        // Top the window up with one batch of new requests
+        const int count = pending.free_count;
+        if (count > 0) {
+            for (int i = 0; i < count; i++) {
+                const uint64_t sent = get_monotonic_time();
+                packet_stamp(&requests[i], seq, batch_seq, sent, payload_size);
+                window_add(&pending, seq++, sent);
+            }
+            if (send_batch(sock, args->engine, tx_msgs, count) < 0) break;
+            batch_seq++;
+            stream->sent_packets += count;
+            stream->sent_bytes += (uint64_t)count * args->packet_size;
+        }
+
+        struct pollfd pfd = {.fd = sock, .events = POLLIN};
+        int ready = poll(&pfd, 1, 10);  // 10ms timeout
+        if (ready < 0 && errno != EINTR) {
+            perror("poll failed");
+            break;
+        }
+        if (ready <= 0) continue;
+
+        int received;
+        if (args->engine == ENGINE_MMSG) {
+            received = recvmmsg(sock, rx_msgs, window, MSG_DONTWAIT, NULL);
+        } else {
+            ssize_t bytes = recv(sock, replies, sizeof(MiniIperfPacket), MSG_DONTWAIT);
+            rx_msgs[0].msg_len = bytes;
+            received = bytes < 0 ? -1 : 1;
+        }
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+            perror("UDP receive failed");
+            break;
+        }
+
+        const uint64_t recv_time = get_monotonic_time();
+        for (int i = 0; i < received; i++) {
+            if (rx_msgs[i].msg_len < sizeof(MiniIperfHeader)) continue;
+            // Late replies to requests already counted as lost are ignored
+            const int64_t bucket = window_find(&pending, be64toh(replies[i].header.seq_num));
+            if (bucket < 0) continue;
+            window_remove(&pending, bucket);
+            account_reply(stats, &replies[i], rx_msgs[i].msg_len, recv_time);
+        }
+
+        atomic_store_explicit(&stream->progress.packets, stats->received_packets, memory_order_relaxed);
+        atomic_store_explicit(&stream->progress.bytes, stats->total_bytes, memory_order_relaxed);
+        atomic_store_explicit(&stream->progress.lost, stats->lost_packets, memory_order_relaxed);
+    }
+    stats->last_ts = get_monotonic_time();
+
+    window_free(&pending);
+    free(requests);
+    free(replies);
+    free(tx_msgs);
+    free(rx_msgs);
+    free(iovs);
     close(sock);
     return NULL;
-}
\ No newline at end of file
+}
+
+// Transaction rate and latency of one stream (or of all streams pooled)
+static void transact_metrics(udp_stream_stats_t* stats, int stream_id, result_transact_t* t) {
+    memset(t, 0, sizeof(*t));
+    t->stream_id = stream_id;
+    t->duration_s = (stats->last_ts - stats->first_ts) / (double)NS_PER_SEC;
+    t->transactions = stats->received_packets;
+    t->timeouts = stats->lost_packets;
+    t->tps = t->duration_s > 0 ? t->transactions / t->duration_s : 0.0;
+    if (stats->owd_samples_count > 0) {
+        qsort(stats->owd_samples, stats->owd_samples_count, sizeof(int64_t), compare_int64);
+        t->p50_ms = owd_percentile_ms(stats->owd_samples, stats->owd_samples_count, 50);
+        t->p90_ms = owd_percentile_ms(stats->owd_samples, stats->owd_samples_count, 90);
+        t->p99_ms = owd_percentile_ms(stats->owd_samples, stats->owd_samples_count, 99);
+        t->p999_ms = owd_percentile_ms(stats->owd_samples, stats->owd_samples_count, 99.9);
+    }
+    if (stats->received_packets > 0) {
+        t->min_ms = stats->owd_min_ns / 1e6;
+        t->max_ms = stats->owd_max_ns / 1e6;
+    }
+}
+
+// UDP Transactions: starts one transaction thread per stream and reports the results
+void* udp_transact(void* args_ptr) {
+    struct arguments* args = (struct arguments*)args_ptr;
+    if (args->packet_size > MAX_PACKET_SIZE || args->packet_size <= (int)sizeof(MiniIperfHeader)) {
+        fprintf(stderr, "Invalid packet size (must be > %zu and <= %d)\n",
+                sizeof(MiniIperfHeader), MAX_PACKET_SIZE);
+        return NULL;
+    }
+
+    udp_stream_t* streams = run_streams(args, args->num_streams, udp_transact_stream, NULL, NULL, "client");
+    if (!streams) return NULL;
+
+    // Pool the streams: total rate over the longest stream, latency over all samples
+    udp_stream_stats_t total = {0};
+    udp_stats.sent_packets = 0;
+    udp_stats.sent_bytes = 0;
+    for (int i = 0; i < args->num_streams; i++) {
+        const udp_stream_stats_t* s = &streams[i].stats;
+        udp_stats.sent_packets += streams[i].sent_packets;
+        udp_stats.sent_bytes += streams[i].sent_bytes;
+        if (i == 0 || s->first_ts < total.first_ts) total.first_ts = s->first_ts;
+        if (s->last_ts > total.last_ts) total.last_ts = s->last_ts;
+        if (s->received_packets > 0) {
+            const int first = total.received_packets == 0;
+            if (first || s->owd_min_ns < total.owd_min_ns) total.owd_min_ns = s->owd_min_ns;
+            if (first || s->owd_max_ns > total.owd_max_ns) total.owd_max_ns = s->owd_max_ns;
+        }
+        total.received_packets += s->received_packets;
+        total.lost_packets += s->lost_packets;
+        total.owd_samples_capacity += s->owd_samples_count;
+    }
+    total.owd_samples = malloc((total.owd_samples_capacity + 1) * sizeof(int64_t));
+    if (total.owd_samples) {
+        for (int i = 0; i < args->num_streams; i++) {
+            const udp_stream_stats_t* s = &streams[i].stats;
+            memcpy(total.owd_samples + total.owd_samples_count, s->owd_samples,
+                   s->owd_samples_count * sizeof(int64_t));
+            total.owd_samples_count += s->owd_samples_count;
+        }
+    }
+
+    result_record_t record = {.type = RESULT_TRANSACT};
+    if (args->num_streams > 1) {
+        for (int i = 0; i < args->num_streams; i++) {
+            transact_metrics(&streams[i].stats, i, &record.transact);
+            results_emit(&record);
+        }
+    }
+    transact_metrics(&total, -1, &record.transact);
+    results_emit(&record);
+
+    free(total.owd_samples);
+    for (int i = 0; i < args->num_streams; i++) {
+        free(streams[i].stats.owd_samples);
+    }
+    free(streams);
+    return NULL;
+}
@@ -0,0 +1,253 @@
+/*
+ * mini_iperf_analyze.c
+ *
+ * Offline analyzer for the binary per-packet traces written by the
+ * Mini-Iperf receiver (-f). For every stream it reports loss bursts,
+ * reordering and duplicates, the one-way delay distribution of all
+ * packets, and optionally a time series of rate and delay.
+ *
+ * One-way delay is rx_ts - tx_ts; both timestamps come from different
+ * hosts' monotonic clocks unless the run was over loopback, so absolute
+ * values are only meaningful on a single host (variation always is).
+ *
+ * The ground-truth log of the sender's impairment stage (-X log=) has the
+ * same format, with the release time as rx_ts; the packets it dropped are
+ * counted, not analyzed.
+ *
+ * Usage: mini_iperf_analyze [-i interval_ms] [-s] trace.bin
+ */
+#include "mini_iperf.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+/* Per-stream accumulators */
+typedef struct {
+    uint64_t* seqs;             // Sequence numbers in arrival order
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t corrupt;
+    uint64_t reordered;         // Arrived after a higher sequence number
+    uint64_t max_reorder_dist;  // Largest distance behind the highest seen
+    uint64_t highest_seq;
+} stream_acc_t;
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_i64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const int64_t* sorted, uint64_t n, double p) {
+    if (n == 0) return 0.0;
+    uint64_t idx = (uint64_t)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[idx] / 1e6;
+}
+
+static int push_seq(stream_acc_t* acc, uint64_t seq) {
+    if (acc->count == acc->capacity) {
+        uint64_t capacity = acc->capacity ? acc->capacity * 2 : 4096;
+        uint64_t* seqs = realloc(acc->seqs, capacity * sizeof(uint64_t));
+        if (!seqs) return -1;
+        acc->seqs = seqs;
+        acc->capacity = capacity;
+    }
+    if (acc->count > 0 && seq < acc->highest_seq) {
+        acc->reordered++;
+        if (acc->highest_seq - seq > acc->max_reorder_dist) {
+            acc->max_reorder_dist = acc->highest_seq - seq;
+        }
+    } else {
+        acc->highest_seq = seq;
+    }
+    acc->seqs[acc->count++] = seq;
+    return 0;
+}
+
+/* Print loss/burst/duplicate figures of one stream */
+static void report_stream(int id, stream_acc_t* acc) {
+    if (acc->count == 0) return;
+    qsort(acc->seqs, acc->count, sizeof(uint64_t), compare_u64);
+
+    uint64_t duplicates = 0, lost = 0, bursts = 0, max_burst = 0;
+    for (uint64_t i = 1; i < acc->count; i++) {
+        const uint64_t gap = acc->seqs[i] - acc->seqs[i - 1];
+        if (gap == 0) {
+            duplicates++;
+        } else if (gap > 1) {
+            lost += gap - 1;
+            bursts++;
+            if (gap - 1 > max_burst) max_burst = gap - 1;
+        }
+    }
+    const uint64_t expected = acc->seqs[acc->count - 1] - acc->seqs[0] + 1;
+
+    printf("\n=== Stream %d ===\n", id);
+    printf("Received:        %lu\n", acc->count);
+    printf("Corrupt:         %lu\n", acc->corrupt);
+    printf("Duplicates:      %lu\n", duplicates);
+    printf("Lost:            %lu (%.4f%%)\n", lost, 100.0 * lost / expected);
+    printf("Loss Bursts:     %lu (mean %.2f, max %lu packets)\n", bursts,
+           bursts ? (double)lost / bursts : 0.0, max_burst);
+    printf("Reordered:       %lu (max distance %lu)\n", acc->reordered, acc->max_reorder_dist);
+}
+
+static void print_analyze_help(void) {
+    printf("Usage: mini_iperf_analyze [options] <trace file>\n\n");
+    printf("  -i <ms>         Time series interval in milliseconds (default: 1000)\n");
+    printf("  -s              Print the time series as CSV\n");
+    printf("  -h              Show this help message\n");
+}
+
+int main(int argc, char* argv[]) {
+    int interval_ms = 1000;
+    int print_series = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:sh")) != -1) {
+        switch (opt) {
+            case 'i':
+                interval_ms = atoi(optarg);
+                if (interval_ms <= 0) {
+                    fprintf(stderr, "Error: Interval must be positive\n");
+                    return 1;
+                }
+                break;
+            case 's':
+                print_series = 1;
+                break;
+            case 'h':
+            default:
+                print_analyze_help();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        print_analyze_help();
+        return 1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    if (fd < 0) {
+        perror("Error: Cannot open trace file");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < TRACE_HEADER_SIZE) {
+        fprintf(stderr, "Error: Not a Mini-Iperf trace file\n");
+        close(fd);
+        return 1;
+    }
+    char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error: Cannot map trace file");
+        return 1;
+    }
+
+    const trace_file_header_t* header = (const trace_file_header_t*)map;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != TRACE_VERSION || header->record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "Error: Unsupported trace format\n");
+        munmap(map, st.st_size);
+        return 1;
+    }
+    uint64_t slots = header->record_slots;
+    const uint64_t max_slots = (st.st_size - TRACE_HEADER_SIZE) / sizeof(trace_record_t);
+    if (slots > max_slots) slots = max_slots;
+    const trace_record_t* records = (const trace_record_t*)(map + TRACE_HEADER_SIZE);
+
+    const int num_streams = header->num_streams > 0 ? header->num_streams : 1;
+    stream_acc_t* streams = calloc(num_streams, sizeof(stream_acc_t));
+    int64_t* owd = malloc((slots ? slots : 1) * sizeof(int64_t));
+    if (!streams || !owd) {
+        perror("Error: Memory allocation failed");
+        return 1;
+    }
+
+    // First pass: per-stream sequence analysis and delay samples
+    uint64_t valid = 0, dropped = 0, first_rx = UINT64_MAX, last_rx = 0;
+    for (uint64_t i = 0; i < slots; i++) {
+        const trace_record_t* r = &records[i];
+        if (!(r->flags & TRACE_FLAG_VALID) || r->stream_id >= (uint32_t)num_streams) continue;
+        if (r->flags & TRACE_FLAG_DROPPED) {
+            dropped++;
+            continue;
+        }
+        stream_acc_t* acc = &streams[r->stream_id];
+        if (r->flags & TRACE_FLAG_CORRUPT) {
+            acc->corrupt++;
+            continue;
+        }
+        if (push_seq(acc, r->seq) < 0) {
+            perror("Error: Memory allocation failed");
+            return 1;
+        }
+        owd[valid++] = (int64_t)(r->rx_ts - r->tx_ts);
+        if (r->rx_ts < first_rx) first_rx = r->rx_ts;
+        if (r->rx_ts > last_rx) last_rx = r->rx_ts;
+    }
+
+    printf("=== Trace %s ===\n", argv[optind]);
+    printf("Streams:         %d\n", num_streams);
+    printf("Records:         %lu\n", valid);
+    printf("Dropped Records: %lu\n", header->dropped_records);
+    if (dropped > 0) printf("Impaired Drops:  %lu\n", dropped);
+
+    for (int s = 0; s < num_streams; s++) {
+        report_stream(s, &streams[s]);
+    }
+
+    if (valid > 0) {
+        qsort(owd, valid, sizeof(int64_t), compare_i64);
+        printf("\n=== One-Way Delay ===\n");
+        printf("Min:             %.3f ms\n", owd[0] / 1e6);
+        printf("P50:             %.3f ms\n", percentile_ms(owd, valid, 50));
+        printf("P90:             %.3f ms\n", percentile_ms(owd, valid, 90));
+        printf("P99:             %.3f ms\n", percentile_ms(owd, valid, 99));
+        printf("P99.9:           %.3f ms\n", percentile_ms(owd, valid, 99.9));
+        printf("Max:             %.3f ms\n", owd[valid - 1] / 1e6);
+    }
+
+    // Second pass: rate and mean delay per interval
+    if (print_series && valid > 0) {
+        const uint64_t interval_ns = (uint64_t)interval_ms * 1000000ULL;
+        const uint64_t buckets = (last_rx - first_rx) / interval_ns + 1;
+        uint64_t* packets = calloc(buckets, sizeof(uint64_t));
+        uint64_t* bytes = calloc(buckets, sizeof(uint64_t));
+        double* owd_sum = calloc(buckets, sizeof(double));
+        if (!packets || !bytes || !owd_sum) {
+            perror("Error: Memory allocation failed");
+            return 1;
+        }
+        for (uint64_t i = 0; i < slots; i++) {
+            const trace_record_t* r = &records[i];
+            if (!(r->flags & TRACE_FLAG_VALID) || (r->flags & (TRACE_FLAG_CORRUPT | TRACE_FLAG_DROPPED))) continue;
+            if (r->stream_id >= (uint32_t)num_streams) continue;
+            const uint64_t b = (r->rx_ts - first_rx) / interval_ns;
+            packets[b]++;
+            bytes[b] += r->size;
+            owd_sum[b] += (int64_t)(r->rx_ts - r->tx_ts) / 1e6;
+        }
+        printf("\ntime_s,packets,mbps,avg_owd_ms\n");
+        for (uint64_t b = 0; b < buckets; b++) {
+            printf("%.3f,%lu,%.3f,%.3f\n", b * interval_ms / 1000.0, packets[b],
+                   bytes[b] * 8.0 / (interval_ms * 1000.0),
+                   packets[b] ? owd_sum[b] / packets[b] : 0.0);
+        }
+        free(packets);
+        free(bytes);
+        free(owd_sum);
+    }
+
+    for (int s = 0; s < num_streams; s++) free(streams[s].seqs);
+    free(streams);
+    free(owd);
+    munmap(map, st.st_size);
+    return 0;
+}